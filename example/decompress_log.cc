@@ -0,0 +1,32 @@
+#include "logger.h"
+
+// Decompress a rotated log file (`.gz` or `.zz`).
+// The dictionary of `.zz` file is found next to it, unless it is given.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: %s <file.gz|file.zz> [<output>] [<dictionary>]\n",
+               argv[0]);
+        return 1;
+    }
+
+    std::string src_path = argv[1];
+    std::string dst_path;
+    if (argc >= 3) {
+        dst_path = argv[2];
+    } else {
+        // Remove the extension.
+        size_t last_dot = src_path.rfind(".");
+        if (last_dot == std::string::npos) {
+            printf("cannot decide the output file name\n");
+            return 1;
+        }
+        dst_path = src_path.substr(0, last_dot);
+    }
+    std::string dict_path = (argc >= 4) ? argv[3] : "";
+
+    if (SimpleLogger::decompressFile(src_path, dst_path, dict_path) != 0) {
+        printf("failed to decompress %s\n", src_path.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -36,16 +36,25 @@
 #endif
 
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <queue>
+#include <unordered_map>
 
 #include <assert.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #if defined(__linux__) || defined(__APPLE__)
     #include <dirent.h>
+    #include <fcntl.h>
+    #include <limits.h>
     #ifdef __linux__
+        #include <linux/futex.h>
         #include <pthread.h>
     #endif
+    #include <sys/resource.h>
     #include <sys/syscall.h>
     #include <sys/types.h>
     #include <unistd.h>
@@ -56,8 +65,30 @@
     #undef max
 #endif
 
+// io_uring by system calls, without liburing.
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+            #define _SL_IO_URING (1)
+        #endif
+    #endif
+#endif
+
+// In-process compression of rotated log files.
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    #include <zlib.h>
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 #ifndef _CLM_DEFINED
 #define _CLM_DEFINED (1)
@@ -120,12 +151,50 @@ std::mutex SimpleLoggerMgr::displayLock;
 // Number of digits to represent thread IDs (Linux only).
 std::atomic<int> tid_digits(2);
 
+// To assign a unique ID to each logger.
+std::atomic<uint64_t> logger_id_counter(0);
+
+// `true` if this thread is in `SimpleLoggerMgr::flushAllLoggers()`.
+thread_local bool _flushing_all_loggers = false;
+
+// Each block of a split file becomes an independent gzip member,
+// written to its own part file so as not to keep it in memory.
+// Members are concatenated in order, which is still a valid gzip file.
+struct SimpleLogger::CompSplit {
+    CompSplit(size_t file_num, const std::string& path, uint64_t size,
+              size_t num_blocks)
+        : fileNum(file_num)
+        , srcPath(path)
+        , fileSize(size)
+        , numBlocks(num_blocks)
+        , numLeft(num_blocks)
+        , failed(false)
+        {}
+    std::string getPartPath(size_t block_idx) const {
+        return srcPath + ".gz.part" + std::to_string(block_idx);
+    }
+    size_t fileNum;
+    std::string srcPath;
+    uint64_t fileSize;
+    size_t numBlocks;
+    std::atomic<size_t> numLeft;
+    std::atomic<bool> failed;
+};
+
+// Block size to split a rotated file for parallel compression.
+static const uint64_t COMP_BLOCK_SIZE = 4 * 1024 * 1024;
+// Buffer size to concatenate the compressed blocks.
+static const size_t COMP_COPY_BUF_SIZE = 256 * 1024;
+
 struct SimpleLoggerMgr::CompElem {
     CompElem(uint64_t num, SimpleLogger* logger)
-        : fileNum(num), targetLogger(logger)
+        : fileNum(num), targetLogger(logger), blockIdx(0)
         {}
     uint64_t fileNum;
     SimpleLogger* targetLogger;
+    // Set if this is a block of a split file.
+    std::shared_ptr<SimpleLogger::CompSplit> split;
+    size_t blockIdx;
 };
 
 SimpleLoggerMgr::TimeInfo::TimeInfo(std::tm* src)
@@ -164,6 +233,1303 @@ SimpleLoggerMgr::TimeInfo::TimeInfo(std::chrono::system_clock::time_point now) {
     usec = us_epoch % 1000;
 }
 
+// ==========================================
+// Formatting kernels.
+
+// "00", "01", ..., "99".
+static const char DIGIT_PAIRS[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline size_t _num_digits(uint64_t val) {
+    size_t num = 1;
+    for (;;) {
+        if (val < 10) return num;
+        if (val < 100) return num + 1;
+        if (val < 1000) return num + 2;
+        if (val < 10000) return num + 3;
+        val /= 10000;
+        num += 4;
+    }
+}
+
+size_t SimpleLogger::Fmt::formatUnsigned(char* buf, uint64_t val) {
+    size_t len = _num_digits(val);
+    char* pp = buf + len;
+    // Two digits at a time.
+    while (val >= 100) {
+        size_t idx = (val % 100) * 2;
+        val /= 100;
+        pp -= 2;
+        memcpy(pp, DIGIT_PAIRS + idx, 2);
+    }
+    if (val >= 10) {
+        memcpy(pp - 2, DIGIT_PAIRS + val * 2, 2);
+    } else {
+        *(pp - 1) = '0' + val;
+    }
+    return len;
+}
+
+size_t SimpleLogger::Fmt::formatSigned(char* buf, int64_t val) {
+    if (val >= 0) return formatUnsigned(buf, val);
+    *buf = '-';
+    // Negate as unsigned, to handle the minimum value.
+    return formatUnsigned(buf + 1, 0ULL - (uint64_t)val) + 1;
+}
+
+void SimpleLogger::Fmt::formatFixed(char* buf, uint32_t val, int width) {
+    char* pp = buf + width;
+    for (; width >= 2; width -= 2) {
+        pp -= 2;
+        memcpy(pp, DIGIT_PAIRS + (val % 100) * 2, 2);
+        val /= 100;
+    }
+    if (width) *(pp - 1) = '0' + (val % 10);
+}
+
+// Convert 8 nibbles into 8 lower-case hex characters at once
+// (SWAR), the most significant nibble in the highest byte.
+static inline uint64_t _hex_swar(uint32_t val) {
+    uint64_t xx = val;
+    // Spread nibbles into bytes.
+    xx = ((xx & 0xffff0000ULL) << 16) | (xx & 0x0000ffffULL);
+    xx = ((xx & 0x0000ff000000ff00ULL) << 8) | (xx & 0x000000ff000000ffULL);
+    xx = ((xx & 0x00f000f000f000f0ULL) << 4) | (xx & 0x000f000f000f000fULL);
+    // 0x01 for each byte >= 10.
+    uint64_t alpha = ((xx + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL;
+    return xx + 0x3030303030303030ULL + alpha * ('a' - '0' - 10);
+}
+
+static inline void _store_be64(char* buf, uint64_t val) {
+#if defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    val = __builtin_bswap64(val);
+    memcpy(buf, &val, 8);
+#else
+    for (size_t ii = 0; ii < 8; ++ii) buf[ii] = (char)(val >> (56 - ii * 8));
+#endif
+}
+
+static inline int _num_hex_digits(uint64_t val) {
+#if defined(__GNUC__)
+    return val ? (64 - __builtin_clzll(val) + 3) / 4 : 1;
+#else
+    int num = 1;
+    while (val >>= 4) num++;
+    return num;
+#endif
+}
+
+size_t SimpleLogger::Fmt::formatHex(char* buf, uint64_t val, int min_width) {
+    char tmp[16];
+    _store_be64(tmp, _hex_swar(val >> 32));
+    _store_be64(tmp + 8, _hex_swar((uint32_t)val));
+    int len = std::max(_num_hex_digits(val), std::min(min_width, 16));
+    memcpy(buf, tmp + 16 - len, len);
+    return len;
+}
+
+static const double POW10_DOUBLE[] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                      1e5, 1e6, 1e7, 1e8, 1e9};
+static const uint32_t POW10_INT[] = {1, 10, 100, 1000, 10000,
+                                     100000, 1000000, 10000000,
+                                     100000000, 1000000000};
+
+// Quick check before probing short decimal numbers: if `val` is
+// `mm / 10^kk`, it is also near an integer when scaled by the largest
+// `10^kk` (up to 9) that keeps it under 10^15, within a few ULPs.
+static bool _may_be_short_decimal(double val) {
+    int kk = 9;
+    while (kk > 1 && val * POW10_DOUBLE[kk] >= 1e15) --kk;
+    double scaled = val * POW10_DOUBLE[kk];
+    double diff = scaled - (double)(uint64_t)(scaled + 0.5);
+    return std::fabs(diff) <= scaled * 1e-15;
+}
+
+// Shortest round-trip digits of a double: Schubfach algorithm
+// (R. Giulietti, "The Schubfach way to render doubles").
+
+// `g(e) = floor(10^e * 2^-b) + 1` in [2^127, 2^128) as {high, low},
+// where `b = floor(log2(10^e)) - 127`, for `e` in [-292, 324].
+static const int POW10_G_MIN = -292;
+static const uint64_t POW10_G[][2] = {
+    { 0xFF77B1FCBEBCDC4F, 0x25E8E89C13BB0F7B },
+    { 0x9FAACF3DF73609B1, 0x77B191618C54E9AD },
+    { 0xC795830D75038C1D, 0xD59DF5B9EF6A2418 },
+    { 0xF97AE3D0D2446F25, 0x4B0573286B44AD1E },
+    { 0x9BECCE62836AC577, 0x4EE367F9430AEC33 },
+    { 0xC2E801FB244576D5, 0x229C41F793CDA740 },
+    { 0xF3A20279ED56D48A, 0x6B43527578C11110 },
+    { 0x9845418C345644D6, 0x830A13896B78AAAA },
+    { 0xBE5691EF416BD60C, 0x23CC986BC656D554 },
+    { 0xEDEC366B11C6CB8F, 0x2CBFBE86B7EC8AA9 },
+    { 0x94B3A202EB1C3F39, 0x7BF7D71432F3D6AA },
+    { 0xB9E08A83A5E34F07, 0xDAF5CCD93FB0CC54 },
+    { 0xE858AD248F5C22C9, 0xD1B3400F8F9CFF69 },
+    { 0x91376C36D99995BE, 0x23100809B9C21FA2 },
+    { 0xB58547448FFFFB2D, 0xABD40A0C2832A78B },
+    { 0xE2E69915B3FFF9F9, 0x16C90C8F323F516D },
+    { 0x8DD01FAD907FFC3B, 0xAE3DA7D97F6792E4 },
+    { 0xB1442798F49FFB4A, 0x99CD11CFDF41779D },
+    { 0xDD95317F31C7FA1D, 0x40405643D711D584 },
+    { 0x8A7D3EEF7F1CFC52, 0x482835EA666B2573 },
+    { 0xAD1C8EAB5EE43B66, 0xDA3243650005EED0 },
+    { 0xD863B256369D4A40, 0x90BED43E40076A83 },
+    { 0x873E4F75E2224E68, 0x5A7744A6E804A292 },
+    { 0xA90DE3535AAAE202, 0x711515D0A205CB37 },
+    { 0xD3515C2831559A83, 0x0D5A5B44CA873E04 },
+    { 0x8412D9991ED58091, 0xE858790AFE9486C3 },
+    { 0xA5178FFF668AE0B6, 0x626E974DBE39A873 },
+    { 0xCE5D73FF402D98E3, 0xFB0A3D212DC81290 },
+    { 0x80FA687F881C7F8E, 0x7CE66634BC9D0B9A },
+    { 0xA139029F6A239F72, 0x1C1FFFC1EBC44E81 },
+    { 0xC987434744AC874E, 0xA327FFB266B56221 },
+    { 0xFBE9141915D7A922, 0x4BF1FF9F0062BAA9 },
+    { 0x9D71AC8FADA6C9B5, 0x6F773FC3603DB4AA },
+    { 0xC4CE17B399107C22, 0xCB550FB4384D21D4 },
+    { 0xF6019DA07F549B2B, 0x7E2A53A146606A49 },
+    { 0x99C102844F94E0FB, 0x2EDA7444CBFC426E },
+    { 0xC0314325637A1939, 0xFA911155FEFB5309 },
+    { 0xF03D93EEBC589F88, 0x793555AB7EBA27CB },
+    { 0x96267C7535B763B5, 0x4BC1558B2F3458DF },
+    { 0xBBB01B9283253CA2, 0x9EB1AAEDFB016F17 },
+    { 0xEA9C227723EE8BCB, 0x465E15A979C1CADD },
+    { 0x92A1958A7675175F, 0x0BFACD89EC191ECA },
+    { 0xB749FAED14125D36, 0xCEF980EC671F667C },
+    { 0xE51C79A85916F484, 0x82B7E12780E7401B },
+    { 0x8F31CC0937AE58D2, 0xD1B2ECB8B0908811 },
+    { 0xB2FE3F0B8599EF07, 0x861FA7E6DCB4AA16 },
+    { 0xDFBDCECE67006AC9, 0x67A791E093E1D49B },
+    { 0x8BD6A141006042BD, 0xE0C8BB2C5C6D24E1 },
+    { 0xAECC49914078536D, 0x58FAE9F773886E19 },
+    { 0xDA7F5BF590966848, 0xAF39A475506A899F },
+    { 0x888F99797A5E012D, 0x6D8406C952429604 },
+    { 0xAAB37FD7D8F58178, 0xC8E5087BA6D33B84 },
+    { 0xD5605FCDCF32E1D6, 0xFB1E4A9A90880A65 },
+    { 0x855C3BE0A17FCD26, 0x5CF2EEA09A550680 },
+    { 0xA6B34AD8C9DFC06F, 0xF42FAA48C0EA481F },
+    { 0xD0601D8EFC57B08B, 0xF13B94DAF124DA27 },
+    { 0x823C12795DB6CE57, 0x76C53D08D6B70859 },
+    { 0xA2CB1717B52481ED, 0x54768C4B0C64CA6F },
+    { 0xCB7DDCDDA26DA268, 0xA9942F5DCF7DFD0A },
+    { 0xFE5D54150B090B02, 0xD3F93B35435D7C4D },
+    { 0x9EFA548D26E5A6E1, 0xC47BC5014A1A6DB0 },
+    { 0xC6B8E9B0709F109A, 0x359AB6419CA1091C },
+    { 0xF867241C8CC6D4C0, 0xC30163D203C94B63 },
+    { 0x9B407691D7FC44F8, 0x79E0DE63425DCF1E },
+    { 0xC21094364DFB5636, 0x985915FC12F542E5 },
+    { 0xF294B943E17A2BC4, 0x3E6F5B7B17B2939E },
+    { 0x979CF3CA6CEC5B5A, 0xA705992CEECF9C43 },
+    { 0xBD8430BD08277231, 0x50C6FF782A838354 },
+    { 0xECE53CEC4A314EBD, 0xA4F8BF5635246429 },
+    { 0x940F4613AE5ED136, 0x871B7795E136BE9A },
+    { 0xB913179899F68584, 0x28E2557B59846E40 },
+    { 0xE757DD7EC07426E5, 0x331AEADA2FE589D0 },
+    { 0x9096EA6F3848984F, 0x3FF0D2C85DEF7622 },
+    { 0xB4BCA50B065ABE63, 0x0FED077A756B53AA },
+    { 0xE1EBCE4DC7F16DFB, 0xD3E8495912C62895 },
+    { 0x8D3360F09CF6E4BD, 0x64712DD7ABBBD95D },
+    { 0xB080392CC4349DEC, 0xBD8D794D96AACFB4 },
+    { 0xDCA04777F541C567, 0xECF0D7A0FC5583A1 },
+    { 0x89E42CAAF9491B60, 0xF41686C49DB57245 },
+    { 0xAC5D37D5B79B6239, 0x311C2875C522CED6 },
+    { 0xD77485CB25823AC7, 0x7D633293366B828C },
+    { 0x86A8D39EF77164BC, 0xAE5DFF9C02033198 },
+    { 0xA8530886B54DBDEB, 0xD9F57F830283FDFD },
+    { 0xD267CAA862A12D66, 0xD072DF63C324FD7C },
+    { 0x8380DEA93DA4BC60, 0x4247CB9E59F71E6E },
+    { 0xA46116538D0DEB78, 0x52D9BE85F074E609 },
+    { 0xCD795BE870516656, 0x67902E276C921F8C },
+    { 0x806BD9714632DFF6, 0x00BA1CD8A3DB53B7 },
+    { 0xA086CFCD97BF97F3, 0x80E8A40ECCD228A5 },
+    { 0xC8A883C0FDAF7DF0, 0x6122CD128006B2CE },
+    { 0xFAD2A4B13D1B5D6C, 0x796B805720085F82 },
+    { 0x9CC3A6EEC6311A63, 0xCBE3303674053BB1 },
+    { 0xC3F490AA77BD60FC, 0xBEDBFC4411068A9D },
+    { 0xF4F1B4D515ACB93B, 0xEE92FB5515482D45 },
+    { 0x991711052D8BF3C5, 0x751BDD152D4D1C4B },
+    { 0xBF5CD54678EEF0B6, 0xD262D45A78A0635E },
+    { 0xEF340A98172AACE4, 0x86FB897116C87C35 },
+    { 0x9580869F0E7AAC0E, 0xD45D35E6AE3D4DA1 },
+    { 0xBAE0A846D2195712, 0x8974836059CCA10A },
+    { 0xE998D258869FACD7, 0x2BD1A438703FC94C },
+    { 0x91FF83775423CC06, 0x7B6306A34627DDD0 },
+    { 0xB67F6455292CBF08, 0x1A3BC84C17B1D543 },
+    { 0xE41F3D6A7377EECA, 0x20CABA5F1D9E4A94 },
+    { 0x8E938662882AF53E, 0x547EB47B7282EE9D },
+    { 0xB23867FB2A35B28D, 0xE99E619A4F23AA44 },
+    { 0xDEC681F9F4C31F31, 0x6405FA00E2EC94D5 },
+    { 0x8B3C113C38F9F37E, 0xDE83BC408DD3DD05 },
+    { 0xAE0B158B4738705E, 0x9624AB50B148D446 },
+    { 0xD98DDAEE19068C76, 0x3BADD624DD9B0958 },
+    { 0x87F8A8D4CFA417C9, 0xE54CA5D70A80E5D7 },
+    { 0xA9F6D30A038D1DBC, 0x5E9FCF4CCD211F4D },
+    { 0xD47487CC8470652B, 0x7647C32000696720 },
+    { 0x84C8D4DFD2C63F3B, 0x29ECD9F40041E074 },
+    { 0xA5FB0A17C777CF09, 0xF468107100525891 },
+    { 0xCF79CC9DB955C2CC, 0x7182148D4066EEB5 },
+    { 0x81AC1FE293D599BF, 0xC6F14CD848405531 },
+    { 0xA21727DB38CB002F, 0xB8ADA00E5A506A7D },
+    { 0xCA9CF1D206FDC03B, 0xA6D90811F0E4851D },
+    { 0xFD442E4688BD304A, 0x908F4A166D1DA664 },
+    { 0x9E4A9CEC15763E2E, 0x9A598E4E043287FF },
+    { 0xC5DD44271AD3CDBA, 0x40EFF1E1853F29FE },
+    { 0xF7549530E188C128, 0xD12BEE59E68EF47D },
+    { 0x9A94DD3E8CF578B9, 0x82BB74F8301958CF },
+    { 0xC13A148E3032D6E7, 0xE36A52363C1FAF02 },
+    { 0xF18899B1BC3F8CA1, 0xDC44E6C3CB279AC2 },
+    { 0x96F5600F15A7B7E5, 0x29AB103A5EF8C0BA },
+    { 0xBCB2B812DB11A5DE, 0x7415D448F6B6F0E8 },
+    { 0xEBDF661791D60F56, 0x111B495B3464AD22 },
+    { 0x936B9FCEBB25C995, 0xCAB10DD900BEEC35 },
+    { 0xB84687C269EF3BFB, 0x3D5D514F40EEA743 },
+    { 0xE65829B3046B0AFA, 0x0CB4A5A3112A5113 },
+    { 0x8FF71A0FE2C2E6DC, 0x47F0E785EABA72AC },
+    { 0xB3F4E093DB73A093, 0x59ED216765690F57 },
+    { 0xE0F218B8D25088B8, 0x306869C13EC3532D },
+    { 0x8C974F7383725573, 0x1E414218C73A13FC },
+    { 0xAFBD2350644EEACF, 0xE5D1929EF90898FB },
+    { 0xDBAC6C247D62A583, 0xDF45F746B74ABF3A },
+    { 0x894BC396CE5DA772, 0x6B8BBA8C328EB784 },
+    { 0xAB9EB47C81F5114F, 0x066EA92F3F326565 },
+    { 0xD686619BA27255A2, 0xC80A537B0EFEFEBE },
+    { 0x8613FD0145877585, 0xBD06742CE95F5F37 },
+    { 0xA798FC4196E952E7, 0x2C48113823B73705 },
+    { 0xD17F3B51FCA3A7A0, 0xF75A15862CA504C6 },
+    { 0x82EF85133DE648C4, 0x9A984D73DBE722FC },
+    { 0xA3AB66580D5FDAF5, 0xC13E60D0D2E0EBBB },
+    { 0xCC963FEE10B7D1B3, 0x318DF905079926A9 },
+    { 0xFFBBCFE994E5C61F, 0xFDF17746497F7053 },
+    { 0x9FD561F1FD0F9BD3, 0xFEB6EA8BEDEFA634 },
+    { 0xC7CABA6E7C5382C8, 0xFE64A52EE96B8FC1 },
+    { 0xF9BD690A1B68637B, 0x3DFDCE7AA3C673B1 },
+    { 0x9C1661A651213E2D, 0x06BEA10CA65C084F },
+    { 0xC31BFA0FE5698DB8, 0x486E494FCFF30A63 },
+    { 0xF3E2F893DEC3F126, 0x5A89DBA3C3EFCCFB },
+    { 0x986DDB5C6B3A76B7, 0xF89629465A75E01D },
+    { 0xBE89523386091465, 0xF6BBB397F1135824 },
+    { 0xEE2BA6C0678B597F, 0x746AA07DED582E2D },
+    { 0x94DB483840B717EF, 0xA8C2A44EB4571CDD },
+    { 0xBA121A4650E4DDEB, 0x92F34D62616CE414 },
+    { 0xE896A0D7E51E1566, 0x77B020BAF9C81D18 },
+    { 0x915E2486EF32CD60, 0x0ACE1474DC1D122F },
+    { 0xB5B5ADA8AAFF80B8, 0x0D819992132456BB },
+    { 0xE3231912D5BF60E6, 0x10E1FFF697ED6C6A },
+    { 0x8DF5EFABC5979C8F, 0xCA8D3FFA1EF463C2 },
+    { 0xB1736B96B6FD83B3, 0xBD308FF8A6B17CB3 },
+    { 0xDDD0467C64BCE4A0, 0xAC7CB3F6D05DDBDF },
+    { 0x8AA22C0DBEF60EE4, 0x6BCDF07A423AA96C },
+    { 0xAD4AB7112EB3929D, 0x86C16C98D2C953C7 },
+    { 0xD89D64D57A607744, 0xE871C7BF077BA8B8 },
+    { 0x87625F056C7C4A8B, 0x11471CD764AD4973 },
+    { 0xA93AF6C6C79B5D2D, 0xD598E40D3DD89BD0 },
+    { 0xD389B47879823479, 0x4AFF1D108D4EC2C4 },
+    { 0x843610CB4BF160CB, 0xCEDF722A585139BB },
+    { 0xA54394FE1EEDB8FE, 0xC2974EB4EE658829 },
+    { 0xCE947A3DA6A9273E, 0x733D226229FEEA33 },
+    { 0x811CCC668829B887, 0x0806357D5A3F5260 },
+    { 0xA163FF802A3426A8, 0xCA07C2DCB0CF26F8 },
+    { 0xC9BCFF6034C13052, 0xFC89B393DD02F0B6 },
+    { 0xFC2C3F3841F17C67, 0xBBAC2078D443ACE3 },
+    { 0x9D9BA7832936EDC0, 0xD54B944B84AA4C0E },
+    { 0xC5029163F384A931, 0x0A9E795E65D4DF12 },
+    { 0xF64335BCF065D37D, 0x4D4617B5FF4A16D6 },
+    { 0x99EA0196163FA42E, 0x504BCED1BF8E4E46 },
+    { 0xC06481FB9BCF8D39, 0xE45EC2862F71E1D7 },
+    { 0xF07DA27A82C37088, 0x5D767327BB4E5A4D },
+    { 0x964E858C91BA2655, 0x3A6A07F8D510F870 },
+    { 0xBBE226EFB628AFEA, 0x890489F70A55368C },
+    { 0xEADAB0ABA3B2DBE5, 0x2B45AC74CCEA842F },
+    { 0x92C8AE6B464FC96F, 0x3B0B8BC90012929E },
+    { 0xB77ADA0617E3BBCB, 0x09CE6EBB40173745 },
+    { 0xE55990879DDCAABD, 0xCC420A6A101D0516 },
+    { 0x8F57FA54C2A9EAB6, 0x9FA946824A12232E },
+    { 0xB32DF8E9F3546564, 0x47939822DC96ABFA },
+    { 0xDFF9772470297EBD, 0x59787E2B93BC56F8 },
+    { 0x8BFBEA76C619EF36, 0x57EB4EDB3C55B65B },
+    { 0xAEFAE51477A06B03, 0xEDE622920B6B23F2 },
+    { 0xDAB99E59958885C4, 0xE95FAB368E45ECEE },
+    { 0x88B402F7FD75539B, 0x11DBCB0218EBB415 },
+    { 0xAAE103B5FCD2A881, 0xD652BDC29F26A11A },
+    { 0xD59944A37C0752A2, 0x4BE76D3346F04960 },
+    { 0x857FCAE62D8493A5, 0x6F70A4400C562DDC },
+    { 0xA6DFBD9FB8E5B88E, 0xCB4CCD500F6BB953 },
+    { 0xD097AD07A71F26B2, 0x7E2000A41346A7A8 },
+    { 0x825ECC24C873782F, 0x8ED400668C0C28C9 },
+    { 0xA2F67F2DFA90563B, 0x728900802F0F32FB },
+    { 0xCBB41EF979346BCA, 0x4F2B40A03AD2FFBA },
+    { 0xFEA126B7D78186BC, 0xE2F610C84987BFA9 },
+    { 0x9F24B832E6B0F436, 0x0DD9CA7D2DF4D7CA },
+    { 0xC6EDE63FA05D3143, 0x91503D1C79720DBC },
+    { 0xF8A95FCF88747D94, 0x75A44C6397CE912B },
+    { 0x9B69DBE1B548CE7C, 0xC986AFBE3EE11ABB },
+    { 0xC24452DA229B021B, 0xFBE85BADCE996169 },
+    { 0xF2D56790AB41C2A2, 0xFAE27299423FB9C4 },
+    { 0x97C560BA6B0919A5, 0xDCCD879FC967D41B },
+    { 0xBDB6B8E905CB600F, 0x5400E987BBC1C921 },
+    { 0xED246723473E3813, 0x290123E9AAB23B69 },
+    { 0x9436C0760C86E30B, 0xF9A0B6720AAF6522 },
+    { 0xB94470938FA89BCE, 0xF808E40E8D5B3E6A },
+    { 0xE7958CB87392C2C2, 0xB60B1D1230B20E05 },
+    { 0x90BD77F3483BB9B9, 0xB1C6F22B5E6F48C3 },
+    { 0xB4ECD5F01A4AA828, 0x1E38AEB6360B1AF4 },
+    { 0xE2280B6C20DD5232, 0x25C6DA63C38DE1B1 },
+    { 0x8D590723948A535F, 0x579C487E5A38AD0F },
+    { 0xB0AF48EC79ACE837, 0x2D835A9DF0C6D852 },
+    { 0xDCDB1B2798182244, 0xF8E431456CF88E66 },
+    { 0x8A08F0F8BF0F156B, 0x1B8E9ECB641B5900 },
+    { 0xAC8B2D36EED2DAC5, 0xE272467E3D222F40 },
+    { 0xD7ADF884AA879177, 0x5B0ED81DCC6ABB10 },
+    { 0x86CCBB52EA94BAEA, 0x98E947129FC2B4EA },
+    { 0xA87FEA27A539E9A5, 0x3F2398D747B36225 },
+    { 0xD29FE4B18E88640E, 0x8EEC7F0D19A03AAE },
+    { 0x83A3EEEEF9153E89, 0x1953CF68300424AD },
+    { 0xA48CEAAAB75A8E2B, 0x5FA8C3423C052DD8 },
+    { 0xCDB02555653131B6, 0x3792F412CB06794E },
+    { 0x808E17555F3EBF11, 0xE2BBD88BBEE40BD1 },
+    { 0xA0B19D2AB70E6ED6, 0x5B6ACEAEAE9D0EC5 },
+    { 0xC8DE047564D20A8B, 0xF245825A5A445276 },
+    { 0xFB158592BE068D2E, 0xEED6E2F0F0D56713 },
+    { 0x9CED737BB6C4183D, 0x55464DD69685606C },
+    { 0xC428D05AA4751E4C, 0xAA97E14C3C26B887 },
+    { 0xF53304714D9265DF, 0xD53DD99F4B3066A9 },
+    { 0x993FE2C6D07B7FAB, 0xE546A8038EFE402A },
+    { 0xBF8FDB78849A5F96, 0xDE98520472BDD034 },
+    { 0xEF73D256A5C0F77C, 0x963E66858F6D4441 },
+    { 0x95A8637627989AAD, 0xDDE7001379A44AA9 },
+    { 0xBB127C53B17EC159, 0x5560C018580D5D53 },
+    { 0xE9D71B689DDE71AF, 0xAAB8F01E6E10B4A7 },
+    { 0x9226712162AB070D, 0xCAB3961304CA70E9 },
+    { 0xB6B00D69BB55C8D1, 0x3D607B97C5FD0D23 },
+    { 0xE45C10C42A2B3B05, 0x8CB89A7DB77C506B },
+    { 0x8EB98A7A9A5B04E3, 0x77F3608E92ADB243 },
+    { 0xB267ED1940F1C61C, 0x55F038B237591ED4 },
+    { 0xDF01E85F912E37A3, 0x6B6C46DEC52F6689 },
+    { 0x8B61313BBABCE2C6, 0x2323AC4B3B3DA016 },
+    { 0xAE397D8AA96C1B77, 0xABEC975E0A0D081B },
+    { 0xD9C7DCED53C72255, 0x96E7BD358C904A22 },
+    { 0x881CEA14545C7575, 0x7E50D64177DA2E55 },
+    { 0xAA242499697392D2, 0xDDE50BD1D5D0B9EA },
+    { 0xD4AD2DBFC3D07787, 0x955E4EC64B44E865 },
+    { 0x84EC3C97DA624AB4, 0xBD5AF13BEF0B113F },
+    { 0xA6274BBDD0FADD61, 0xECB1AD8AEACDD58F },
+    { 0xCFB11EAD453994BA, 0x67DE18EDA5814AF3 },
+    { 0x81CEB32C4B43FCF4, 0x80EACF948770CED8 },
+    { 0xA2425FF75E14FC31, 0xA1258379A94D028E },
+    { 0xCAD2F7F5359A3B3E, 0x096EE45813A04331 },
+    { 0xFD87B5F28300CA0D, 0x8BCA9D6E188853FD },
+    { 0x9E74D1B791E07E48, 0x775EA264CF55347E },
+    { 0xC612062576589DDA, 0x95364AFE032A819E },
+    { 0xF79687AED3EEC551, 0x3A83DDBD83F52205 },
+    { 0x9ABE14CD44753B52, 0xC4926A9672793543 },
+    { 0xC16D9A0095928A27, 0x75B7053C0F178294 },
+    { 0xF1C90080BAF72CB1, 0x5324C68B12DD6339 },
+    { 0x971DA05074DA7BEE, 0xD3F6FC16EBCA5E04 },
+    { 0xBCE5086492111AEA, 0x88F4BB1CA6BCF585 },
+    { 0xEC1E4A7DB69561A5, 0x2B31E9E3D06C32E6 },
+    { 0x9392EE8E921D5D07, 0x3AFF322E62439FD0 },
+    { 0xB877AA3236A4B449, 0x09BEFEB9FAD487C3 },
+    { 0xE69594BEC44DE15B, 0x4C2EBE687989A9B4 },
+    { 0x901D7CF73AB0ACD9, 0x0F9D37014BF60A11 },
+    { 0xB424DC35095CD80F, 0x538484C19EF38C95 },
+    { 0xE12E13424BB40E13, 0x2865A5F206B06FBA },
+    { 0x8CBCCC096F5088CB, 0xF93F87B7442E45D4 },
+    { 0xAFEBFF0BCB24AAFE, 0xF78F69A51539D749 },
+    { 0xDBE6FECEBDEDD5BE, 0xB573440E5A884D1C },
+    { 0x89705F4136B4A597, 0x31680A88F8953031 },
+    { 0xABCC77118461CEFC, 0xFDC20D2B36BA7C3E },
+    { 0xD6BF94D5E57A42BC, 0x3D32907604691B4D },
+    { 0x8637BD05AF6C69B5, 0xA63F9A49C2C1B110 },
+    { 0xA7C5AC471B478423, 0x0FCF80DC33721D54 },
+    { 0xD1B71758E219652B, 0xD3C36113404EA4A9 },
+    { 0x83126E978D4FDF3B, 0x645A1CAC083126EA },
+    { 0xA3D70A3D70A3D70A, 0x3D70A3D70A3D70A4 },
+    { 0xCCCCCCCCCCCCCCCC, 0xCCCCCCCCCCCCCCCD },
+    { 0x8000000000000000, 0x0000000000000001 },
+    { 0xA000000000000000, 0x0000000000000001 },
+    { 0xC800000000000000, 0x0000000000000001 },
+    { 0xFA00000000000000, 0x0000000000000001 },
+    { 0x9C40000000000000, 0x0000000000000001 },
+    { 0xC350000000000000, 0x0000000000000001 },
+    { 0xF424000000000000, 0x0000000000000001 },
+    { 0x9896800000000000, 0x0000000000000001 },
+    { 0xBEBC200000000000, 0x0000000000000001 },
+    { 0xEE6B280000000000, 0x0000000000000001 },
+    { 0x9502F90000000000, 0x0000000000000001 },
+    { 0xBA43B74000000000, 0x0000000000000001 },
+    { 0xE8D4A51000000000, 0x0000000000000001 },
+    { 0x9184E72A00000000, 0x0000000000000001 },
+    { 0xB5E620F480000000, 0x0000000000000001 },
+    { 0xE35FA931A0000000, 0x0000000000000001 },
+    { 0x8E1BC9BF04000000, 0x0000000000000001 },
+    { 0xB1A2BC2EC5000000, 0x0000000000000001 },
+    { 0xDE0B6B3A76400000, 0x0000000000000001 },
+    { 0x8AC7230489E80000, 0x0000000000000001 },
+    { 0xAD78EBC5AC620000, 0x0000000000000001 },
+    { 0xD8D726B7177A8000, 0x0000000000000001 },
+    { 0x878678326EAC9000, 0x0000000000000001 },
+    { 0xA968163F0A57B400, 0x0000000000000001 },
+    { 0xD3C21BCECCEDA100, 0x0000000000000001 },
+    { 0x84595161401484A0, 0x0000000000000001 },
+    { 0xA56FA5B99019A5C8, 0x0000000000000001 },
+    { 0xCECB8F27F4200F3A, 0x0000000000000001 },
+    { 0x813F3978F8940984, 0x4000000000000001 },
+    { 0xA18F07D736B90BE5, 0x5000000000000001 },
+    { 0xC9F2C9CD04674EDE, 0xA400000000000001 },
+    { 0xFC6F7C4045812296, 0x4D00000000000001 },
+    { 0x9DC5ADA82B70B59D, 0xF020000000000001 },
+    { 0xC5371912364CE305, 0x6C28000000000001 },
+    { 0xF684DF56C3E01BC6, 0xC732000000000001 },
+    { 0x9A130B963A6C115C, 0x3C7F400000000001 },
+    { 0xC097CE7BC90715B3, 0x4B9F100000000001 },
+    { 0xF0BDC21ABB48DB20, 0x1E86D40000000001 },
+    { 0x96769950B50D88F4, 0x1314448000000001 },
+    { 0xBC143FA4E250EB31, 0x17D955A000000001 },
+    { 0xEB194F8E1AE525FD, 0x5DCFAB0800000001 },
+    { 0x92EFD1B8D0CF37BE, 0x5AA1CAE500000001 },
+    { 0xB7ABC627050305AD, 0xF14A3D9E40000001 },
+    { 0xE596B7B0C643C719, 0x6D9CCD05D0000001 },
+    { 0x8F7E32CE7BEA5C6F, 0xE4820023A2000001 },
+    { 0xB35DBF821AE4F38B, 0xDDA2802C8A800001 },
+    { 0xE0352F62A19E306E, 0xD50B2037AD200001 },
+    { 0x8C213D9DA502DE45, 0x4526F422CC340001 },
+    { 0xAF298D050E4395D6, 0x9670B12B7F410001 },
+    { 0xDAF3F04651D47B4C, 0x3C0CDD765F114001 },
+    { 0x88D8762BF324CD0F, 0xA5880A69FB6AC801 },
+    { 0xAB0E93B6EFEE0053, 0x8EEA0D047A457A01 },
+    { 0xD5D238A4ABE98068, 0x72A4904598D6D881 },
+    { 0x85A36366EB71F041, 0x47A6DA2B7F864751 },
+    { 0xA70C3C40A64E6C51, 0x999090B65F67D925 },
+    { 0xD0CF4B50CFE20765, 0xFFF4B4E3F741CF6E },
+    { 0x82818F1281ED449F, 0xBFF8F10E7A8921A5 },
+    { 0xA321F2D7226895C7, 0xAFF72D52192B6A0E },
+    { 0xCBEA6F8CEB02BB39, 0x9BF4F8A69F764491 },
+    { 0xFEE50B7025C36A08, 0x02F236D04753D5B5 },
+    { 0x9F4F2726179A2245, 0x01D762422C946591 },
+    { 0xC722F0EF9D80AAD6, 0x424D3AD2B7B97EF6 },
+    { 0xF8EBAD2B84E0D58B, 0xD2E0898765A7DEB3 },
+    { 0x9B934C3B330C8577, 0x63CC55F49F88EB30 },
+    { 0xC2781F49FFCFA6D5, 0x3CBF6B71C76B25FC },
+    { 0xF316271C7FC3908A, 0x8BEF464E3945EF7B },
+    { 0x97EDD871CFDA3A56, 0x97758BF0E3CBB5AD },
+    { 0xBDE94E8E43D0C8EC, 0x3D52EEED1CBEA318 },
+    { 0xED63A231D4C4FB27, 0x4CA7AAA863EE4BDE },
+    { 0x945E455F24FB1CF8, 0x8FE8CAA93E74EF6B },
+    { 0xB975D6B6EE39E436, 0xB3E2FD538E122B45 },
+    { 0xE7D34C64A9C85D44, 0x60DBBCA87196B617 },
+    { 0x90E40FBEEA1D3A4A, 0xBC8955E946FE31CE },
+    { 0xB51D13AEA4A488DD, 0x6BABAB6398BDBE42 },
+    { 0xE264589A4DCDAB14, 0xC696963C7EED2DD2 },
+    { 0x8D7EB76070A08AEC, 0xFC1E1DE5CF543CA3 },
+    { 0xB0DE65388CC8ADA8, 0x3B25A55F43294BCC },
+    { 0xDD15FE86AFFAD912, 0x49EF0EB713F39EBF },
+    { 0x8A2DBF142DFCC7AB, 0x6E3569326C784338 },
+    { 0xACB92ED9397BF996, 0x49C2C37F07965405 },
+    { 0xD7E77A8F87DAF7FB, 0xDC33745EC97BE907 },
+    { 0x86F0AC99B4E8DAFD, 0x69A028BB3DED71A4 },
+    { 0xA8ACD7C0222311BC, 0xC40832EA0D68CE0D },
+    { 0xD2D80DB02AABD62B, 0xF50A3FA490C30191 },
+    { 0x83C7088E1AAB65DB, 0x792667C6DA79E0FB },
+    { 0xA4B8CAB1A1563F52, 0x577001B891185939 },
+    { 0xCDE6FD5E09ABCF26, 0xED4C0226B55E6F87 },
+    { 0x80B05E5AC60B6178, 0x544F8158315B05B5 },
+    { 0xA0DC75F1778E39D6, 0x696361AE3DB1C722 },
+    { 0xC913936DD571C84C, 0x03BC3A19CD1E38EA },
+    { 0xFB5878494ACE3A5F, 0x04AB48A04065C724 },
+    { 0x9D174B2DCEC0E47B, 0x62EB0D64283F9C77 },
+    { 0xC45D1DF942711D9A, 0x3BA5D0BD324F8395 },
+    { 0xF5746577930D6500, 0xCA8F44EC7EE3647A },
+    { 0x9968BF6ABBE85F20, 0x7E998B13CF4E1ECC },
+    { 0xBFC2EF456AE276E8, 0x9E3FEDD8C321A67F },
+    { 0xEFB3AB16C59B14A2, 0xC5CFE94EF3EA101F },
+    { 0x95D04AEE3B80ECE5, 0xBBA1F1D158724A13 },
+    { 0xBB445DA9CA61281F, 0x2A8A6E45AE8EDC98 },
+    { 0xEA1575143CF97226, 0xF52D09D71A3293BE },
+    { 0x924D692CA61BE758, 0x593C2626705F9C57 },
+    { 0xB6E0C377CFA2E12E, 0x6F8B2FB00C77836D },
+    { 0xE498F455C38B997A, 0x0B6DFB9C0F956448 },
+    { 0x8EDF98B59A373FEC, 0x4724BD4189BD5EAD },
+    { 0xB2977EE300C50FE7, 0x58EDEC91EC2CB658 },
+    { 0xDF3D5E9BC0F653E1, 0x2F2967B66737E3EE },
+    { 0x8B865B215899F46C, 0xBD79E0D20082EE75 },
+    { 0xAE67F1E9AEC07187, 0xECD8590680A3AA12 },
+    { 0xDA01EE641A708DE9, 0xE80E6F4820CC9496 },
+    { 0x884134FE908658B2, 0x3109058D147FDCDE },
+    { 0xAA51823E34A7EEDE, 0xBD4B46F0599FD416 },
+    { 0xD4E5E2CDC1D1EA96, 0x6C9E18AC7007C91B },
+    { 0x850FADC09923329E, 0x03E2CF6BC604DDB1 },
+    { 0xA6539930BF6BFF45, 0x84DB8346B786151D },
+    { 0xCFE87F7CEF46FF16, 0xE612641865679A64 },
+    { 0x81F14FAE158C5F6E, 0x4FCB7E8F3F60C07F },
+    { 0xA26DA3999AEF7749, 0xE3BE5E330F38F09E },
+    { 0xCB090C8001AB551C, 0x5CADF5BFD3072CC6 },
+    { 0xFDCB4FA002162A63, 0x73D9732FC7C8F7F7 },
+    { 0x9E9F11C4014DDA7E, 0x2867E7FDDCDD9AFB },
+    { 0xC646D63501A1511D, 0xB281E1FD541501B9 },
+    { 0xF7D88BC24209A565, 0x1F225A7CA91A4227 },
+    { 0x9AE757596946075F, 0x3375788DE9B06959 },
+    { 0xC1A12D2FC3978937, 0x0052D6B1641C83AF },
+    { 0xF209787BB47D6B84, 0xC0678C5DBD23A49B },
+    { 0x9745EB4D50CE6332, 0xF840B7BA963646E1 },
+    { 0xBD176620A501FBFF, 0xB650E5A93BC3D899 },
+    { 0xEC5D3FA8CE427AFF, 0xA3E51F138AB4CEBF },
+    { 0x93BA47C980E98CDF, 0xC66F336C36B10138 },
+    { 0xB8A8D9BBE123F017, 0xB80B0047445D4185 },
+    { 0xE6D3102AD96CEC1D, 0xA60DC059157491E6 },
+    { 0x9043EA1AC7E41392, 0x87C89837AD68DB30 },
+    { 0xB454E4A179DD1877, 0x29BABE4598C311FC },
+    { 0xE16A1DC9D8545E94, 0xF4296DD6FEF3D67B },
+    { 0x8CE2529E2734BB1D, 0x1899E4A65F58660D },
+    { 0xB01AE745B101E9E4, 0x5EC05DCFF72E7F90 },
+    { 0xDC21A1171D42645D, 0x76707543F4FA1F74 },
+    { 0x899504AE72497EBA, 0x6A06494A791C53A9 },
+    { 0xABFA45DA0EDBDE69, 0x0487DB9D17636893 },
+    { 0xD6F8D7509292D603, 0x45A9D2845D3C42B7 },
+    { 0x865B86925B9BC5C2, 0x0B8A2392BA45A9B3 },
+    { 0xA7F26836F282B732, 0x8E6CAC7768D7141F },
+    { 0xD1EF0244AF2364FF, 0x3207D795430CD927 },
+    { 0x8335616AED761F1F, 0x7F44E6BD49E807B9 },
+    { 0xA402B9C5A8D3A6E7, 0x5F16206C9C6209A7 },
+    { 0xCD036837130890A1, 0x36DBA887C37A8C10 },
+    { 0x802221226BE55A64, 0xC2494954DA2C978A },
+    { 0xA02AA96B06DEB0FD, 0xF2DB9BAA10B7BD6D },
+    { 0xC83553C5C8965D3D, 0x6F92829494E5ACC8 },
+    { 0xFA42A8B73ABBF48C, 0xCB772339BA1F17FA },
+    { 0x9C69A97284B578D7, 0xFF2A760414536EFC },
+    { 0xC38413CF25E2D70D, 0xFEF5138519684ABB },
+    { 0xF46518C2EF5B8CD1, 0x7EB258665FC25D6A },
+    { 0x98BF2F79D5993802, 0xEF2F773FFBD97A62 },
+    { 0xBEEEFB584AFF8603, 0xAAFB550FFACFD8FB },
+    { 0xEEAABA2E5DBF6784, 0x95BA2A53F983CF39 },
+    { 0x952AB45CFA97A0B2, 0xDD945A747BF26184 },
+    { 0xBA756174393D88DF, 0x94F971119AEEF9E5 },
+    { 0xE912B9D1478CEB17, 0x7A37CD5601AAB85E },
+    { 0x91ABB422CCB812EE, 0xAC62E055C10AB33B },
+    { 0xB616A12B7FE617AA, 0x577B986B314D600A },
+    { 0xE39C49765FDF9D94, 0xED5A7E85FDA0B80C },
+    { 0x8E41ADE9FBEBC27D, 0x14588F13BE847308 },
+    { 0xB1D219647AE6B31C, 0x596EB2D8AE258FC9 },
+    { 0xDE469FBD99A05FE3, 0x6FCA5F8ED9AEF3BC },
+    { 0x8AEC23D680043BEE, 0x25DE7BB9480D5855 },
+    { 0xADA72CCC20054AE9, 0xAF561AA79A10AE6B },
+    { 0xD910F7FF28069DA4, 0x1B2BA1518094DA05 },
+    { 0x87AA9AFF79042286, 0x90FB44D2F05D0843 },
+    { 0xA99541BF57452B28, 0x353A1607AC744A54 },
+    { 0xD3FA922F2D1675F2, 0x42889B8997915CE9 },
+    { 0x847C9B5D7C2E09B7, 0x69956135FEBADA12 },
+    { 0xA59BC234DB398C25, 0x43FAB9837E699096 },
+    { 0xCF02B2C21207EF2E, 0x94F967E45E03F4BC },
+    { 0x8161AFB94B44F57D, 0x1D1BE0EEBAC278F6 },
+    { 0xA1BA1BA79E1632DC, 0x6462D92A69731733 },
+    { 0xCA28A291859BBF93, 0x7D7B8F7503CFDCFF },
+    { 0xFCB2CB35E702AF78, 0x5CDA735244C3D43F },
+    { 0x9DEFBF01B061ADAB, 0x3A0888136AFA64A8 },
+    { 0xC56BAEC21C7A1916, 0x088AAA1845B8FDD1 },
+    { 0xF6C69A72A3989F5B, 0x8AAD549E57273D46 },
+    { 0x9A3C2087A63F6399, 0x36AC54E2F678864C },
+    { 0xC0CB28A98FCF3C7F, 0x84576A1BB416A7DE },
+    { 0xF0FDF2D3F3C30B9F, 0x656D44A2A11C51D6 },
+    { 0x969EB7C47859E743, 0x9F644AE5A4B1B326 },
+    { 0xBC4665B596706114, 0x873D5D9F0DDE1FEF },
+    { 0xEB57FF22FC0C7959, 0xA90CB506D155A7EB },
+    { 0x9316FF75DD87CBD8, 0x09A7F12442D588F3 },
+    { 0xB7DCBF5354E9BECE, 0x0C11ED6D538AEB30 },
+    { 0xE5D3EF282A242E81, 0x8F1668C8A86DA5FB },
+    { 0x8FA475791A569D10, 0xF96E017D694487BD },
+    { 0xB38D92D760EC4455, 0x37C981DCC395A9AD },
+    { 0xE070F78D3927556A, 0x85BBE253F47B1418 },
+    { 0x8C469AB843B89562, 0x93956D7478CCEC8F },
+    { 0xAF58416654A6BABB, 0x387AC8D1970027B3 },
+    { 0xDB2E51BFE9D0696A, 0x06997B05FCC0319F },
+    { 0x88FCF317F22241E2, 0x441FECE3BDF81F04 },
+    { 0xAB3C2FDDEEAAD25A, 0xD527E81CAD7626C4 },
+    { 0xD60B3BD56A5586F1, 0x8A71E223D8D3B075 },
+    { 0x85C7056562757456, 0xF6872D5667844E4A },
+    { 0xA738C6BEBB12D16C, 0xB428F8AC016561DC },
+    { 0xD106F86E69D785C7, 0xE13336D701BEBA53 },
+    { 0x82A45B450226B39C, 0xECC0024661173474 },
+    { 0xA34D721642B06084, 0x27F002D7F95D0191 },
+    { 0xCC20CE9BD35C78A5, 0x31EC038DF7B441F5 },
+    { 0xFF290242C83396CE, 0x7E67047175A15272 },
+    { 0x9F79A169BD203E41, 0x0F0062C6E984D387 },
+    { 0xC75809C42C684DD1, 0x52C07B78A3E60869 },
+    { 0xF92E0C3537826145, 0xA7709A56CCDF8A83 },
+    { 0x9BBCC7A142B17CCB, 0x88A66076400BB692 },
+    { 0xC2ABF989935DDBFE, 0x6ACFF893D00EA436 },
+    { 0xF356F7EBF83552FE, 0x0583F6B8C4124D44 },
+    { 0x98165AF37B2153DE, 0xC3727A337A8B704B },
+    { 0xBE1BF1B059E9A8D6, 0x744F18C0592E4C5D },
+    { 0xEDA2EE1C7064130C, 0x1162DEF06F79DF74 },
+    { 0x9485D4D1C63E8BE7, 0x8ADDCB5645AC2BA9 },
+    { 0xB9A74A0637CE2EE1, 0x6D953E2BD7173693 },
+    { 0xE8111C87C5C1BA99, 0xC8FA8DB6CCDD0438 },
+    { 0x910AB1D4DB9914A0, 0x1D9C9892400A22A3 },
+    { 0xB54D5E4A127F59C8, 0x2503BEB6D00CAB4C },
+    { 0xE2A0B5DC971F303A, 0x2E44AE64840FD61E },
+    { 0x8DA471A9DE737E24, 0x5CEAECFED289E5D3 },
+    { 0xB10D8E1456105DAD, 0x7425A83E872C5F48 },
+    { 0xDD50F1996B947518, 0xD12F124E28F7771A },
+    { 0x8A5296FFE33CC92F, 0x82BD6B70D99AAA70 },
+    { 0xACE73CBFDC0BFB7B, 0x636CC64D1001550C },
+    { 0xD8210BEFD30EFA5A, 0x3C47F7E05401AA4F },
+    { 0x8714A775E3E95C78, 0x65ACFAEC34810A72 },
+    { 0xA8D9D1535CE3B396, 0x7F1839A741A14D0E },
+    { 0xD31045A8341CA07C, 0x1EDE48111209A051 },
+    { 0x83EA2B892091E44D, 0x934AED0AAB460433 },
+    { 0xA4E4B66B68B65D60, 0xF81DA84D56178540 },
+    { 0xCE1DE40642E3F4B9, 0x36251260AB9D668F },
+    { 0x80D2AE83E9CE78F3, 0xC1D72B7C6B42601A },
+    { 0xA1075A24E4421730, 0xB24CF65B8612F820 },
+    { 0xC94930AE1D529CFC, 0xDEE033F26797B628 },
+    { 0xFB9B7CD9A4A7443C, 0x169840EF017DA3B2 },
+    { 0x9D412E0806E88AA5, 0x8E1F289560EE864F },
+    { 0xC491798A08A2AD4E, 0xF1A6F2BAB92A27E3 },
+    { 0xF5B5D7EC8ACB58A2, 0xAE10AF696774B1DC },
+    { 0x9991A6F3D6BF1765, 0xACCA6DA1E0A8EF2A },
+    { 0xBFF610B0CC6EDD3F, 0x17FD090A58D32AF4 },
+    { 0xEFF394DCFF8A948E, 0xDDFC4B4CEF07F5B1 },
+    { 0x95F83D0A1FB69CD9, 0x4ABDAF101564F98F },
+    { 0xBB764C4CA7A4440F, 0x9D6D1AD41ABE37F2 },
+    { 0xEA53DF5FD18D5513, 0x84C86189216DC5EE },
+    { 0x92746B9BE2F8552C, 0x32FD3CF5B4E49BB5 },
+    { 0xB7118682DBB66A77, 0x3FBC8C33221DC2A2 },
+    { 0xE4D5E82392A40515, 0x0FABAF3FEAA5334B },
+    { 0x8F05B1163BA6832D, 0x29CB4D87F2A7400F },
+    { 0xB2C71D5BCA9023F8, 0x743E20E9EF511013 },
+    { 0xDF78E4B2BD342CF6, 0x914DA9246B255417 },
+    { 0x8BAB8EEFB6409C1A, 0x1AD089B6C2F7548F },
+    { 0xAE9672ABA3D0C320, 0xA184AC2473B529B2 },
+    { 0xDA3C0F568CC4F3E8, 0xC9E5D72D90A2741F },
+    { 0x8865899617FB1871, 0x7E2FA67C7A658893 },
+    { 0xAA7EEBFB9DF9DE8D, 0xDDBB901B98FEEAB8 },
+    { 0xD51EA6FA85785631, 0x552A74227F3EA566 },
+    { 0x8533285C936B35DE, 0xD53A88958F872760 },
+    { 0xA67FF273B8460356, 0x8A892ABAF368F138 },
+    { 0xD01FEF10A657842C, 0x2D2B7569B0432D86 },
+    { 0x8213F56A67F6B29B, 0x9C3B29620E29FC74 },
+    { 0xA298F2C501F45F42, 0x8349F3BA91B47B90 },
+    { 0xCB3F2F7642717713, 0x241C70A936219A74 },
+    { 0xFE0EFB53D30DD4D7, 0xED238CD383AA0111 },
+    { 0x9EC95D1463E8A506, 0xF4363804324A40AB },
+    { 0xC67BB4597CE2CE48, 0xB143C6053EDCD0D6 },
+    { 0xF81AA16FDC1B81DA, 0xDD94B7868E94050B },
+    { 0x9B10A4E5E9913128, 0xCA7CF2B4191C8327 },
+    { 0xC1D4CE1F63F57D72, 0xFD1C2F611F63A3F1 },
+    { 0xF24A01A73CF2DCCF, 0xBC633B39673C8CED },
+    { 0x976E41088617CA01, 0xD5BE0503E085D814 },
+    { 0xBD49D14AA79DBC82, 0x4B2D8644D8A74E19 },
+    { 0xEC9C459D51852BA2, 0xDDF8E7D60ED1219F },
+    { 0x93E1AB8252F33B45, 0xCABB90E5C942B504 },
+    { 0xB8DA1662E7B00A17, 0x3D6A751F3B936244 },
+    { 0xE7109BFBA19C0C9D, 0x0CC512670A783AD5 },
+    { 0x906A617D450187E2, 0x27FB2B80668B24C6 },
+    { 0xB484F9DC9641E9DA, 0xB1F9F660802DEDF7 },
+    { 0xE1A63853BBD26451, 0x5E7873F8A0396974 },
+    { 0x8D07E33455637EB2, 0xDB0B487B6423E1E9 },
+    { 0xB049DC016ABC5E5F, 0x91CE1A9A3D2CDA63 },
+    { 0xDC5C5301C56B75F7, 0x7641A140CC7810FC },
+    { 0x89B9B3E11B6329BA, 0xA9E904C87FCB0A9E },
+    { 0xAC2820D9623BF429, 0x546345FA9FBDCD45 },
+    { 0xD732290FBACAF133, 0xA97C177947AD4096 },
+    { 0x867F59A9D4BED6C0, 0x49ED8EABCCCC485E },
+    { 0xA81F301449EE8C70, 0x5C68F256BFFF5A75 },
+    { 0xD226FC195C6A2F8C, 0x73832EEC6FFF3112 },
+    { 0x83585D8FD9C25DB7, 0xC831FD53C5FF7EAC },
+    { 0xA42E74F3D032F525, 0xBA3E7CA8B77F5E56 },
+    { 0xCD3A1230C43FB26F, 0x28CE1BD2E55F35EC },
+    { 0x80444B5E7AA7CF85, 0x7980D163CF5B81B4 },
+    { 0xA0555E361951C366, 0xD7E105BCC3326220 },
+    { 0xC86AB5C39FA63440, 0x8DD9472BF3FEFAA8 },
+    { 0xFA856334878FC150, 0xB14F98F6F0FEB952 },
+    { 0x9C935E00D4B9D8D2, 0x6ED1BF9A569F33D4 },
+    { 0xC3B8358109E84F07, 0x0A862F80EC4700C9 },
+    { 0xF4A642E14C6262C8, 0xCD27BB612758C0FB },
+    { 0x98E7E9CCCFBD7DBD, 0x8038D51CB897789D },
+    { 0xBF21E44003ACDD2C, 0xE0470A63E6BD56C4 },
+    { 0xEEEA5D5004981478, 0x1858CCFCE06CAC75 },
+    { 0x95527A5202DF0CCB, 0x0F37801E0C43EBC9 },
+    { 0xBAA718E68396CFFD, 0xD30560258F54E6BB },
+    { 0xE950DF20247C83FD, 0x47C6B82EF32A206A },
+    { 0x91D28B7416CDD27E, 0x4CDC331D57FA5442 },
+    { 0xB6472E511C81471D, 0xE0133FE4ADF8E953 },
+    { 0xE3D8F9E563A198E5, 0x58180FDDD97723A7 },
+    { 0x8E679C2F5E44FF8F, 0x570F09EAA7EA7649 },
+    { 0xB201833B35D63F73, 0x2CD2CC6551E513DB },
+    { 0xDE81E40A034BCF4F, 0xF8077F7EA65E58D2 },
+    { 0x8B112E86420F6191, 0xFB04AFAF27FAF783 },
+    { 0xADD57A27D29339F6, 0x79C5DB9AF1F9B564 },
+    { 0xD94AD8B1C7380874, 0x18375281AE7822BD },
+    { 0x87CEC76F1C830548, 0x8F2293910D0B15B6 },
+    { 0xA9C2794AE3A3C69A, 0xB2EB3875504DDB23 },
+    { 0xD433179D9C8CB841, 0x5FA60692A46151EC },
+    { 0x849FEEC281D7F328, 0xDBC7C41BA6BCD334 },
+    { 0xA5C7EA73224DEFF3, 0x12B9B522906C0801 },
+    { 0xCF39E50FEAE16BEF, 0xD768226B34870A01 },
+    { 0x81842F29F2CCE375, 0xE6A1158300D46641 },
+    { 0xA1E53AF46F801C53, 0x60495AE3C1097FD1 },
+    { 0xCA5E89B18B602368, 0x385BB19CB14BDFC5 },
+    { 0xFCF62C1DEE382C42, 0x46729E03DD9ED7B6 },
+    { 0x9E19DB92B4E31BA9, 0x6C07A2C26A8346D2 },
+};
+
+// Full 128-bit product of two 64-bit numbers, as {high, low}.
+static inline void _mul_64x64(uint64_t aa, uint64_t bb,
+                              uint64_t& hi_out, uint64_t& lo_out)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 pp = (unsigned __int128)aa * bb;
+    hi_out = (uint64_t)(pp >> 64);
+    lo_out = (uint64_t)pp;
+#else
+    uint64_t a_lo = (uint32_t)aa, a_hi = aa >> 32;
+    uint64_t b_lo = (uint32_t)bb, b_hi = bb >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi;
+    uint64_t hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    hi_out = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    lo_out = (mid << 32) | (uint32_t)ll;
+#endif
+}
+
+// `g * cp / 2^128`, rounded to odd: the lowest bit is set if it is not
+// an integer, so that comparisons with even numbers are exact.
+static inline uint64_t _round_to_odd(const uint64_t* g, uint64_t cp) {
+    uint64_t x_hi = 0, x_lo = 0, y_hi = 0, y_lo = 0;
+    _mul_64x64(g[1], cp, x_hi, x_lo);
+    _mul_64x64(g[0], cp, y_hi, y_lo);
+    uint64_t mid = y_lo + x_hi;
+    uint64_t carry = (mid < y_lo);
+    // `g` is rounded up, the error is at most 1 in `mid`.
+    return (y_hi + carry) | (mid > 1);
+}
+
+// floor(log10(2^e)), floor(log10(3/4 * 2^e)), and floor(log2(10^e)),
+// exact for the exponents of doubles.
+static inline int _floor_log10_pow2(int e) { return (e * 1262611) >> 22; }
+static inline int _floor_log10_3q_pow2(int e) {
+    return (e * 1262611 - 524031) >> 22;
+}
+static inline int _floor_log2_pow10(int e) { return (e * 1741647) >> 19; }
+
+// The shortest `digits * 10^exp10` that reads back to `c * 2^q`
+// (the closest one if there are many), without trailing zeros.
+// `lower_closer` is set for a power of 2 (but the smallest normal
+// number), whose lower neighbor is closer than the upper one.
+static void _shortest_decimal(uint64_t c,
+                              int q,
+                              bool lower_closer,
+                              uint64_t& digits_out,
+                              int& exp10_out)
+{
+    // Boundaries of numbers that round to `val`, scaled by 4 * 2^-q.
+    // Included if `c` is even.
+    bool even = !(c & 1);
+    uint64_t cb = c << 2;
+    uint64_t cbl = cb - 2 + lower_closer;
+    uint64_t cbr = cb + 2;
+
+    // Scale them by 10^-k, so that `s` below has as many digits as
+    // `c` or one more: 16 or 17 for a double, 8 or 9 for a float.
+    int k = (lower_closer) ? _floor_log10_3q_pow2(q) : _floor_log10_pow2(q);
+    int h = q + _floor_log2_pow10(-k) + 1;
+    const uint64_t* g = POW10_G[-k - POW10_G_MIN];
+    uint64_t vbl = _round_to_odd(g, cbl << h);
+    uint64_t vb = _round_to_odd(g, cb << h);
+    uint64_t vbr = _round_to_odd(g, cbr << h);
+    uint64_t lower = vbl + !even;
+    uint64_t upper = vbr - !even;
+
+    uint64_t s = vb >> 2;
+    uint64_t digits = 0;
+    int exp10 = k;
+    bool found = false;
+    if (s >= 10) {
+        // One less digit, if only one of its neighbors is in the range.
+        uint64_t sp = s / 10;
+        bool up_inside = (lower <= 40 * sp);
+        bool wp_inside = (40 * sp + 40 <= upper);
+        if (up_inside != wp_inside) {
+            digits = sp + wp_inside;
+            exp10 = k + 1;
+            found = true;
+        }
+    }
+    if (!found) {
+        bool u_inside = (lower <= 4 * s);
+        bool w_inside = (4 * s + 4 <= upper);
+        if (u_inside != w_inside) {
+            digits = s + w_inside;
+        } else {
+            // Both are in the range, the closer one (even on a tie).
+            uint64_t mid = 4 * s + 2;
+            digits = s + (vb > mid || (vb == mid && (s & 1)));
+        }
+    }
+
+    while (digits % 10 == 0) {
+        digits /= 10;
+        exp10++;
+    }
+    digits_out = digits;
+    exp10_out = exp10;
+}
+
+// Finite, non-zero `val`.
+static void _shortest_decimal(double val, uint64_t& digits_out, int& exp10_out) {
+    uint64_t bits = 0;
+    memcpy(&bits, &val, sizeof(bits));
+    uint64_t fraction = bits & ((1ULL << 52) - 1);
+    int bin_exp = (int)((bits >> 52) & 0x7ff);
+    // `val` = c * 2^q.
+    uint64_t c = (bin_exp) ? (fraction | (1ULL << 52)) : fraction;
+    int q = (bin_exp) ? (bin_exp - 1075) : -1074;
+    _shortest_decimal(c, q, fraction == 0 && bin_exp > 1, digits_out, exp10_out);
+}
+
+static void _shortest_decimal(float val, uint64_t& digits_out, int& exp10_out) {
+    uint32_t bits = 0;
+    memcpy(&bits, &val, sizeof(bits));
+    uint32_t fraction = bits & ((1U << 23) - 1);
+    int bin_exp = (int)((bits >> 23) & 0xff);
+    uint64_t c = (bin_exp) ? (fraction | (1U << 23)) : fraction;
+    int q = (bin_exp) ? (bin_exp - 150) : -149;
+    _shortest_decimal(c, q, fraction == 0 && bin_exp > 1, digits_out, exp10_out);
+}
+
+// Write `digits * 10^exp10` to `out` in the same style as `%g`: the
+// precision is `short_precision`, or `full_precision` if more digits
+// are needed.
+static size_t _write_g_style(char* out,
+                             bool negative,
+                             uint64_t digits,
+                             int exp10,
+                             int short_precision,
+                             int full_precision)
+{
+    char dd[SimpleLogger::Fmt::MAX_INT_LEN];
+    int num = (int)SimpleLogger::Fmt::formatUnsigned(dd, digits);
+    // Decimal exponent of the first digit.
+    int dec_exp = exp10 + num - 1;
+    int precision = (num > short_precision) ? full_precision : short_precision;
+
+    char* po = out;
+    if (negative) *po++ = '-';
+    if (dec_exp < -4 || dec_exp >= precision) {
+        *po++ = dd[0];
+        if (num > 1) {
+            *po++ = '.';
+            memcpy(po, dd + 1, num - 1);
+            po += num - 1;
+        }
+        *po++ = 'e';
+        *po++ = (dec_exp < 0) ? '-' : '+';
+        int abs_exp = std::abs(dec_exp);
+        if (abs_exp >= 100) *po++ = '0' + abs_exp / 100;
+        *po++ = '0' + abs_exp / 10 % 10;
+        *po++ = '0' + abs_exp % 10;
+    } else if (dec_exp >= num - 1) {
+        // Integral.
+        memcpy(po, dd, num);
+        po += num;
+        memset(po, '0', dec_exp + 1 - num);
+        po += dec_exp + 1 - num;
+    } else if (dec_exp >= 0) {
+        memcpy(po, dd, dec_exp + 1);
+        po += dec_exp + 1;
+        *po++ = '.';
+        memcpy(po, dd + dec_exp + 1, num - dec_exp - 1);
+        po += num - dec_exp - 1;
+    } else {
+        *po++ = '0';
+        *po++ = '.';
+        memset(po, '0', -dec_exp - 1);
+        po += -dec_exp - 1;
+        memcpy(po, dd, num);
+        po += num;
+    }
+    return po - out;
+}
+
+size_t SimpleLogger::Fmt::formatDouble(char* buf, double val) {
+    // Integral numbers: no need to probe, same as `%.15g`.
+    if ( val > -1e15 && val < 1e15 &&
+         val == (double)(int64_t)val &&
+         (val != 0 || !std::signbit(val)) ) {
+        return formatSigned(buf, (int64_t)val);
+    }
+    // Short decimal numbers: find the smallest `kk` such that
+    // `val == mm / 10^kk` for an integer `mm`. Both `mm` and `10^kk`
+    // are exact, so the division is rounded in the same way as
+    // `strtod` parses the string.
+    double abs_val = std::fabs(val);
+    if (abs_val >= 1e-4 && abs_val < 1e14 && _may_be_short_decimal(abs_val)) {
+        for (int kk = 1; kk <= 9; ++kk) {
+            double scaled = abs_val * POW10_DOUBLE[kk];
+            if (scaled >= 1e15) break;
+            uint64_t mm = (uint64_t)(scaled + 0.5);
+            if ((double)mm / POW10_DOUBLE[kk] != abs_val) continue;
+
+            char* pp = buf;
+            if (val < 0) *pp++ = '-';
+            pp += formatUnsigned(pp, mm / POW10_INT[kk]);
+            *pp++ = '.';
+            formatFixed(pp, mm % POW10_INT[kk], kk);
+            return pp + kk - buf;
+        }
+    }
+
+    if (!std::isfinite(val)) {
+        int len = snprintf(buf, 32, "%g", val);
+        return (len > 0) ? len : 0;
+    }
+    if (val == 0) {
+        // Negative zero, the positive one is integral.
+        memcpy(buf, "-0", 2);
+        return 2;
+    }
+    uint64_t digits = 0;
+    int exp10 = 0;
+    _shortest_decimal(val, digits, exp10);
+    return _write_g_style(buf, std::signbit(val), digits, exp10, 15, 17);
+}
+
+size_t SimpleLogger::Fmt::formatFloat(char* buf, float val) {
+    // Integral numbers, same as `%.6g`.
+    if ( val > -1e6f && val < 1e6f &&
+         val == (float)(int32_t)val &&
+         (val != 0 || !std::signbit(val)) ) {
+        return formatSigned(buf, (int32_t)val);
+    }
+    if (!std::isfinite(val)) {
+        int len = snprintf(buf, 32, "%g", val);
+        return (len > 0) ? len : 0;
+    }
+    if (val == 0) {
+        memcpy(buf, "-0", 2);
+        return 2;
+    }
+    // A float has at least 6 significant digits, 9 are always enough.
+    uint64_t digits = 0;
+    int exp10 = 0;
+    _shortest_decimal(val, digits, exp10);
+    return _write_g_style(buf, std::signbit(val), digits, exp10, 6, 9);
+}
+
+const char* SimpleLogger::Fmt::writeLiteral(Writer& w, const char* fmt) {
+    // The format string was already validated at compile time.
+    const char* begin = fmt;
+    while (*fmt) {
+        if (*fmt != '{' && *fmt != '}') {
+            fmt++;
+            continue;
+        }
+        w.append(begin, fmt - begin);
+        if (fmt[0] == '{' && fmt[1] == '}') {
+            return fmt + 2;
+        }
+        // `{{` or `}}`: write a single brace.
+        w.append(fmt, 1);
+        if (fmt[1]) fmt++;
+        fmt++;
+        begin = fmt;
+    }
+    w.append(begin, fmt - begin);
+    return fmt;
+}
+
+void SimpleLogger::Fmt::writeUnsigned(Writer& w, unsigned long long val) {
+    char buf[MAX_INT_LEN];
+    w.append(buf, formatUnsigned(buf, val));
+}
+
+void SimpleLogger::Fmt::writeSigned(Writer& w, long long val) {
+    char buf[MAX_INT_LEN];
+    w.append(buf, formatSigned(buf, val));
+}
+
+void SimpleLogger::Fmt::writeFloat(Writer& w, float val) {
+    char buf[MAX_FLOAT_LEN];
+    w.append(buf, formatFloat(buf, val));
+}
+
+void SimpleLogger::Fmt::writeDouble(Writer& w, double val) {
+    char buf[MAX_FLOAT_LEN];
+    w.append(buf, formatDouble(buf, val));
+}
+
+void SimpleLogger::Fmt::writePointer(Writer& w, const void* val) {
+    char buf[MAX_HEX_LEN + 2] = {'0', 'x'};
+    w.append(buf, formatHex(buf + 2, (uintptr_t)val, 1) + 2);
+}
+
+// Write `val` as a `width`-digit decimal number, padded with zeros.
+static inline char* _write_digits(char* buf, uint32_t val, int width) {
+    SimpleLogger::Fmt::formatFixed(buf, val, width);
+    return buf + width;
+}
+
+SimpleLoggerMgr::TimeCache::TimeCache()
+    : curSec(-1)
+    , tzGap(0)
+    , lt(std::chrono::system_clock::time_point())
+{
+    memset(dateTime, 0x0, sizeof(dateTime));
+    memcpy(tzStr, "+00:00", sizeof(tzStr));
+}
+
+void SimpleLoggerMgr::TimeCache::update(std::chrono::system_clock::time_point now,
+                                        int tz_gap)
+{
+    int64_t us_epoch = std::chrono::duration_cast< std::chrono::microseconds >
+                       ( now.time_since_epoch() ).count();
+    int64_t sec = us_epoch / 1000000;
+    if (sec != curSec) {
+        // Second rolled over, call `localtime_r`.
+        lt = TimeInfo(now);
+        char* pp = dateTime;
+        pp = _write_digits(pp, lt.year, 4);     *pp++ = '-';
+        pp = _write_digits(pp, lt.month, 2);    *pp++ = '-';
+        pp = _write_digits(pp, lt.day, 2);      *pp++ = 'T';
+        pp = _write_digits(pp, lt.hour, 2);     *pp++ = ':';
+        pp = _write_digits(pp, lt.min, 2);      *pp++ = ':';
+        pp = _write_digits(pp, lt.sec, 2);
+        curSec = sec;
+    } else {
+        lt.msec = (us_epoch / 1000) % 1000;
+        lt.usec = us_epoch % 1000;
+    }
+
+    if (tz_gap != tzGap) {
+        int tz_gap_abs = (tz_gap < 0) ? (tz_gap * -1) : (tz_gap);
+        char* pp = tzStr;
+        *pp++ = (tz_gap >= 0) ? '+' : '-';
+        pp = _write_digits(pp, tz_gap_abs / 60, 2);     *pp++ = ':';
+        pp = _write_digits(pp, tz_gap_abs % 60, 2);
+        tzGap = tz_gap;
+    }
+}
+
+size_t SimpleLoggerMgr::TimeCache::write(char* buf) const {
+    char* pp = buf;
+    memcpy(pp, dateTime, sizeof(dateTime));         pp += sizeof(dateTime);
+    *pp++ = '.';
+    pp = _write_digits(pp, lt.msec, 3);             *pp++ = '_';
+    pp = _write_digits(pp, lt.usec, 3);
+    memcpy(pp, tzStr, sizeof(tzStr));               pp += sizeof(tzStr);
+    return pp - buf;
+}
+
+
+// ==========================================
+// Clock sources.
+
+// Conversion needs 128-bit integers, not available on 32-bit x86.
+#if defined(__x86_64__)
+    #define _TSC_SUPPORTED (1)
+    static inline uint64_t _read_tsc() { return __rdtsc(); }
+#elif defined(__aarch64__)
+    #define _TSC_SUPPORTED (1)
+    static inline uint64_t _read_tsc() {
+        uint64_t val;
+        asm volatile("mrs %0, cntvct_el0" : "=r" (val));
+        return val;
+    }
+#endif
+
+static inline int64_t _system_clock_ns() {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >
+           ( std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+static inline std::chrono::system_clock::time_point _ns_to_time_point(int64_t ns) {
+    return std::chrono::system_clock::time_point
+           ( std::chrono::duration_cast< std::chrono::system_clock::duration >
+             ( std::chrono::nanoseconds(ns) ) );
+}
+
+#ifdef _TSC_SUPPORTED
+// TSC to wall time conversion:
+//   ns = base_ns + ((tsc - base_tsc) * mult) >> 32
+//
+// Parameters are protected by a sequence lock, so that readers
+// never take a lock.
+struct TscClock {
+    TscClock()
+        : seq(0), baseTsc(0), baseNs(0), mult(0), numSteps(0)
+        , refTsc(0), refNs(0), enabled(false) {}
+
+    // Odd number: being updated.
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> baseTsc;
+    std::atomic<int64_t> baseNs;
+    // Nanoseconds per tick, in Q32 fixed point.
+    std::atomic<uint64_t> mult;
+    // Number of steps, readers should not clamp the time across a step.
+    std::atomic<uint64_t> numSteps;
+
+    // Reference point to get the long-term rate (updated by calibrator only).
+    uint64_t refTsc;
+    int64_t refNs;
+
+    std::atomic<bool> enabled;
+    std::mutex calibrationLock;
+};
+static TscClock tsc_clock;
+
+// Wall time that is considered as a step of the clock, not a drift.
+static const int64_t TSC_MAX_SLEW_NS = 1000000000;
+// Expected interval of calibration, should be the same as flusher's.
+static const int64_t TSC_CALIBRATION_INTERVAL_NS = 500000000;
+
+static inline int64_t _tsc_convert(uint64_t tsc,
+                                   uint64_t base_tsc,
+                                   int64_t base_ns,
+                                   uint64_t mult)
+{
+    // TSC of other cores can be slightly behind.
+    if (tsc < base_tsc) return base_ns;
+    return base_ns +
+           (int64_t)( ( (unsigned __int128)(tsc - base_tsc) * mult ) >> 32 );
+}
+
+static void _tsc_update(uint64_t base_tsc,
+                        int64_t base_ns,
+                        uint64_t mult,
+                        bool step = false)
+{
+    tsc_clock.seq.fetch_add(1, std::memory_order_acq_rel);
+    tsc_clock.baseTsc.store(base_tsc, std::memory_order_relaxed);
+    tsc_clock.baseNs.store(base_ns, std::memory_order_relaxed);
+    tsc_clock.mult.store(mult, std::memory_order_relaxed);
+    if (step) tsc_clock.numSteps.fetch_add(1, std::memory_order_relaxed);
+    tsc_clock.seq.fetch_add(1, std::memory_order_release);
+}
+
+static void _tsc_enable() {
+    if (tsc_clock.enabled.load()) return;
+
+    std::lock_guard<std::mutex> l(tsc_clock.calibrationLock);
+    if (tsc_clock.enabled.load()) return;
+
+    // Initial calibration, the flusher will refine it later.
+    tsc_clock.refTsc = _read_tsc();
+    tsc_clock.refNs = _system_clock_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    uint64_t tsc = _read_tsc();
+    int64_t ns = _system_clock_ns();
+
+    uint64_t mult = ( (unsigned __int128)(ns - tsc_clock.refNs) << 32 ) /
+                    std::max(tsc - tsc_clock.refTsc, (uint64_t)1);
+    _tsc_update(tsc, ns, mult);
+    tsc_clock.enabled = true;
+}
+
+static int64_t _tsc_now_ns() {
+    uint64_t tsc = 0, base_tsc = 0, mult = 0, num_steps = 0;
+    int64_t base_ns = 0;
+    uint32_t seq = 0;
+    do {
+        seq = tsc_clock.seq.load(std::memory_order_acquire);
+        base_tsc = tsc_clock.baseTsc.load(std::memory_order_relaxed);
+        base_ns = tsc_clock.baseNs.load(std::memory_order_relaxed);
+        mult = tsc_clock.mult.load(std::memory_order_relaxed);
+        num_steps = tsc_clock.numSteps.load(std::memory_order_relaxed);
+        tsc = _read_tsc();
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ( (seq & 0x1) ||
+              seq != tsc_clock.seq.load(std::memory_order_relaxed) );
+
+    int64_t ns = _tsc_convert(tsc, base_tsc, base_ns, mult);
+
+    // Never go backward within the same thread, unless the clock
+    // has been stepped since the last call (rebase onto the new one).
+    thread_local int64_t last_ns = 0;
+    thread_local uint64_t last_num_steps = 0;
+    if (ns < last_ns && num_steps == last_num_steps) ns = last_ns;
+    last_ns = ns;
+    last_num_steps = num_steps;
+    return ns;
+}
+#endif
+
+void SimpleLoggerMgr::calibrateTscClock(int64_t wall_ns) {
+#ifdef _TSC_SUPPORTED
+    if (!tsc_clock.enabled.load()) return;
+
+    std::lock_guard<std::mutex> l(tsc_clock.calibrationLock);
+    uint64_t tsc = _read_tsc();
+    if (!wall_ns) wall_ns = _system_clock_ns();
+    int64_t cur_ns = _tsc_convert( tsc,
+                                   tsc_clock.baseTsc.load(),
+                                   tsc_clock.baseNs.load(),
+                                   tsc_clock.mult.load() );
+    int64_t diff = wall_ns - cur_ns;
+
+    if (diff > TSC_MAX_SLEW_NS || diff < -TSC_MAX_SLEW_NS || tsc <= tsc_clock.refTsc) {
+        // Wall time has been stepped (or TSC has been reset), step as well.
+        tsc_clock.refTsc = tsc;
+        tsc_clock.refNs = wall_ns;
+        _tsc_update(tsc, wall_ns, tsc_clock.mult.load(), true);
+        return;
+    }
+
+    // Long-term rate.
+    uint64_t rate = ( (unsigned __int128)std::max(wall_ns - tsc_clock.refNs,
+                                                  (int64_t)1) << 32 ) /
+                    (tsc - tsc_clock.refTsc);
+
+    // Slew, so as to meet the wall time at the next calibration.
+    // Rate is bounded within [0.5x, 1.5x], thus it never goes backward.
+    uint64_t interval_ticks = ( (unsigned __int128)TSC_CALIBRATION_INTERVAL_NS << 32 )
+                              / std::max(rate, (uint64_t)1);
+    int64_t adjust = ( (__int128)diff << 32 ) /
+                     (int64_t)std::max(interval_ticks, (uint64_t)1);
+    int64_t new_mult = (int64_t)rate + adjust;
+    new_mult = std::max(new_mult, (int64_t)(rate / 2));
+    new_mult = std::min(new_mult, (int64_t)(rate + rate / 2));
+
+    _tsc_update(tsc, cur_ns, new_mult);
+#else
+    (void)wall_ns;
+#endif
+}
+
+std::chrono::system_clock::time_point
+    SimpleLogger::getCurrentTime(ClockSource src)
+{
+    switch (src) {
+#ifdef __linux__
+    case COARSE_CLOCK: {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return _ns_to_time_point( (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec );
+    }
+#endif
+#ifdef _TSC_SUPPORTED
+    case TSC_CLOCK:
+        if (tsc_clock.enabled.load(MOR)) {
+            return _ns_to_time_point( _tsc_now_ns() );
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+    return std::chrono::system_clock::now();
+}
+
+
+// Print filename part only (excluding directory path).
+static const char* _file_name_only(const char* source_file) {
+    size_t last_slash = 0;
+    for (size_t ii=0; source_file && source_file[ii] != 0; ++ii) {
+        if (source_file[ii] == '/' || source_file[ii] == '\\') last_slash = ii;
+    }
+    return source_file + ((last_slash)?(last_slash+1):0);
+}
 
 SimpleLoggerMgr* SimpleLoggerMgr::init() {
     SimpleLoggerMgr* mgr = instance.load(SimpleLogger::MOR);
@@ -173,6 +1539,7 @@ SimpleLoggerMgr* SimpleLoggerMgr::init() {
         if (!mgr) {
             mgr = new SimpleLoggerMgr();
             instance.store(mgr, SimpleLogger::MOR);
+            mgr->adoptPendingCallsites();
         }
     }
     return mgr;
@@ -437,6 +1804,7 @@ void SimpleLoggerMgr::handleSegFault(int sig) {
     mgr->enableOnlyOneDisplayer();
     mgr->flushAllLoggers(1, "Segmentation fault");
     mgr->logStackBacktrace();
+    mgr->flushConsole();
 
     printf("[SEG FAULT] Flushed all logs safely.\n");
     fflush(stdout);
@@ -460,6 +1828,7 @@ void SimpleLoggerMgr::handleSegAbort(int sig) {
     mgr->enableOnlyOneDisplayer();
     mgr->flushAllLoggers(1, "Abort");
     mgr->logStackBacktrace();
+    mgr->flushConsole();
 
     printf("[ABORT] Flushed all logs safely.\n");
     fflush(stdout);
@@ -499,16 +1868,19 @@ void SimpleLoggerMgr::handleStackTrace(int sig, siginfo_t* info, void* secret) {
 
 // LCOV_EXCL_STOP
 
-void SimpleLoggerMgr::flushWorker() {
+void SimpleLoggerMgr::flushWorker(SimpleLoggerMgr* mgr) {
 #ifdef __linux__
     pthread_setname_np(pthread_self(), "sl_flusher");
 #endif
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
     while (!mgr->chkTermination()) {
         // Every 500ms.
         size_t sub_ms = 500;
         mgr->sleepFlusher(sub_ms);
-        mgr->flushAllLoggers();
+        calibrateTscClock();
+        mgr->flushAllLoggersAsync();
+        mgr->syncAllLoggers();
+        mgr->prepareAllSegments();
+        mgr->enforceRetention();
         if (mgr->abortTimer) {
             if (mgr->abortTimer > sub_ms) {
                 mgr->abortTimer.fetch_sub(sub_ms);
@@ -520,35 +1892,49 @@ void SimpleLoggerMgr::flushWorker() {
     }
 }
 
-void SimpleLoggerMgr::compressWorker() {
+void SimpleLoggerMgr::compressWorker(SimpleLoggerMgr* mgr, size_t idx) {
 #ifdef __linux__
     pthread_setname_np(pthread_self(), "sl_compressor");
+    int cur_nice = 0;
 #endif
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
-    bool sleep_next_time = true;
-    while (!mgr->chkTermination()) {
-        // Every 500ms.
-        size_t sub_ms = 500;
-        if (sleep_next_time) {
-            mgr->sleepCompressor(sub_ms);
+    while (true) {
+        CompElem* elem = nullptr;
+        {   std::unique_lock<std::mutex> l(mgr->pendingCompElemsLock);
+            // Every 500ms, or when a job is added.
+            mgr->cvCompressor.wait_for
+                ( l, std::chrono::milliseconds(500),
+                  [mgr, idx]() {
+                      return !mgr->pendingCompElems.empty() ||
+                             mgr->termination ||
+                             idx >= mgr->numCompressors;
+                  } );
+            // Terminated, or removed from the pool.
+            if (mgr->termination || idx >= mgr->numCompressors) break;
+
+            if (!mgr->pendingCompElems.empty()) {
+                elem = mgr->pendingCompElems.front();
+                mgr->pendingCompElems.pop_front();
+            }
         }
-        sleep_next_time = true;
 
-        CompElem* elem = nullptr;
-        {   std::lock_guard<std::mutex> l(mgr->pendingCompElemsLock);
-            auto entry = mgr->pendingCompElems.begin();
-            if (entry != mgr->pendingCompElems.end()) {
-                elem = *entry;
-                mgr->pendingCompElems.erase(entry);
+#ifdef __linux__
+        int nice_level = mgr->compressorNice.load();
+        if (nice_level != cur_nice) {
+            // Per thread on Linux. Raising it back may not be allowed,
+            // then keep the current one and retry next time.
+            if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice_level) == 0) {
+                cur_nice = nice_level;
             }
         }
+#endif
+        if (!elem) continue;
 
-        if (elem) {
+        if (elem->split) {
+            elem->targetLogger->compressBlock(elem->split, elem->blockIdx);
+        } else {
             elem->targetLogger->doCompression(elem->fileNum);
-            delete elem;
-            // Continuous compression if pending item exists.
-            sleep_next_time = false;
         }
+        delete elem;
     }
 }
 
@@ -568,8 +1954,216 @@ void SimpleLoggerMgr::setExitOnCrash(bool exit_on_crash) {
 }
 
 
+// Queued console logs: ~4K lines of average size.
+static const size_t CONSOLE_RING_SIZE = 1024 * 1024;
+// Console logs are written by `write(2)` calls of up to this size.
+static const size_t CONSOLE_BATCH_SIZE = 64 * 1024;
+
+static void _wake_waiters(std::atomic<uint32_t>& word,
+                          std::atomic<uint32_t>& num_waiters);
+
+// Minimal io_uring for the background flusher: queue writes of all
+// loggers, and submit them by a single `io_uring_enter` call.
+#ifdef _SL_IO_URING
+class SimpleLoggerIoUring {
+public:
+    // Returns `nullptr` if io_uring is not available.
+    static SimpleLoggerIoUring* create(unsigned entries) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) return nullptr;
+
+        SimpleLoggerIoUring* ring = new SimpleLoggerIoUring(fd);
+        if (ring->init(params) != 0) {
+            delete ring;
+            return nullptr;
+        }
+        return ring;
+    }
+
+    ~SimpleLoggerIoUring() {
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqPtr && cqPtr != sqPtr) munmap(cqPtr, cqSize);
+        if (sqPtr) munmap(sqPtr, sqSize);
+        close(ringFd);
+    }
+
+    /**
+     * Queue a `writev` of `iov`.
+     *
+     * @return `false` if the queue is full.
+     */
+    bool prepareWrite(int fd,
+                      const struct iovec* iov,
+                      size_t num_iov,
+                      uint64_t offset,
+                      uint64_t user_data)
+    {
+        unsigned tail = *sqTail;
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= sqEntries) return false;
+
+        unsigned idx = tail & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)iov;
+        sqe->len = num_iov;
+        // The file is opened with `O_APPEND`, it always appends.
+        sqe->off = offset;
+        sqe->user_data = user_data;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        numQueued++;
+        return true;
+    }
+
+    /**
+     * Submit all queued writes, and wait for their completions.
+     * `func(user_data, res)` is invoked for each write, where `res` is
+     * the result of `writev` (or negative error code).
+     *
+     * @return `false` if io_uring is broken, and should not be used.
+     */
+    template<typename Func>
+    bool submitAndWait(Func func) {
+        unsigned to_submit = numQueued;
+        unsigned num_waiting = numQueued;
+        numQueued = 0;
+        bool broken = false;
+        while (num_waiting) {
+            if (!broken) {
+                int ret = syscall( __NR_io_uring_enter, ringFd, to_submit, 1,
+                                   IORING_ENTER_GETEVENTS, nullptr, 0 );
+                if (ret >= 0) {
+                    to_submit -= std::min((unsigned)ret, to_submit);
+                } else if (errno != EINTR && errno != EAGAIN) {
+                    broken = true;
+                    // Not submitted ones will be written synchronously.
+                    unsigned tail = *sqTail;
+                    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+                    for (unsigned ii = head; ii != tail; ++ii) {
+                        func(sqes[ii & *sqMask].user_data, -EAGAIN);
+                        num_waiting--;
+                    }
+                    __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+                }
+            }
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail && num_waiting; ++head) {
+                const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+                func(cqe.user_data, cqe.res);
+                num_waiting--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            if (broken && num_waiting) {
+                // Cannot wait by `io_uring_enter`, poll completions.
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        return !broken;
+    }
+
+private:
+    SimpleLoggerIoUring(int fd)
+        : ringFd(fd), sqPtr(nullptr), cqPtr(nullptr), sqes(nullptr)
+        , sqSize(0), cqSize(0), sqesSize(0), numQueued(0)
+        {}
+
+    int init(const struct io_uring_params& params) {
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes +
+                 params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sqSize = cqSize = std::max(sqSize, cqSize);
+
+        void* ptr = mmap( nullptr, sqSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ringFd,
+                          IORING_OFF_SQ_RING );
+        if (ptr == MAP_FAILED) return -1;
+        sqPtr = ptr;
+
+        if (single_mmap) {
+            cqPtr = sqPtr;
+        } else {
+            ptr = mmap( nullptr, cqSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_CQ_RING );
+            if (ptr == MAP_FAILED) return -1;
+            cqPtr = ptr;
+        }
+
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        ptr = mmap( nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES );
+        if (ptr == MAP_FAILED) return -1;
+        sqes = (struct io_uring_sqe*)ptr;
+
+        char* sq = (char*)sqPtr;
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+
+        char* cq = (char*)cqPtr;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+        return 0;
+    }
+
+    int ringFd;
+    void* sqPtr;
+    void* cqPtr;
+    struct io_uring_sqe* sqes;
+    size_t sqSize;
+    size_t cqSize;
+    size_t sqesSize;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    // Queued but not submitted yet.
+    unsigned numQueued;
+};
+#else
+class SimpleLoggerIoUring {
+public:
+    static SimpleLoggerIoUring* create(unsigned) { return nullptr; }
+};
+#endif
+
+// Max number of loggers whose writes are submitted at once.
+static const unsigned IO_URING_ENTRIES = 64;
+
 SimpleLoggerMgr::SimpleLoggerMgr()
-    : termination(false)
+    : maxLogLevel(6)
+    , uniformLogLevel(false)
+    , numCompressors(1)
+    , compressorNice(0)
+    , numIoUringWrites(0)
+    , consoleEpoch(0)
+    , numConsoleWaiters(0)
+    , numConsoleDropped(0)
+    , numConsoleDroppedNotified(0)
+    , consoleColor(false)
+    , flusherInvoked(false)
+    , termination(false)
     , oldSigSegvHandler(nullptr)
     , oldSigAbortHandler(nullptr)
     , stackTraceBuffer(nullptr)
@@ -595,8 +2189,16 @@ SimpleLoggerMgr::SimpleLoggerMgr()
     stackTraceBuffer = (char*)malloc(stackTraceBufferSize);
 
 #endif
-    tFlush = std::thread(SimpleLoggerMgr::flushWorker);
-    tCompress = std::thread(SimpleLoggerMgr::compressWorker);
+    tFlush = std::thread(SimpleLoggerMgr::flushWorker, this);
+    tCompressors.push_back(std::thread(SimpleLoggerMgr::compressWorker, this, 0));
+
+#if defined(__linux__) || defined(__APPLE__)
+    // Skip ANSI color codes if stdout is redirected.
+    consoleColor = isatty(STDOUT_FILENO);
+    consoleRing.reset(new SimpleLogger::LogRing(CONSOLE_RING_SIZE));
+    consoleBatch.resize(CONSOLE_BATCH_SIZE);
+    tConsole = std::thread(SimpleLoggerMgr::consoleWorker, this);
+#endif
 }
 
 SimpleLoggerMgr::~SimpleLoggerMgr() {
@@ -609,17 +2211,30 @@ SimpleLoggerMgr::~SimpleLoggerMgr() {
     {   std::unique_lock<std::mutex> l(cvFlusherLock);
         cvFlusher.notify_all();
     }
-    {   std::unique_lock<std::mutex> l(cvCompressorLock);
+    {   std::unique_lock<std::mutex> l(pendingCompElemsLock);
         cvCompressor.notify_all();
     }
     if (tFlush.joinable()) {
         tFlush.join();
     }
-    if (tCompress.joinable()) {
-        tCompress.join();
+    for (std::thread& tt: tCompressors) {
+        if (tt.joinable()) tt.join();
+    }
+    // The console writer drains all logs before exit.
+    consoleEpoch.fetch_add(1);
+    _wake_waiters(consoleEpoch, numConsoleWaiters);
+    if (tConsole.joinable()) {
+        tConsole.join();
     }
 
     free(stackTraceBuffer);
+
+    // Callsites will be registered again to the next instance.
+    std::lock_guard<std::mutex> l(callsitesLock);
+    for (SimpleLoggerCallsite* cs: callsites) {
+        cs->levels.store(SimpleLoggerCallsite::ALL_LEVELS, SimpleLogger::MOR);
+        cs->state.store(SimpleLoggerCallsite::UNREGISTERED, SimpleLogger::MOR);
+    }
 }
 
 // LCOV_EXCL_START
@@ -645,6 +2260,12 @@ void SimpleLoggerMgr::enableOnlyOneDisplayer() {
 // LCOV_EXCL_STOP
 
 void SimpleLoggerMgr::flushAllLoggers(int level, const std::string& msg) {
+    // Loggers cannot wait for the BG flusher while holding `loggersLock`.
+    _flushing_all_loggers = true;
+    struct ResetFlag {
+        ~ResetFlag() { _flushing_all_loggers = false; }
+    } reset_flag;
+
     std::unique_lock<std::mutex> l(loggersLock);
     for (auto& entry: loggers) {
         SimpleLogger* logger = entry;
@@ -656,50 +2277,517 @@ void SimpleLoggerMgr::flushAllLoggers(int level, const std::string& msg) {
     }
 }
 
-void SimpleLoggerMgr::addLogger(SimpleLogger* logger) {
-    std::unique_lock<std::mutex> l(loggersLock);
-    loggers.insert(logger);
-}
+void SimpleLoggerMgr::flushAllLoggersAsync() {
+#ifdef _SL_IO_URING
+    std::unique_lock<std::mutex> l_uring(ioUringLock);
+    if (!ioUring) {
+        l_uring.unlock();
+        flushAllLoggers();
+        return;
+    }
 
-void SimpleLoggerMgr::removeLogger(SimpleLogger* logger) {
+    _flushing_all_loggers = true;
+    struct ResetFlag {
+        ~ResetFlag() { _flushing_all_loggers = false; }
+    } reset_flag;
+
+    // Loggers being flushed, holding their `flushingLogs`.
+    struct Entry {
+        SimpleLogger* logger;
+        std::unique_lock<std::mutex> lock;
+        SimpleLogger::FlushBatch batch;
+        bool done;
+    };
     std::unique_lock<std::mutex> l(loggersLock);
-    loggers.erase(logger);
-}
-
-void SimpleLoggerMgr::addThread(uint64_t tid) {
-    std::unique_lock<std::mutex> l(activeThreadsLock);
-    activeThreads.insert(tid);
-}
+    std::vector<Entry> entries;
+    entries.reserve(loggers.size());
+    for (SimpleLogger* logger: loggers) {
+        if (!logger) continue;
+        if ( logger->ring.empty() &&
+             !logger->numThreadRings.load(SimpleLogger::MOR) ) {
+            // Same as `flush()` of an idle logger.
+            logger->flushAll();
+            continue;
+        }
+        std::unique_lock<std::mutex> ll(logger->flushingLogs, std::try_to_lock);
+        if (!ll.owns_lock()) continue;
+        logger->flushRequested.store(false, SimpleLogger::MOR);
+
+        entries.emplace_back();
+        Entry& entry = entries.back();
+        entry.logger = logger;
+        entry.lock = std::move(ll);
+        entry.done = false;
+        logger->beginFlush(entry.batch);
+    }
 
-void SimpleLoggerMgr::removeThread(uint64_t tid) {
-    std::unique_lock<std::mutex> l(activeThreadsLock);
-    activeThreads.erase(tid);
-}
+    // Each round writes a batch of each logger.
+    bool more = true;
+    while (more && ioUring) {
+        more = false;
+        for (size_t ii=0; ii<entries.size(); ++ii) {
+            Entry& entry = entries[ii];
+            if (entry.done) continue;
+            SimpleLogger* logger = entry.logger;
+            if (!logger->fillBatch(entry.batch)) {
+                entry.done = true;
+                continue;
+            }
+            more = true;
+            size_t num_iov = 0;
+            const struct iovec* iov = logger->sink.getPieces(num_iov);
+            if ( !num_iov ||
+                 !ioUring->prepareWrite( logger->sink.getFd(), iov, num_iov,
+                                         logger->sink.getOffset(), ii ) ) {
+                // Queue is full, or nothing to write.
+                logger->sink.commit();
+                logger->releaseBatch(entry.batch);
+            }
+        }
 
-void SimpleLoggerMgr::addCompElem(SimpleLoggerMgr::CompElem* elem) {
-    {   std::unique_lock<std::mutex> l(pendingCompElemsLock);
-        pendingCompElems.push_back(elem);
+        bool ok = ioUring->submitAndWait( [&](uint64_t idx, int res) {
+            Entry& entry = entries[idx];
+            entry.logger->sink.completeWrite(res);
+            entry.logger->releaseBatch(entry.batch);
+            numIoUringWrites.fetch_add(1, SimpleLogger::MOR);
+        } );
+        if (!ok) ioUring.reset();
     }
-    {   std::unique_lock<std::mutex> l(cvCompressorLock);
-        cvCompressor.notify_all();
+
+    for (Entry& entry: entries) {
+        // Remaining ones, if io_uring is broken.
+        while (!entry.done && entry.logger->fillBatch(entry.batch)) {
+            entry.logger->sink.commit();
+            entry.logger->releaseBatch(entry.batch);
+        }
+        entry.logger->endFlush(entry.batch);
     }
+#else
+    flushAllLoggers();
+#endif
 }
 
-void SimpleLoggerMgr::sleepFlusher(size_t ms) {
-    std::unique_lock<std::mutex> l(cvFlusherLock);
-    cvFlusher.wait_for(l, std::chrono::milliseconds(ms));
+void SimpleLoggerMgr::syncAllLoggers() {
+    std::unique_lock<std::mutex> l(loggersLock);
+    for (SimpleLogger* logger: loggers) {
+        if (!logger) continue;
+        if (logger->getDurability() != SimpleLogger::PERIODIC_SYNC) continue;
+        logger->syncFile(logger->syncIntervalMs.load(SimpleLogger::MOR));
+    }
 }
 
-void SimpleLoggerMgr::sleepCompressor(size_t ms) {
-    std::unique_lock<std::mutex> l(cvCompressorLock);
-    cvCompressor.wait_for(l, std::chrono::milliseconds(ms));
+// Remove files, with a directory handle per directory.
+static void _unlink_files(std::vector<std::string>& paths) {
+    if (paths.empty()) return;
+#if defined(__linux__) || defined(__APPLE__)
+    std::sort(paths.begin(), paths.end());
+    std::string cur_dir;
+    int dir_fd = -1;
+    for (const std::string& path: paths) {
+        size_t last_pos = path.rfind("/");
+        std::string dir = (last_pos == std::string::npos)
+                          ? "." : path.substr(0, last_pos + 1);
+        if (dir != cur_dir || dir_fd < 0) {
+            if (dir_fd >= 0) ::close(dir_fd);
+            dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            cur_dir = dir;
+        }
+        const char* name = (last_pos == std::string::npos)
+                           ? path.c_str() : path.c_str() + last_pos + 1;
+        if (dir_fd >= 0) {
+            (void)unlinkat(dir_fd, name, 0);
+        } else {
+            (void)remove(path.c_str());
+        }
+    }
+    if (dir_fd >= 0) ::close(dir_fd);
+#else
+    for (const std::string& path: paths) remove(path.c_str());
+#endif
 }
 
-bool SimpleLoggerMgr::chkTermination() const {
-    return termination;
-}
+size_t SimpleLoggerMgr::enforceRetention() {
+    std::vector<std::string> paths;
+    int64_t now_sec = std::chrono::system_clock::to_time_t
+                      ( std::chrono::system_clock::now() );
+    SimpleLogger::RetentionPolicy global;
+    {   std::lock_guard<std::mutex> l(globalRetentionLock);
+        global = globalRetention;
+    }
 
-void SimpleLoggerMgr::setCriticalInfo(const std::string& info_str) {
+    {   std::unique_lock<std::mutex> l(loggersLock);
+        for (SimpleLogger* logger: loggers) {
+            if (!logger) continue;
+            logger->collectExpiredFiles(now_sec, paths);
+        }
+
+        // The oldest file of all loggers, until the budget is met.
+        // Min-heap of the oldest file of each logger, by its mtime.
+        typedef std::pair<int64_t, SimpleLogger*> OldestFile;
+        std::priority_queue< OldestFile,
+                             std::vector<OldestFile>,
+                             std::greater<OldestFile> > oldest_files;
+        size_t num_files = 0;
+        uint64_t total_bytes = 0;
+        if (!global.isUnlimited()) {
+            for (SimpleLogger* logger: loggers) {
+                if (!logger) continue;
+                std::lock_guard<std::mutex> ll(logger->retentionLock);
+                num_files += logger->archivedFiles.size();
+                total_bytes += logger->archivedBytes;
+                if (logger->archivedFiles.empty()) continue;
+                oldest_files.push( OldestFile( logger->archivedFiles.front().mtime,
+                                               logger ) );
+            }
+        }
+
+        while (!oldest_files.empty()) {
+            OldestFile oldest = oldest_files.top();
+            if ( !(global.maxFiles && num_files > global.maxFiles) &&
+                 !(global.maxTotalBytes && total_bytes > global.maxTotalBytes) &&
+                 !( global.maxAgeSec &&
+                    oldest.first + (int64_t)global.maxAgeSec < now_sec ) ) {
+                break;
+            }
+            oldest_files.pop();
+
+            SimpleLogger* logger = oldest.second;
+            std::lock_guard<std::mutex> ll(logger->retentionLock);
+            // Compression jobs may have added files meanwhile,
+            // they will be counted next time.
+            if (logger->archivedFiles.empty()) continue;
+            uint64_t bytes_before = logger->archivedBytes;
+            logger->popArchivedFile(paths);
+            num_files--;
+            total_bytes -= std::min(total_bytes,
+                                    bytes_before - logger->archivedBytes);
+            if (logger->archivedFiles.empty()) continue;
+            oldest_files.push( OldestFile( logger->archivedFiles.front().mtime,
+                                           logger ) );
+        }
+    }
+
+    // Outside the lock, loggers can be added or removed meanwhile.
+    _unlink_files(paths);
+    return paths.size();
+}
+
+void SimpleLoggerMgr::setGlobalRetentionPolicy
+                      (const SimpleLogger::RetentionPolicy& policy)
+{
+    {   std::lock_guard<std::mutex> l(globalRetentionLock);
+        globalRetention = policy;
+    }
+    invokeFlusher();
+}
+
+void SimpleLoggerMgr::prepareAllSegments() {
+    std::unique_lock<std::mutex> l(loggersLock);
+    for (SimpleLogger* logger: loggers) {
+        if (!logger) continue;
+        logger->closeRetiredSegments();
+        logger->prepareNextSegment();
+    }
+}
+
+bool SimpleLoggerMgr::setIoUring(bool enable) {
+    std::lock_guard<std::mutex> l(ioUringLock);
+    if (!enable) {
+        ioUring.reset();
+        return false;
+    }
+    if (!ioUring) {
+        ioUring.reset(SimpleLoggerIoUring::create(IO_URING_ENTRIES));
+    }
+    return (bool)ioUring;
+}
+
+bool SimpleLoggerMgr::isIoUringEnabled() {
+    std::lock_guard<std::mutex> l(ioUringLock);
+    return (bool)ioUring;
+}
+
+void SimpleLoggerMgr::addLogger(SimpleLogger* logger) {
+    {   std::unique_lock<std::mutex> l(loggersLock);
+        loggers.insert(logger);
+        logger->registered.store(true, SimpleLogger::MOR);
+    }
+    countLoggerLevel(logger, 1);
+}
+
+void SimpleLoggerMgr::removeLogger(SimpleLogger* logger) {
+    {   std::unique_lock<std::mutex> l(loggersLock);
+        // Producers waiting for space should flush by themselves.
+        logger->registered.store(false, SimpleLogger::MOR);
+        loggers.erase(logger);
+    }
+    countLoggerLevel(logger, -1);
+}
+
+// Same as `fnmatch` without flags: `*` and `?` only.
+static bool _glob_match(const char* pattern, const char* str) {
+    const char* star = nullptr;
+    const char* star_str = nullptr;
+    while (*str) {
+        if (*pattern == '?' || *pattern == *str) {
+            pattern++;
+            str++;
+        } else if (*pattern == '*') {
+            // Match empty string first, and extend it on mismatch.
+            star = pattern++;
+            star_str = str;
+        } else if (star) {
+            pattern = star + 1;
+            str = ++star_str;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return !*pattern;
+}
+
+// Callsites hit before `SimpleLoggerMgr` is created.
+static std::mutex pending_callsites_lock;
+static std::vector<SimpleLoggerCallsite*> pending_callsites;
+
+static bool _callsite_match(const std::string& file_pattern,
+                            const std::string& func_pattern,
+                            const SimpleLoggerCallsite* cs)
+{
+    const char* file = cs->file ? cs->file : "";
+    if (file_pattern.find('/') == std::string::npos) {
+        file = _file_name_only(file);
+    }
+    return _glob_match(file_pattern.c_str(), file) &&
+           _glob_match(func_pattern.c_str(), cs->func ? cs->func : "");
+}
+
+uint8_t SimpleLoggerCallsite::registerCallsite(SimpleLoggerCallsite& cs,
+                                               int level,
+                                               const char* file,
+                                               const char* func,
+                                               size_t line)
+{
+    {   std::lock_guard<std::mutex> l(pending_callsites_lock);
+        // `init()` takes pending ones after the instance is set.
+        if (!SimpleLoggerMgr::getWithoutInit()) {
+            uint8_t state = cs.state.load(SimpleLogger::MOR);
+            // Registered by another thread.
+            if (state != UNREGISTERED) return state;
+
+            // Follow the log level until the manager takes it.
+            cs.file = file;
+            cs.func = func;
+            cs.line = line;
+            cs.level = level;
+            cs.levels.store(ALL_LEVELS, SimpleLogger::MOR);
+            cs.state.store(FOLLOW_LEVEL, SimpleLogger::MOR);
+            pending_callsites.push_back(&cs);
+            return FOLLOW_LEVEL;
+        }
+    }
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    return mgr->registerCallsite(&cs, level, file, func, line);
+}
+
+void SimpleLoggerMgr::adoptPendingCallsites() {
+    std::lock_guard<std::mutex> l(pending_callsites_lock);
+    std::lock_guard<std::mutex> ll(callsitesLock);
+    for (SimpleLoggerCallsite* cs: pending_callsites) {
+        callsites.push_back(cs);
+        applyCallsiteRules(cs);
+    }
+    pending_callsites.clear();
+}
+
+uint8_t SimpleLoggerMgr::registerCallsite(SimpleLoggerCallsite* cs,
+                                          int level,
+                                          const char* file,
+                                          const char* func,
+                                          size_t line)
+{
+    std::lock_guard<std::mutex> l(callsitesLock);
+    uint8_t state = cs->state.load(SimpleLogger::MOR);
+    // Registered by another thread.
+    if (state != SimpleLoggerCallsite::UNREGISTERED) return state;
+
+    cs->file = file;
+    cs->func = func;
+    cs->line = line;
+    cs->level = level;
+    callsites.push_back(cs);
+    return applyCallsiteRules(cs);
+}
+
+uint8_t SimpleLoggerMgr::applyCallsiteRules(SimpleLoggerCallsite* cs) {
+    // The last matching rule wins.
+    uint8_t state = SimpleLoggerCallsite::FOLLOW_LEVEL;
+    for (const CallsiteRule& rule: callsiteRules) {
+        if (_callsite_match(rule.filePattern, rule.funcPattern, cs)) {
+            state = rule.enable ? SimpleLoggerCallsite::FORCE_ON
+                                : SimpleLoggerCallsite::FORCE_OFF;
+        }
+    }
+
+    uint8_t levels = 0;
+    if (state == SimpleLoggerCallsite::FORCE_ON) {
+        levels = SimpleLoggerCallsite::ALL_LEVELS;
+    } else if (state == SimpleLoggerCallsite::FOLLOW_LEVEL && maxLogLevel >= 0) {
+        levels = (uint8_t)( (2u << std::min(maxLogLevel, 6)) - 1 );
+        if (uniformLogLevel) levels |= SimpleLoggerCallsite::EXACT_LEVELS;
+    }
+    cs->state.store(state, SimpleLogger::MOR);
+    cs->levels.store(levels, SimpleLogger::MOR);
+    return state;
+}
+
+size_t SimpleLoggerMgr::addCallsiteRule(const std::string& file_pattern,
+                                        const std::string& func_pattern,
+                                        bool enable)
+{
+    std::lock_guard<std::mutex> l(callsitesLock);
+    callsiteRules.push_back( CallsiteRule{file_pattern, func_pattern, enable} );
+    size_t num_matched = 0;
+    for (SimpleLoggerCallsite* cs: callsites) {
+        if (!_callsite_match(file_pattern, func_pattern, cs)) continue;
+        applyCallsiteRules(cs);
+        num_matched++;
+    }
+    return num_matched;
+}
+
+size_t SimpleLoggerMgr::enableCallsites(const std::string& file_pattern,
+                                        const std::string& func_pattern)
+{
+    return addCallsiteRule(file_pattern, func_pattern, true);
+}
+
+size_t SimpleLoggerMgr::disableCallsites(const std::string& file_pattern,
+                                         const std::string& func_pattern)
+{
+    return addCallsiteRule(file_pattern, func_pattern, false);
+}
+
+void SimpleLoggerMgr::resetCallsites() {
+    std::lock_guard<std::mutex> l(callsitesLock);
+    callsiteRules.clear();
+    for (SimpleLoggerCallsite* cs: callsites) applyCallsiteRules(cs);
+}
+
+size_t SimpleLoggerMgr::getNumCallsites() {
+    std::lock_guard<std::mutex> l(callsitesLock);
+    return callsites.size();
+}
+
+void SimpleLoggerMgr::setLoggerLevel(SimpleLogger* logger, int level) {
+    // Under the lock, so that `loggerLevels` and the logger agree.
+    std::lock_guard<std::mutex> l(callsitesLock);
+    logger->curLogLevel = level;
+    auto entry = loggerLevels.find(logger);
+    // Not running, will be counted by `addLogger`.
+    if (entry == loggerLevels.end()) return;
+    entry->second = level;
+    updateCallsiteLevels();
+}
+
+void SimpleLoggerMgr::countLoggerLevel(SimpleLogger* logger, int delta) {
+    std::lock_guard<std::mutex> l(callsitesLock);
+    if (delta > 0) {
+        loggerLevels[logger] = logger->getLogLevel();
+    } else {
+        loggerLevels.erase(logger);
+    }
+    updateCallsiteLevels();
+}
+
+void SimpleLoggerMgr::updateCallsiteLevels() {
+    int max_level = -1;
+    int min_level = 6;
+    for (auto& entry: loggerLevels) {
+        int level = std::max(entry.second, -1);
+        max_level = std::max(max_level, level);
+        min_level = std::min(min_level, level);
+    }
+    bool uniform = (min_level == max_level);
+    if (loggerLevels.empty()) {
+        // No running logger: callsites allow all levels, and a logger
+        // that is not started (or already stopped) checks its own level.
+        max_level = 6;
+        uniform = false;
+    }
+    if (max_level == maxLogLevel && uniform == uniformLogLevel) return;
+    maxLogLevel = max_level;
+    uniformLogLevel = uniform;
+    for (SimpleLoggerCallsite* cs: callsites) applyCallsiteRules(cs);
+}
+
+void SimpleLoggerMgr::addThread(uint64_t tid) {
+    std::unique_lock<std::mutex> l(activeThreadsLock);
+    activeThreads.insert(tid);
+}
+
+void SimpleLoggerMgr::removeThread(uint64_t tid) {
+    std::unique_lock<std::mutex> l(activeThreadsLock);
+    activeThreads.erase(tid);
+}
+
+void SimpleLoggerMgr::addCompElem(SimpleLoggerMgr::CompElem* elem) {
+    std::unique_lock<std::mutex> l(pendingCompElemsLock);
+    if (elem->split) {
+        // Blocks of a file being compressed, to finish it first.
+        pendingCompElems.push_front(elem);
+    } else {
+        pendingCompElems.push_back(elem);
+    }
+    cvCompressor.notify_one();
+}
+
+size_t SimpleLoggerMgr::setCompressorPool(size_t num_threads, int nice_level) {
+    // Bounded by the number of cores, not to starve the application.
+    size_t num_cores = std::thread::hardware_concurrency();
+    num_threads = std::min(num_threads, std::max(num_cores, (size_t)1));
+    num_threads = std::max(num_threads, (size_t)1);
+    nice_level = std::min(std::max(nice_level, 0), 19);
+
+    std::lock_guard<std::mutex> l(compressorsLock);
+    compressorNice = nice_level;
+    {   std::unique_lock<std::mutex> ll(pendingCompElemsLock);
+        numCompressors = num_threads;
+        // To apply the nice value, or to exit.
+        cvCompressor.notify_all();
+    }
+    while (tCompressors.size() > num_threads) {
+        if (tCompressors.back().joinable()) tCompressors.back().join();
+        tCompressors.pop_back();
+    }
+    while (tCompressors.size() < num_threads) {
+        tCompressors.push_back( std::thread( SimpleLoggerMgr::compressWorker,
+                                             this,
+                                             tCompressors.size() ) );
+    }
+    return num_threads;
+}
+
+void SimpleLoggerMgr::sleepFlusher(size_t ms) {
+    std::unique_lock<std::mutex> l(cvFlusherLock);
+    cvFlusher.wait_for( l, std::chrono::milliseconds(ms),
+                        [this]() { return flusherInvoked || termination; } );
+    flusherInvoked = false;
+}
+
+void SimpleLoggerMgr::invokeFlusher() {
+    {   std::unique_lock<std::mutex> l(cvFlusherLock);
+        flusherInvoked = true;
+    }
+    cvFlusher.notify_all();
+}
+
+bool SimpleLoggerMgr::chkTermination() const {
+    return termination;
+}
+
+void SimpleLoggerMgr::setCriticalInfo(const std::string& info_str) {
     globalCriticalInfo = info_str;
 }
 
@@ -708,6 +2796,68 @@ const std::string& SimpleLoggerMgr::getCriticalInfo() const {
 }
 
 
+// ==========================================
+// Adaptive spin-then-wait.
+
+static inline void _cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Spinning is useless if there is only one core.
+static const size_t _max_spin_count =
+    (std::thread::hardware_concurrency() > 1) ? 4096 : 0;
+
+// Wait while `word == expected`. It may return early (spurious wake-up
+// or timeout), so that the caller should check its condition again.
+static void _wait_while_equal(std::atomic<uint32_t>& word,
+                              uint32_t expected,
+                              std::atomic<uint32_t>& num_waiters)
+{
+    // Spin longer if spinning worked last time, otherwise shorter.
+    thread_local size_t spin_count = _max_spin_count / 16;
+    for (size_t ii=0; ii<spin_count; ++ii) {
+        if (word.load(std::memory_order_acquire) != expected) {
+            spin_count = std::min(spin_count * 2, _max_spin_count);
+            return;
+        }
+        _cpu_relax();
+    }
+    spin_count = std::max(spin_count / 2, _max_spin_count / 256);
+
+    // Pairs with `_wake_waiters()`, should be sequentially consistent.
+    num_waiters.fetch_add(1);
+#ifdef __linux__
+    // Timeout as a safety net.
+    struct timespec timeout = {0, 10 * 1000 * 1000};
+    syscall( SYS_futex, reinterpret_cast<uint32_t*>(&word),
+             FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0 );
+#else
+    if (word.load() == expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+#endif
+    num_waiters.fetch_sub(1);
+}
+
+// Should be called after modifying `word`.
+static void _wake_waiters(std::atomic<uint32_t>& word,
+                          std::atomic<uint32_t>& num_waiters)
+{
+    // Skip the system call if nobody is waiting.
+    if (!num_waiters.load()) return;
+#ifdef __linux__
+    syscall( SYS_futex, reinterpret_cast<uint32_t*>(&word),
+             FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0 );
+#else
+    (void)word;
+#endif
+}
+
+
 // ==========================================
 
 struct ThreadWrapper {
@@ -743,140 +2893,794 @@ struct ThreadWrapper {
         if (mgr) {
             mgr->removeThread(mySelf);
         }
+        retireRings();
     }
 #else
     ThreadWrapper() : myTid(0) {}
-    ~ThreadWrapper() {}
+    ~ThreadWrapper() {
+        retireRings();
+    }
 #endif
+    void retireRings() {
+        // Hand over the remaining logs to the flusher,
+        // and the rings will be reused by other threads.
+        for (ThreadRing& entry: rings) entry.ring->retire();
+    }
+
     uint64_t mySelf;
     uint32_t myTid;
+
+    // Per-thread buffers of this thread, one for each logger.
+    struct ThreadRing {
+        uint64_t loggerId;
+        std::shared_ptr<SimpleLogger::LogRing> ring;
+    };
+    std::vector<ThreadRing> rings;
 };
 
+static ThreadWrapper& _my_thread_wrapper() {
+    thread_local ThreadWrapper thread_wrapper;
+    return thread_wrapper;
+}
+
 
 
 // ==========================================
 
-SimpleLogger::LogElem::LogElem() : len(0), status(CLEAN) {
-    memset(ctx, 0x0, MSG_SIZE);
+SimpleLogger::LogRing::LogRing(size_t _capacity, bool single_producer)
+    : mem(nullptr)
+    , descs(nullptr)
+    , buf(nullptr)
+    , capacity(4 * MSG_SIZE)
+    , numDescs(0)
+    , singleProducer(single_producer)
+    , head(0)
+    , tail(0)
+    , consumedEpoch(0)
+    , numWaiters(0)
+    , retired(false)
+{
+    // Power of 2, and a message of `MSG_SIZE` should fit.
+    while (capacity < _capacity) capacity *= 2;
+    const size_t MAX_CAPACITY = (size_t)1 << 31;
+    if (capacity > MAX_CAPACITY) capacity = MAX_CAPACITY;
+
+    // Up to twice the number of average-sized records.
+    numDescs = capacity / AVG_RECORD_SIZE * 2;
+
+    // Descriptors and payload area in a single allocation,
+    // aligned to cache line.
+    size_t descs_size = sizeof(Desc) * numDescs;
+    mem = calloc(1, descs_size + capacity + CACHE_LINE_SIZE);
+    uintptr_t aligned = ( (uintptr_t)mem + CACHE_LINE_SIZE - 1 ) &
+                        ~( (uintptr_t)CACHE_LINE_SIZE - 1 );
+    descs = reinterpret_cast<Desc*>(aligned);
+    buf = reinterpret_cast<char*>(aligned) + descs_size;
+}
+
+SimpleLogger::LogRing::~LogRing() {
+    free(mem);
+}
+
+char* SimpleLogger::LogRing::reserve(size_t len, uint32_t& seq_out) {
+    uint32_t rec_size = recordSize(len);
+    uint64_t head_exp = head.load(MOR);
+    uint32_t seq = 0;
+    uint32_t pos = 0;
+    uint32_t contiguous = 0;
+    uint32_t to_reserve = 0;
+    do {
+        seq = head_exp >> 32;
+        pos = (uint32_t)head_exp;
+        // Acquire: consumer should be done with the space and descriptor.
+        uint64_t cur_tail = tail.load(std::memory_order_acquire);
+        if (seq - (uint32_t)(cur_tail >> 32) >= numDescs) return nullptr;
+
+        contiguous = capacity - (pos & (capacity - 1));
+        // If it does not fit at the end, skip the remaining space.
+        to_reserve = (rec_size > contiguous)
+                     ? contiguous + rec_size
+                     : rec_size;
+        if (pos + to_reserve - (uint32_t)cur_tail > capacity) return nullptr;
+
+        uint64_t head_new = makePos(seq + 1, pos + to_reserve);
+        if (singleProducer) {
+            head.store(head_new, MOR);
+            break;
+        }
+        if ( head.compare_exchange_weak( head_exp, head_new, MOR ) ) {
+            break;
+        }
+    } while (true);
+
+    Desc& desc = descs[seq & (numDescs - 1)];
+    desc.len = len;
+    desc.end = pos + to_reserve;
+    seq_out = seq;
+    return buf + ((desc.end - rec_size) & (capacity - 1));
 }
 
-// True if dirty.
-bool SimpleLogger::LogElem::needToFlush() {
-    return status.load(MOR) == DIRTY;
+void SimpleLogger::LogRing::publish(uint32_t seq,
+                                    RecordType type,
+                                    int64_t time_raw)
+{
+    Desc& desc = descs[seq & (numDescs - 1)];
+    desc.type = type;
+    desc.timeRaw = time_raw;
+    desc.seq.store(seq + 1, std::memory_order_release);
 }
 
-// True if no other thread is working on it.
-bool SimpleLogger::LogElem::available() {
-    Status s = status.load(MOR);
-    return s == CLEAN || s == DIRTY;
+bool SimpleLogger::LogRing::front(Record& rec_out) {
+    return peek(frontSeq(), rec_out);
 }
 
-int SimpleLogger::LogElem::write(size_t _len, char* msg) {
-    Status exp = CLEAN;
-    Status val = WRITING;
-    if (!status.compare_exchange_strong(exp, val)) return -1;
+void SimpleLogger::LogRing::pop() {
+    popUntil(frontSeq() + 1);
+}
 
-    len = (_len > MSG_SIZE) ? MSG_SIZE : _len;
-    memcpy(ctx, msg, len);
+bool SimpleLogger::LogRing::peek(uint32_t seq, Record& rec_out) const {
+    const Desc& desc = descs[seq & (numDescs - 1)];
+    // Not published yet (or nothing to consume).
+    if (desc.seq.load(std::memory_order_acquire) != seq + 1) return false;
 
-    status.store(LogElem::DIRTY);
-    return 0;
+    rec_out.type = (RecordType)desc.type;
+    rec_out.payload = buf + ( (desc.end - recordSize(desc.len)) &
+                              (capacity - 1) );
+    rec_out.len = desc.len;
+    rec_out.timeRaw = desc.timeRaw;
+    return true;
+}
+
+void SimpleLogger::LogRing::popUntil(uint32_t seq) {
+    if (seq == frontSeq()) return;
+    // The last consumed one, not reused until `tail` passes it.
+    const Desc& desc = descs[(seq - 1) & (numDescs - 1)];
+    // Release: producers can reuse the space and descriptors.
+    tail.store( makePos(seq, desc.end), std::memory_order_release );
 }
 
-int SimpleLogger::LogElem::flush(std::ofstream& fs) {
-    Status exp = DIRTY;
-    Status val = FLUSHING;
-    if (!status.compare_exchange_strong(exp, val)) return -1;
+void SimpleLogger::LogRing::waitForSpace(uint32_t epoch) {
+    _wait_while_equal(consumedEpoch, epoch, numWaiters);
+}
 
-    fs.write(ctx, len);
+void SimpleLogger::LogRing::notifyConsumed() {
+    consumedEpoch.fetch_add(1);
+    _wake_waiters(consumedEpoch, numWaiters);
+}
 
-    status.store(LogElem::CLEAN);
-    return 0;
+bool SimpleLogger::LogRing::empty() const {
+    return head.load(MOR) == tail.load(MOR);
 }
 
 
 // ==========================================
+// Log file writer.
+
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+struct SimpleLogger::FileSink::Deflater {
+    Deflater() : ok(false), outLen(0), out(OUT_SIZE) {
+        memset(&zs, 0x0, sizeof(zs));
+        // +16: gzip header and trailer, instead of zlib's.
+        ok = ( deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK );
+    }
+    ~Deflater() {
+        if (ok) deflateEnd(&zs);
+    }
+    static const size_t OUT_SIZE = 256 * 1024;
+    z_stream zs;
+    bool ok;
+    // Compressed data not written yet.
+    size_t outLen;
+    std::vector<unsigned char> out;
+};
+#else
+struct SimpleLogger::FileSink::Deflater {};
+#endif
 
-
-SimpleLogger::SimpleLogger(const std::string& file_path,
-                           size_t max_log_elems,
-                           uint64_t log_file_size_limit,
-                           uint32_t max_log_files)
-    : filePath(replaceString(file_path, "//", "/"))
-    , maxLogFiles(max_log_files)
-    , maxLogFileSize(log_file_size_limit)
-    , numCompJobs(0)
-    , curLogLevel(4)
-    , curDispLevel(4)
-    , tzGap( SimpleLoggerMgr::getTzGap() )
-    , cursor(0)
-    , logs(max_log_elems)
+SimpleLogger::FileSink::FileSink()
+#if defined(__linux__) || defined(__APPLE__)
+    : fd(-1)
+#else
+    : fp(nullptr)
+#endif
+    , numPieces(0)
+    , maxPieces(1024)
+    , stagingLen(0)
+    , offset(0)
+    , failed(false)
 {
-    findMinMaxRevNum(minRevnum, curRevnum);
+#if defined(IOV_MAX)
+    maxPieces = std::min(maxPieces, (size_t)IOV_MAX);
+#endif
+    pieces.resize(maxPieces);
 }
 
-SimpleLogger::~SimpleLogger() {
-    stop();
+SimpleLogger::FileSink::~FileSink() {
+    close();
 }
 
-void SimpleLogger::setCriticalInfo(const std::string& info_str) {
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
-    if (mgr) {
-        mgr->setCriticalInfo(info_str);
+int SimpleLogger::FileSink::open(const std::string& path) {
+    close();
+    uint64_t size = 0;
+    Handle h = openFile(path, size);
+    if (!isValidHandle(h)) {
+        failed = true;
+        return -1;
     }
+    uint64_t dummy = 0;
+    swapFile(h, size, dummy);
+    return 0;
 }
 
-void SimpleLogger::setCrashDumpPath(const std::string& path,
-                                    bool origin_only)
-{
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
-    if (mgr) {
-        mgr->setCrashDumpPath(path, origin_only);
-    }
+void SimpleLogger::FileSink::close() {
+    if (!isOpen()) return;
+    commit();
+    // Closing is not a failure.
+    bool was_failed = failed;
+    uint64_t size = 0;
+    Handle h = swapFile(invalidHandle(), 0, size);
+    failed = was_failed;
+    closeFile(h, size, false);
 }
 
-void SimpleLogger::setStackTraceOriginOnly(bool origin_only) {
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
-    if (mgr) {
-        mgr->setStackTraceOriginOnly(origin_only);
-    }
+SimpleLogger::FileSink::Handle SimpleLogger::FileSink::invalidHandle() {
+#if defined(__linux__) || defined(__APPLE__)
+    return -1;
+#else
+    return nullptr;
+#endif
 }
 
-void SimpleLogger::logStackBacktrace() {
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
-    if (mgr) {
-        mgr->enableOnlyOneDisplayer();
-        mgr->logStackBacktrace(0);
-    }
+bool SimpleLogger::FileSink::isValidHandle(Handle h) {
+#if defined(__linux__) || defined(__APPLE__)
+    return h >= 0;
+#else
+    return h != nullptr;
+#endif
 }
 
-void SimpleLogger::shutdown() {
-    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
-    if (mgr) {
-        mgr->destroy();
+SimpleLogger::FileSink::Handle
+    SimpleLogger::FileSink::openFile(const std::string& path,
+                                     uint64_t& size_out,
+                                     uint64_t prealloc_size)
+{
+    size_out = 0;
+#if defined(__linux__) || defined(__APPLE__)
+    int h = ::open( path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644 );
+    if (h < 0) return h;
+    off_t size = lseek(h, 0, SEEK_END);
+    if (size > 0) size_out = size;
+  #if defined(__linux__)
+    // Allocate blocks now, instead of on each write. Not supported
+    // by some file systems, which is fine.
+    if (prealloc_size > size_out) {
+        (void)fallocate(h, FALLOC_FL_KEEP_SIZE, size_out,
+                        prealloc_size - size_out);
     }
+  #else
+    (void)prealloc_size;
+  #endif
+#else
+    FILE* h = fopen(path.c_str(), "ab");
+    if (!h) return h;
+    fseek(h, 0, SEEK_END);
+    long size = ftell(h);
+    if (size > 0) size_out = size;
+    (void)prealloc_size;
+#endif
+    return h;
 }
 
-std::string SimpleLogger::replaceString( const std::string& src_str,
-                                         const std::string& before,
-                                         const std::string& after )
+void SimpleLogger::FileSink::closeFile(Handle h, uint64_t trim_size, bool sync) {
+    if (!isValidHandle(h)) return;
+#if defined(__linux__) || defined(__APPLE__)
+  #if defined(__linux__)
+    // Release the reserved space beyond the data.
+    if (trim_size) (void)ftruncate(h, trim_size);
+    if (sync) fdatasync(h);
+  #else
+    (void)trim_size;
+    if (sync) fsync(h);
+  #endif
+    ::close(h);
+#else
+    (void)trim_size;
+    (void)sync;
+    fclose(h);
+#endif
+}
+
+SimpleLogger::FileSink::Handle
+    SimpleLogger::FileSink::swapFile(Handle h,
+                                     uint64_t size,
+                                     uint64_t& prev_size_out)
 {
-    size_t last = 0;
-    size_t pos = src_str.find(before, last);
-    std::string ret;
-    while (pos != std::string::npos) {
-        ret += src_str.substr(last, pos - last);
-        ret += after;
-        last = pos + before.size();
-        pos = src_str.find(before, last);
-    }
-    if (last < src_str.size()) {
-        ret += src_str.substr(last);
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    if (deflater && isOpen()) {
+        // Finish the stream of the previous file, and start a new one.
+        deflatePieces(Z_FINISH);
+        if (deflater->ok) deflateReset(&deflater->zs);
     }
-    return ret;
+#endif
+    prev_size_out = offset.load(MOR);
+#if defined(__linux__) || defined(__APPLE__)
+    Handle old = fd;
+    fd = h;
+#else
+    Handle old = fp;
+    fp = h;
+#endif
+    offset.store(size, MOR);
+    failed = !isValidHandle(h);
+    return old;
 }
 
-void SimpleLogger::findMinMaxRevNum( size_t& min_revnum_out,
+bool SimpleLogger::FileSink::isOpen() const {
+#if defined(__linux__) || defined(__APPLE__)
+    return fd >= 0;
+#else
+    return fp != nullptr;
+#endif
+}
+
+void SimpleLogger::FileSink::append(const char* data, size_t len) {
+    if (!len) return;
+    if (numPieces) {
+        // Contiguous to the previous one, e.g., 8-byte aligned records
+        // in a ring, or messages in the staging area.
+        Piece& prev = pieces[numPieces - 1];
+        if ((char*)prev.iov_base + prev.iov_len == data) {
+            prev.iov_len += len;
+            return;
+        }
+    }
+    if (numPieces == maxPieces) commit();
+    pieces[numPieces].iov_base = (void*)data;
+    pieces[numPieces].iov_len = len;
+    numPieces++;
+}
+
+char* SimpleLogger::FileSink::getStagingBuf(size_t len) {
+    if (staging.size() < STAGING_SIZE) staging.resize(STAGING_SIZE);
+    if (stagingLen + len > staging.size()) commit();
+    if (len > staging.size()) staging.resize(len);
+    return staging.data() + stagingLen;
+}
+
+void SimpleLogger::FileSink::appendStaged(size_t len) {
+    append(staging.data() + stagingLen, len);
+    stagingLen += len;
+}
+
+bool SimpleLogger::FileSink::setCompression(bool enable) {
+    if (isOpen()) return false;
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    if (!enable) {
+        deflater.reset();
+        return true;
+    }
+    std::unique_ptr<Deflater> d(new Deflater());
+    if (!d->ok) return false;
+    deflater = std::move(d);
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+void SimpleLogger::FileSink::flushStream() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    if (deflater && isOpen()) deflatePieces(Z_SYNC_FLUSH);
+#endif
+}
+
+void SimpleLogger::FileSink::writeAll(const char* data, size_t len) {
+    size_t written = 0;
+#if defined(__linux__) || defined(__APPLE__)
+    while (written < len && fd >= 0 && !failed) {
+        ssize_t ret = write(fd, data + written, len - written);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+        }
+        written += ret;
+    }
+#else
+    if (fp && !failed) {
+        written = fwrite(data, 1, len, fp);
+        if (written < len) failed = true;
+        fflush(fp);
+    }
+#endif
+    offset.store(offset.load(MOR) + written, MOR);
+}
+
+void SimpleLogger::FileSink::deflatePieces(int mode) {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    Deflater& d = *deflater;
+    if (!d.ok) failed = true;
+    if (failed) {
+        numPieces = 0;
+        stagingLen = 0;
+        return;
+    }
+
+    z_stream& zs = d.zs;
+    // Compress each piece, and then flush the stream if requested.
+    for (size_t idx = 0; idx <= numPieces; ++idx) {
+        bool last = (idx == numPieces);
+        if (last && mode == Z_NO_FLUSH) break;
+        zs.next_in = (last) ? nullptr : (Bytef*)pieces[idx].iov_base;
+        zs.avail_in = (last) ? 0 : (uInt)pieces[idx].iov_len;
+        int flush = (last) ? mode : Z_NO_FLUSH;
+        while (true) {
+            zs.next_out = d.out.data() + d.outLen;
+            zs.avail_out = (uInt)(d.out.size() - d.outLen);
+            int ret = deflate(&zs, flush);
+            d.outLen = d.out.size() - zs.avail_out;
+            if (d.outLen == d.out.size()) {
+                // Output buffer is full.
+                writeAll((const char*)d.out.data(), d.outLen);
+                d.outLen = 0;
+                continue;
+            }
+            if (ret == Z_STREAM_ERROR) failed = true;
+            // Input is consumed, and the flush (if any) is done.
+            break;
+        }
+    }
+    if (mode != Z_NO_FLUSH && d.outLen) {
+        writeAll((const char*)d.out.data(), d.outLen);
+        d.outLen = 0;
+    }
+#else
+    (void)mode;
+#endif
+    numPieces = 0;
+    stagingLen = 0;
+}
+
+size_t SimpleLogger::FileSink::commit() {
+    size_t written = 0;
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    if (deflater) {
+        for (size_t idx = 0; idx < numPieces; ++idx) {
+            written += pieces[idx].iov_len;
+        }
+        deflatePieces(Z_NO_FLUSH);
+        return written;
+    }
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+    while (numPieces && fd >= 0 && !failed) {
+        ssize_t ret = writev(fd, pieces.data(), (int)numPieces);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            // Same as the bad bit of `std::ofstream`.
+            failed = true;
+            break;
+        }
+        written += ret;
+        skipWritten(ret);
+    }
+#else
+    for (size_t idx = 0; idx < numPieces && fp && !failed; ++idx) {
+        size_t len = fwrite(pieces[idx].iov_base, 1, pieces[idx].iov_len, fp);
+        written += len;
+        if (len < pieces[idx].iov_len) failed = true;
+    }
+    if (fp) fflush(fp);
+#endif
+    offset.store(offset.load(MOR) + written, MOR);
+    numPieces = 0;
+    stagingLen = 0;
+    return written;
+}
+
+int SimpleLogger::FileSink::sync() {
+#if defined(__linux__)
+    if (fd < 0) return -1;
+    return fdatasync(fd);
+#elif defined(__APPLE__)
+    if (fd < 0) return -1;
+    return fsync(fd);
+#else
+    if (!fp) return -1;
+    return fflush(fp);
+#endif
+}
+
+// Remove written data from the front of `pieces`.
+void SimpleLogger::FileSink::skipWritten(size_t len) {
+    size_t idx = 0;
+    while (idx < numPieces && len >= pieces[idx].iov_len) {
+        len -= pieces[idx].iov_len;
+        idx++;
+    }
+    if (idx < numPieces) {
+        pieces[idx].iov_base = (char*)pieces[idx].iov_base + len;
+        pieces[idx].iov_len -= len;
+    }
+    if (idx) {
+        std::copy(pieces.begin() + idx, pieces.begin() + numPieces,
+                  pieces.begin());
+        numPieces -= idx;
+    }
+}
+
+void SimpleLogger::FileSink::completeWrite(int64_t res) {
+    if (res < 0) {
+        // Retry synchronously if it is temporary.
+        if (res != -EINTR && res != -EAGAIN) failed = true;
+    } else {
+        offset.store(offset.load(MOR) + res, MOR);
+        skipWritten(res);
+    }
+    commit();
+}
+
+
+// ==========================================
+// Console writer.
+
+#if defined(__linux__) || defined(__APPLE__)
+// Write all data, retry on partial write or interrupt.
+static void _write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            // Closed or broken, give up.
+            return;
+        }
+        data += ret;
+        len -= ret;
+    }
+}
+#endif
+
+void SimpleLoggerMgr::writeConsole(SimpleLoggerMgr* mgr,
+                                   const char* header,
+                                   size_t header_len,
+                                   const char* msg,
+                                   size_t msg_len,
+                                   const char* tail,
+                                   size_t tail_len)
+{
+    if (mgr && mgr->consoleRing && !mgr->chkTermination()) {
+        SimpleLogger::LogRing* ring = mgr->consoleRing.get();
+        size_t max_len = ring->maxPayloadLen();
+        header_len = std::min(header_len, max_len);
+        tail_len = std::min(tail_len, max_len - header_len);
+        msg_len = std::min(msg_len, max_len - header_len - tail_len);
+
+        uint32_t seq = 0;
+        char* dst = ring->reserve(header_len + msg_len + tail_len, seq);
+        if (!dst) {
+            // Console cannot keep up, drop it rather than blocking.
+            mgr->numConsoleDropped.fetch_add(1, SimpleLogger::MOR);
+            return;
+        }
+        memcpy(dst, header, header_len);
+        memcpy(dst + header_len, msg, msg_len);
+        memcpy(dst + header_len + msg_len, tail, tail_len);
+        ring->publish(seq, SimpleLogger::LogRing::TEXT, 0);
+
+        // Wake up the writer only if it is sleeping. If it is about to
+        // sleep, it will wake up by timeout.
+        if (mgr->numConsoleWaiters.load()) {
+            mgr->consoleEpoch.fetch_add(1);
+            _wake_waiters(mgr->consoleEpoch, mgr->numConsoleWaiters);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(displayLock);
+    std::cout.write(header, header_len);
+    std::cout.write(msg, msg_len);
+    std::cout.write(tail, tail_len);
+    std::cout.flush();
+}
+
+size_t SimpleLoggerMgr::flushConsole() {
+#if defined(__linux__) || defined(__APPLE__)
+    if (!consoleRing) return 0;
+
+    std::lock_guard<std::mutex> l(consoleFlushLock);
+    char* batch = consoleBatch.data();
+    size_t batch_len = 0;
+    auto append = [&](const char* data, size_t len) {
+        if (batch_len + len > CONSOLE_BATCH_SIZE) {
+            _write_all(STDOUT_FILENO, batch, batch_len);
+            batch_len = 0;
+        }
+        if (len > CONSOLE_BATCH_SIZE) {
+            _write_all(STDOUT_FILENO, data, len);
+            return;
+        }
+        memcpy(batch + batch_len, data, len);
+        batch_len += len;
+    };
+
+    size_t num_logs = 0;
+    SimpleLogger::LogRing::Record rec;
+    while (consoleRing->front(rec)) {
+        append(rec.payload, rec.len);
+        consoleRing->pop();
+        num_logs++;
+    }
+
+    uint64_t num_dropped = numConsoleDropped.load(SimpleLogger::MOR);
+    if (num_dropped > numConsoleDroppedNotified) {
+        char notice[128];
+        int len = snprintf( notice, sizeof(notice),
+                            "[simple_logger] %zu console logs dropped\n",
+                            (size_t)(num_dropped - numConsoleDroppedNotified) );
+        if (len > 0) append(notice, std::min((size_t)len, sizeof(notice) - 1));
+        numConsoleDroppedNotified = num_dropped;
+    }
+
+    if (batch_len) _write_all(STDOUT_FILENO, batch, batch_len);
+    return num_logs;
+#else
+    return 0;
+#endif
+}
+
+void SimpleLoggerMgr::consoleWorker(SimpleLoggerMgr* mgr) {
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), "sl_console");
+#endif
+    for (;;) {
+        uint32_t epoch = mgr->consoleEpoch.load();
+        size_t num_logs = mgr->flushConsole();
+        if (num_logs) {
+            // Under light load, wait a bit to gather more logs. Producers
+            // do not need to wake up this thread in the meantime.
+            if (num_logs < 64 && !mgr->chkTermination()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            continue;
+        }
+        // Drain all logs before termination.
+        if (mgr->chkTermination()) break;
+        _wait_while_equal(mgr->consoleEpoch, epoch, mgr->numConsoleWaiters);
+    }
+}
+
+
+// ==========================================
+
+
+SimpleLogger::SimpleLogger(const std::string& file_path,
+                           size_t max_log_elems,
+                           uint64_t log_file_size_limit,
+                           uint32_t max_log_files,
+                           BackpressurePolicy backpressure_policy)
+    : filePath(replaceString(file_path, "//", "/"))
+    , maxLogFiles(max_log_files)
+    , maxLogFileSize(log_file_size_limit)
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    , compFormat(GZIP)
+#else
+    , compFormat(TAR_GZ)
+#endif
+    , numCompJobs(0)
+    , numCompJobWaiters(0)
+    , archivedBytes(0)
+    , maxTotalBytes(0)
+    , maxAgeSec(0)
+    , dictRevnum(0)
+    , dictRetrainInterval(16)
+    , nextSegment(FileSink::invalidHandle())
+    , nextSegmentRevnum(0)
+    , nextSegmentSize(0)
+    , numSlowRotations(0)
+    , threadRingCapacity(0)
+    , numThreadRings(0)
+    , curLogLevel(4)
+    , curDispLevel(4)
+    , deferredFormat(false)
+    , perThreadBuffer(false)
+    , clockSource(SYSTEM_CLOCK)
+    , tzGap( SimpleLoggerMgr::getTzGap() )
+    , loggerId(logger_id_counter.fetch_add(1))
+    , bpPolicy(backpressure_policy)
+    , registered(false)
+    , flushRequested(false)
+    , numFull(0)
+    , numDropped(0)
+    , numInlineFlushes(0)
+    , durability(NO_SYNC)
+    , syncLevel(ERROR)
+    , syncIntervalMs(1000)
+    , barrierTicket(0)
+    , writtenTicket(0)
+    , durableTicket(0)
+    , barrierLeaderActive(false)
+    , barrierSyncRequested(false)
+    , syncedOffset(0)
+    , lastSyncTime(std::chrono::steady_clock::now())
+    , numSyncs(0)
+    , ring(max_log_elems * LogRing::AVG_RECORD_SIZE)
+{
+    size_t cur_revnum = 0;
+    findMinMaxRevNum(minRevnum, cur_revnum);
+    curRevnum = cur_revnum;
+
+    // Existing rotated files, for the retention.
+    for (size_t ii=minRevnum; ii<cur_revnum; ++ii) addArchivedFile(ii);
+}
+
+SimpleLogger::~SimpleLogger() {
+    stop();
+}
+
+void SimpleLogger::setCriticalInfo(const std::string& info_str) {
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    if (mgr) {
+        mgr->setCriticalInfo(info_str);
+    }
+}
+
+void SimpleLogger::setCrashDumpPath(const std::string& path,
+                                    bool origin_only)
+{
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    if (mgr) {
+        mgr->setCrashDumpPath(path, origin_only);
+    }
+}
+
+void SimpleLogger::setStackTraceOriginOnly(bool origin_only) {
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    if (mgr) {
+        mgr->setStackTraceOriginOnly(origin_only);
+    }
+}
+
+void SimpleLogger::logStackBacktrace() {
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    if (mgr) {
+        mgr->enableOnlyOneDisplayer();
+        mgr->logStackBacktrace(0);
+    }
+}
+
+void SimpleLogger::shutdown() {
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) {
+        mgr->destroy();
+    }
+}
+
+std::string SimpleLogger::replaceString( const std::string& src_str,
+                                         const std::string& before,
+                                         const std::string& after )
+{
+    size_t last = 0;
+    size_t pos = src_str.find(before, last);
+    std::string ret;
+    while (pos != std::string::npos) {
+        ret += src_str.substr(last, pos - last);
+        ret += after;
+        last = pos + before.size();
+        pos = src_str.find(before, last);
+    }
+    if (last < src_str.size()) {
+        ret += src_str.substr(last);
+    }
+    return ret;
+}
+
+void SimpleLogger::findMinMaxRevNum( size_t& min_revnum_out,
                                      size_t& max_revnum_out )
 {
     std::string dir_path = "./";
@@ -901,6 +3705,12 @@ void SimpleLogger::findMinMaxRevNum( size_t& min_revnum_out,
         // Irrelavent file: skip.
         if (f_name_pos == std::string::npos) continue;
 
+        // Empty file, e.g., the next file prepared before a crash:
+        // skip, it will be prepared again.
+        struct stat st;
+        std::string path = dir_path + "/" + f_name;
+        if (stat(path.c_str(), &st) == 0 && st.st_size == 0) continue;
+
         findMinMaxRevNumInternal(min_revnum_initialized,
                                  min_revnum,
                                  max_revnum,
@@ -920,8 +3730,9 @@ void SimpleLogger::findMinMaxRevNum( size_t& min_revnum_out,
     while (hfind != INVALID_HANDLE_VALUE) {
         std::string f_name(filedata.cFileName);
         size_t f_name_pos = f_name.rfind(file_name_only);
-        // Irrelavent file: skip.
-        if (f_name_pos != std::string::npos) {
+        bool empty_file = !filedata.nFileSizeLow && !filedata.nFileSizeHigh;
+        // Irrelavent or empty file: skip.
+        if (f_name_pos != std::string::npos && !empty_file) {
             findMinMaxRevNumInternal(min_revnum_initialized,
                                      min_revnum,
                                      max_revnum,
@@ -949,9 +3760,23 @@ void SimpleLogger::findMinMaxRevNumInternal(bool& min_revnum_initialized,
 
     bool comp_file = false;
     std::string ext = f_name.substr(last_dot + 1, f_name.size() - last_dot - 1);
-    if (ext == "gz" && f_name.size() > 7) {
-        // Compressed file: asdf.log.123.tar.gz => need to get 123.
-        f_name = f_name.substr(0, f_name.size() - 7);
+    if (ext == "zdict") {
+        // Dictionary: asdf.log.123.zdict, not a log file.
+        std::string base = f_name.substr(0, last_dot);
+        size_t dot = base.rfind(".");
+        dictRevnums.insert( (dot == std::string::npos)
+                            ? 0 : atoi(base.c_str() + dot + 1) );
+        return;
+    }
+    if ((ext == "gz" || ext == "zz") && f_name.size() > 3) {
+        // Compressed file: asdf.log.123.tar.gz (old format),
+        // asdf.log.123.gz, or asdf.log.123.zz => need to get 123.
+        size_t suffix_len = 3;
+        if ( f_name.size() > 7 &&
+             f_name.compare(f_name.size() - 7, 7, ".tar.gz") == 0 ) {
+            suffix_len = 7;
+        }
+        f_name = f_name.substr(0, f_name.size() - suffix_len);
         last_dot = f_name.rfind(".");
         if (last_dot == std::string::npos) return;
         ext = f_name.substr(last_dot + 1, f_name.size() - last_dot - 1);
@@ -975,16 +3800,50 @@ std::string SimpleLogger::getLogFilePath(size_t file_num) const {
     return filePath;
 }
 
+std::string SimpleLogger::getActiveFilePath(size_t file_num) const {
+    if (isCompressOnWrite()) return getLogFilePath(file_num) + ".gz";
+    return getLogFilePath(file_num);
+}
+
+void SimpleLogger::resumeCompressedFile() {
+    // The scan counts `file.N.gz` as a compressed file, and the next
+    // number as the current one.
+    size_t cur_revnum = curRevnum.load();
+    if (!cur_revnum) return;
+    size_t prev = cur_revnum - 1;
+    auto has_data = [](const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && st.st_size > 0;
+    };
+    // Empty ones were prepared, but not used.
+    if ( has_data(getLogFilePath(cur_revnum)) ||
+         has_data(getActiveFilePath(cur_revnum)) ||
+         !has_data(getActiveFilePath(prev)) ) {
+        return;
+    }
+    if (finishGzipStream(getActiveFilePath(prev)) != 0) return;
+
+    // Active again, not a rotated file.
+    std::lock_guard<std::mutex> l(retentionLock);
+    if (!archivedFiles.empty() && archivedFiles.back().revnum == prev) {
+        archivedBytes -= archivedFiles.back().size;
+        archivedFiles.pop_back();
+    }
+    curRevnum = prev;
+}
+
 int SimpleLogger::start() {
     if (filePath.empty()) return 0;
 
+    if (isCompressOnWrite()) resumeCompressedFile();
     // Append at the end.
-    fs.open(getLogFilePath(curRevnum), std::ofstream::out | std::ofstream::app);
-    if (!fs) return -1;
+    if (sink.open(getActiveFilePath(curRevnum)) != 0) return -1;
 
     SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
     SimpleLogger* ll = this;
     mgr->addLogger(ll);
+    // Open the next file in advance.
+    prepareNextSegment();
 
     _log_sys(ll, "Start logger: %s (%zu MB per file, up to %zu files)",
              filePath.c_str(),
@@ -1000,18 +3859,32 @@ int SimpleLogger::start() {
 }
 
 int SimpleLogger::stop() {
-    if (fs.is_open()) {
+    if (sink.isOpen()) {
         SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
         if (mgr) {
             SimpleLogger* ll = this;
+            // Before removing it, while callsites still follow its level.
+            _log_sys(ll, "Stop logger: %s", filePath.c_str());
             mgr->removeLogger(ll);
 
-            _log_sys(ll, "Stop logger: %s", filePath.c_str());
             flushAll();
-            fs.flush();
-            fs.close();
+            if (durability.load(MOR) != NO_SYNC) syncFile();
+            {   std::lock_guard<std::mutex> l(syncLock);
+                sink.close();
+            }
 
-            while (numCompJobs.load() > 0) std::this_thread::yield();
+            uint32_t num_jobs = 0;
+            while ( (num_jobs = numCompJobs.load()) > 0 ) {
+                _wait_while_equal(numCompJobs, num_jobs, numCompJobWaiters);
+            }
+            // Not enforced by the flusher anymore.
+            std::vector<std::string> paths;
+            collectExpiredFiles( std::chrono::system_clock::to_time_t
+                                     ( std::chrono::system_clock::now() ),
+                                 paths );
+            _unlink_files(paths);
+            closeRetiredSegments();
+            discardNextSegment();
         }
     }
 
@@ -1020,9 +3893,15 @@ int SimpleLogger::stop() {
 
 void SimpleLogger::setLogLevel(int level) {
     if (level > 6) return;
-    if (!fs) return;
+    if (sink.isFailed()) return;
 
-    curLogLevel = level;
+    // Callsites for the new level should be updated.
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) {
+        mgr->setLoggerLevel(this, level);
+    } else {
+        curLogLevel = level;
+    }
 }
 
 void SimpleLogger::setDispLevel(int level) {
@@ -1032,180 +3911,906 @@ void SimpleLogger::setDispLevel(int level) {
 }
 
 void SimpleLogger::setMaxLogFiles(size_t max_log_files) {
-    if (max_log_files == 0) return;
-
     maxLogFiles = max_log_files;
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) mgr->invokeFlusher();
 }
 
-#define _snprintf(msg, avail_len, cur_len, msg_len, ...)            \
-    avail_len = (avail_len > cur_len) ? (avail_len - cur_len) : 0;  \
-    msg_len = snprintf( msg + cur_len, avail_len, __VA_ARGS__ );    \
-    cur_len += (avail_len > msg_len) ? msg_len : avail_len
+bool SimpleLogger::setCompressionFormat(CompressionFormat format) {
+#if !defined(SIMPLELOGGER_WITH_ZLIB)
+    if (format == GZIP || format == ZLIB_DICT) return false;
+#endif
+#if !defined(__linux__) && !defined(__APPLE__)
+    if (format == TAR_GZ) return false;
+#endif
+    compFormat = format;
+    return true;
+}
 
-#define _vsnprintf(msg, avail_len, cur_len, msg_len, ...)           \
-    avail_len = (avail_len > cur_len) ? (avail_len - cur_len) : 0;  \
-    msg_len = vsnprintf( msg + cur_len, avail_len, __VA_ARGS__ );   \
-    cur_len += (avail_len > msg_len) ? msg_len : avail_len
+bool SimpleLogger::setCompressOnWrite(bool enable) {
+    return sink.setCompression(enable);
+}
 
-void SimpleLogger::put(int level,
-                       const char* source_file,
-                       const char* func_name,
-                       size_t line_number,
-                       const char* format,
-                       ...)
-{
-    if (level > curLogLevel.load(MOR)) return;
-    if (!fs) return;
+void SimpleLogger::setRetentionPolicy(const RetentionPolicy& policy) {
+    maxLogFiles = policy.maxFiles;
+    maxTotalBytes = policy.maxTotalBytes;
+    maxAgeSec = policy.maxAgeSec;
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) mgr->invokeFlusher();
+}
 
-    static const char* lv_names[7] = {"====",
-                                      "FATL", "ERRO", "WARN",
-                                      "INFO", "DEBG", "TRAC"};
-    char msg[MSG_SIZE];
-    thread_local ThreadWrapper thread_wrapper;
-#ifdef __linux__
-    const int TID_DIGITS = tid_digits;
-    thread_local uint32_t tid_hash = thread_wrapper.myTid;
-#else
-    thread_local std::thread::id tid = std::this_thread::get_id();
-    thread_local uint32_t tid_hash = std::hash<std::thread::id>{}(tid) % 0x10000;
-#endif
+SimpleLogger::RetentionPolicy SimpleLogger::getRetentionPolicy() const {
+    return RetentionPolicy(maxLogFiles.load(), maxTotalBytes.load(), maxAgeSec.load());
+}
 
-    // Print filename part only (excluding directory path).
-    size_t last_slash = 0;
-    for (size_t ii=0; source_file && source_file[ii] != 0; ++ii) {
-        if (source_file[ii] == '/' || source_file[ii] == '\\') last_slash = ii;
-    }
+void SimpleLogger::setDictRetrainInterval(size_t num_files) {
+    if (num_files == 0) return;
 
-    SimpleLoggerMgr::TimeInfo lt( std::chrono::system_clock::now() );
-    int tz_gap_abs = (tzGap < 0) ? (tzGap * -1) : (tzGap);
+    dictRetrainInterval = num_files;
+}
 
-    // [time] [tid] [log type] [user msg] [stack info]
-    // Timestamp: ISO 8601 format.
-    size_t cur_len = 0;
-    size_t avail_len = MSG_SIZE;
-    size_t msg_len = 0;
+void SimpleLogger::setDeferredFormat(bool enable) {
+    deferredFormat = enable;
+}
 
+void SimpleLogger::setPerThreadBuffer(bool enable,
+                                      size_t max_log_elems_per_thread)
+{
+    threadRingCapacity = max_log_elems_per_thread * LogRing::AVG_RECORD_SIZE;
+    perThreadBuffer = enable;
+}
+
+void SimpleLogger::setClockSource(ClockSource src) {
+#ifdef _TSC_SUPPORTED
+    if (src == TSC_CLOCK) _tsc_enable();
+#endif
+    clockSource = src;
+}
+
+static const char* lv_names[7] = {"====",
+                                  "FATL", "ERRO", "WARN",
+                                  "INFO", "DEBG", "TRAC"};
+
+// [time] [tid] [log type] [user msg] [stack info]
+// Timestamp: ISO 8601 format.
+//
+// `user_msg` renders the user message in the same way as `vsnprintf`.
+static SimpleLoggerMgr::TimeCache& _my_time_cache() {
+    thread_local SimpleLoggerMgr::TimeCache time_cache;
+    return time_cache;
+}
+
+// Same as `%*u` (Linux) or `%04x` (others).
+static inline char* _write_tid(char* pp, int tid_digits, uint32_t tid_hash) {
 #ifdef __linux__
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
-               "[%*u] "
-               "[%s] ",
-               lt.year, lt.month, lt.day,
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               (tzGap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
-               TID_DIGITS, tid_hash,
-               lv_names[level] );
+    char tid_str[SimpleLogger::Fmt::MAX_INT_LEN];
+    int tid_len = SimpleLogger::Fmt::formatUnsigned(tid_str, tid_hash);
+    for (int ii = tid_len; ii < tid_digits; ++ii) *pp++ = ' ';
+    memcpy(pp, tid_str, tid_len);
+    return pp + tid_len;
 #else
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
-               "[%04x] "
-               "[%s] ",
-               lt.year, lt.month, lt.day,
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               (tzGap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
-               tid_hash,
-               lv_names[level] );
+    (void)tid_digits;
+    return pp + SimpleLogger::Fmt::formatHex(pp, tid_hash, 4);
 #endif
+}
 
-    va_list args;
-    va_start(args, format);
-    _vsnprintf(msg, avail_len, cur_len, msg_len, format, args);
-    va_end(args);
-
+// The line is truncated if it is longer than `msg_size - 1`,
+// and `full_len_out` returns the length before truncation.
+// `user_pos_out` and `user_len_out` return the location of the
+// (possibly truncated) user message in `msg`, so that the console
+// line can reuse it.
+template<typename UserMsgFunc>
+static size_t _compose_log_line(char* msg,
+                                size_t msg_size,
+                                int level,
+                                const SimpleLoggerMgr::TimeCache& tc,
+                                int tid_digits,
+                                uint32_t tid_hash,
+                                const char* source_file,
+                                const char* func_name,
+                                size_t line_number,
+                                UserMsgFunc user_msg,
+                                size_t& full_len_out,
+                                size_t& user_pos_out,
+                                size_t& user_len_out)
+{
+    // Header is much shorter than `MSG_SIZE`, no need to check length.
+    char* pp = msg + tc.write(msg);
+    *pp++ = ' ';
+    *pp++ = '[';
+    pp = _write_tid(pp, tid_digits, tid_hash);
+    memcpy(pp, "] [", 3);           pp += 3;
+    memcpy(pp, lv_names[level], 4); pp += 4;
+    memcpy(pp, "] ", 2);            pp += 2;
+    size_t cur_len = pp - msg;
+    size_t full_len = cur_len;
+
+    size_t user_len = user_msg(msg + cur_len, msg_size - cur_len);
+    full_len += user_len;
+    user_pos_out = cur_len;
+    user_len_out = std::min(user_len, msg_size - cur_len - 1);
+    cur_len += user_len_out;
+
+    // Same as `"\t[%s:%zu, %s()]\n"`.
+    SimpleLogger::Fmt::Writer ww(msg + cur_len, msg_size - cur_len);
     if (source_file && func_name) {
-        _snprintf( msg, avail_len, cur_len, msg_len,
-                   "\t[%s:%zu, %s()]\n",
-                   source_file + ((last_slash)?(last_slash+1):0),
-                   line_number, func_name );
+        char num[SimpleLogger::Fmt::MAX_INT_LEN];
+        const char* file_name = _file_name_only(source_file);
+        ww.append("\t[", 2);
+        ww.append(file_name, strlen(file_name));
+        ww.append(":", 1);
+        ww.append(num, SimpleLogger::Fmt::formatUnsigned(num, line_number));
+        ww.append(", ", 2);
+        ww.append(func_name, strlen(func_name));
+        ww.append("()]\n", 4);
     } else {
-        _snprintf(msg, avail_len, cur_len, msg_len, "\n");
+        ww.append("\n", 1);
     }
+    size_t suffix_len = ww.finish();
+    full_len += suffix_len;
+    cur_len += std::min(suffix_len, msg_size - cur_len - 1);
+
+    if (cur_len < full_len) {
+        // Truncated, but should end with newline.
+        msg[cur_len - 1] = '\n';
+        user_len_out = std::min(user_len_out, cur_len - 1 - user_pos_out);
+    }
+    full_len_out = full_len;
+    return cur_len;
+}
 
-    size_t num = logs.size();
-    uint64_t cursor_exp = 0, cursor_val = 0;
-    LogElem* ll = nullptr;
-    do {
-        cursor_exp = cursor.load(MOR);
-        cursor_val = (cursor_exp + 1) % num;
-        ll = &logs[cursor_exp];
-    } while ( !cursor.compare_exchange_strong(cursor_exp, cursor_val, MOR) );
-    while ( !ll->available() ) std::this_thread::yield();
-
-    if (ll->needToFlush()) {
-        // Allow only one thread to flush.
-        if (!flush(cursor_exp)) {
-            // Other threads: wait.
-            while (ll->needToFlush()) std::this_thread::yield();
-        }
-    }
-    ll->write(cur_len, msg);
-
-    if (level > curDispLevel) return;
-
-    // Console part.
-    static const char* colored_lv_names[7] =
-                       { _CL_B_BROWN("===="),
-                         _CL_WHITE_FG_RED_BG("FATL"),
-                         _CL_B_RED("ERRO"),
-                         _CL_B_MAGENTA("WARN"),
-                         "INFO",
-                         _CL_D_GRAY("DEBG"),
-                         _CL_D_GRAY("TRAC") };
-
-    cur_len = 0;
-    avail_len = MSG_SIZE;
-#ifdef __linux__
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               " [" _CL_BROWN("%02d") ":" _CL_BROWN("%02d") ":" _CL_BROWN("%02d") "."
-               _CL_BROWN("%03d") " " _CL_BROWN("%03d")
-               "] [tid " _CL_B_BLUE("%*u") "] "
-               "[%s] ",
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               TID_DIGITS, tid_hash,
-               colored_lv_names[level] );
-#else
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               " [" _CL_BROWN("%02d") ":" _CL_BROWN("%02d") ":" _CL_BROWN("%02d") "."
-               _CL_BROWN("%03d") " " _CL_BROWN("%03d")
-               "] [tid " _CL_B_BLUE("%04x") "] "
-               "[%s] ",
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               tid_hash,
-               colored_lv_names[level] );
-#endif
+// ANSI color codes for console, plain (0) or colored (1).
+struct ConsoleColors {
+    const char* time;
+    const char* tid;
+    const char* file;
+    const char* line;
+    const char* func;
+    const char* end;
+    const char* lvNames[7];
+    const char* msg[7];
+};
+
+static const ConsoleColors _console_colors[2] = {
+    { "", "", "", "", "", "",
+      {"====", "FATL", "ERRO", "WARN", "INFO", "DEBG", "TRAC"},
+      {"", "", "", "", "", "", ""} },
+    { _CLM_BROWN, _CLM_B_BLUE, _CLM_GREEN, _CLM_B_RED, _CLM_CYAN, _CLM_END,
+      { _CL_B_BROWN("===="),
+        _CL_WHITE_FG_RED_BG("FATL"),
+        _CL_B_RED("ERRO"),
+        _CL_B_MAGENTA("WARN"),
+        "INFO",
+        _CL_D_GRAY("DEBG"),
+        _CL_D_GRAY("TRAC") },
+      {_CLM_B_BROWN, _CLM_B_RED, "", "", "", "", ""} },
+};
+
+// Console log: header line, and then the user message line.
+// This composes the header line, followed by the color code of the
+// user message. The user message should be followed by
+// `_console_tail()`.
+static size_t _compose_console_header(char* msg,
+                                      size_t msg_size,
+                                      const SimpleLoggerMgr::TimeInfo& lt,
+                                      int tid_digits,
+                                      uint32_t tid_hash,
+                                      int level,
+                                      const char* source_file,
+                                      const char* func_name,
+                                      size_t line_number,
+                                      bool color)
+{
+    const ConsoleColors& cc = _console_colors[color ? 1 : 0];
+    SimpleLogger::Fmt::Writer ww(msg, msg_size);
+    auto append = [&ww](const char* str) { ww.append(str, strlen(str)); };
+    auto append_time = [&](uint32_t val, int width, const char* sep) {
+        char num[4];
+        append(cc.time);
+        SimpleLogger::Fmt::formatFixed(num, val, width);
+        ww.append(num, width);
+        append(cc.end);
+        append(sep);
+    };
+
+    append(" [");
+    append_time(lt.hour, 2, ":");
+    append_time(lt.min, 2, ":");
+    append_time(lt.sec, 2, ".");
+    append_time(lt.msec, 3, " ");
+    append_time(lt.usec, 3, "] [tid ");
+    append(cc.tid);
+    char tid_str[32];
+    ww.append(tid_str, _write_tid(tid_str, tid_digits, tid_hash) - tid_str);
+    append(cc.end);
+    append("] [");
+    append(cc.lvNames[level]);
+    append("] ");
 
     if (source_file && func_name) {
-        _snprintf( msg, avail_len, cur_len, msg_len,
-                   "[" _CL_GREEN("%s") ":" _CL_B_RED("%zu")
-                   ", " _CL_CYAN("%s()") "]\n",
-                   source_file + ((last_slash)?(last_slash+1):0),
-                   line_number, func_name );
+        char num[SimpleLogger::Fmt::MAX_INT_LEN];
+        append("[");
+        append(cc.file);
+        append(_file_name_only(source_file));
+        append(cc.end);
+        append(":");
+        append(cc.line);
+        ww.append(num, SimpleLogger::Fmt::formatUnsigned(num, line_number));
+        append(cc.end);
+        append(", ");
+        append(cc.func);
+        append(func_name);
+        append("()");
+        append(cc.end);
+        append("]\n");
     } else {
-        _snprintf(msg, avail_len, cur_len, msg_len, "\n");
+        append("\n");
     }
+    append(cc.msg[level]);
+    return std::min(ww.finish(), msg_size - 1);
+}
 
-    va_start(args, format);
+// Color end and newline.
+static inline const char* _console_tail(bool color, size_t& len_out) {
+    static const char COLORED_TAIL[] = _CLM_END "\n";
+    if (color) {
+        len_out = sizeof(COLORED_TAIL) - 1;
+        return COLORED_TAIL;
+    }
+    len_out = 1;
+    return "\n";
+}
+
+// ==========================================
+// Deferred formatting.
+//
+// Arguments are captured in the order of conversion specifiers:
+//   * `*` width and precision: `int`.
+//   * integer, floating point, and pointer: raw bytes of the value.
+//   * string: 4-byte length (`UINT32_MAX` if null), and the
+//     contents followed by a null character.
+
+struct _fmt_spec {
+    enum ArgType {
+        NONE,       // `%%`.
+        INT,
+        LONG,
+        LONG_LONG,
+        INTMAX,
+        SIZE,
+        PTRDIFF,
+        DOUBLE,
+        LONG_DOUBLE,
+        STRING,
+        POINTER,
+    };
+    static const size_t MAX_LEN = 32;
+
+    const char* begin;
+    size_t len;
+    bool starWidth;
+    bool starPrecision;
+    // Precision given as a number, -1 if not given.
+    int precision;
+    ArgType type;
+};
 
-#ifndef LOGGER_NO_COLOR
-    if (level == 0) {
-        _snprintf(msg, avail_len, cur_len, msg_len, _CLM_B_BROWN);
-    } else if (level == 1) {
-        _snprintf(msg, avail_len, cur_len, msg_len, _CLM_B_RED);
+// Parse a conversion specifier where `fmt` points to '%'.
+// Returns `false` if it cannot be deferred.
+static bool _parse_fmt_spec(const char* fmt, _fmt_spec& spec) {
+    const char* pp = fmt + 1;
+    spec.begin = fmt;
+    spec.starWidth = spec.starPrecision = false;
+    spec.precision = -1;
+
+    if (*pp == '%') {
+        spec.len = 2;
+        spec.type = _fmt_spec::NONE;
+        return true;
     }
-#endif
 
-    _vsnprintf(msg, avail_len, cur_len, msg_len, format, args);
+    // Flags. Positional arguments (`%1$d`) are not supported.
+    while (*pp && strchr("-+ #0'", *pp)) pp++;
+    // Width.
+    if (*pp == '*') {
+        spec.starWidth = true;
+        pp++;
+    } else {
+        while (*pp >= '0' && *pp <= '9') pp++;
+        if (*pp == '$') return false;
+    }
+    // Precision.
+    if (*pp == '.') {
+        pp++;
+        if (*pp == '*') {
+            spec.starPrecision = true;
+            pp++;
+        } else {
+            spec.precision = 0;
+            while (*pp >= '0' && *pp <= '9') {
+                spec.precision = spec.precision * 10 + (*pp - '0');
+                pp++;
+            }
+        }
+    }
+
+    // Length modifier.
+    enum { LM_NONE, LM_HH, LM_H, LM_L, LM_LL, LM_J, LM_Z, LM_T, LM_LD } lm;
+    lm = LM_NONE;
+    switch (*pp) {
+    case 'h':   lm = (pp[1] == 'h') ? LM_HH : LM_H;     break;
+    case 'l':   lm = (pp[1] == 'l') ? LM_LL : LM_L;     break;
+    case 'q':   lm = LM_LL;     break;
+    case 'j':   lm = LM_J;      break;
+    case 'z':   lm = LM_Z;      break;
+    case 't':   lm = LM_T;      break;
+    case 'L':   lm = LM_LD;     break;
+    default:    break;
+    }
+    if (lm == LM_HH || lm == LM_LL) {
+        pp += (*pp == 'q') ? 1 : 2;
+    } else if (lm != LM_NONE) {
+        pp++;
+    }
+
+    // Conversion.
+    switch (*pp) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        switch (lm) {
+        case LM_NONE: case LM_HH: case LM_H:
+                        spec.type = _fmt_spec::INT;         break;
+        case LM_L:      spec.type = _fmt_spec::LONG;        break;
+        case LM_LL:     spec.type = _fmt_spec::LONG_LONG;   break;
+        case LM_J:      spec.type = _fmt_spec::INTMAX;      break;
+        case LM_Z:      spec.type = _fmt_spec::SIZE;        break;
+        case LM_T:      spec.type = _fmt_spec::PTRDIFF;     break;
+        default:        return false;
+        }
+        break;
+    case 'c':
+        if (lm != LM_NONE) return false;
+        spec.type = _fmt_spec::INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A':
+        if (lm == LM_NONE || lm == LM_L) {
+            spec.type = _fmt_spec::DOUBLE;
+        } else if (lm == LM_LD) {
+            spec.type = _fmt_spec::LONG_DOUBLE;
+        } else {
+            return false;
+        }
+        break;
+    case 's':
+        if (lm != LM_NONE) return false;
+        spec.type = _fmt_spec::STRING;
+        break;
+    case 'p':
+        if (lm != LM_NONE) return false;
+        spec.type = _fmt_spec::POINTER;
+        break;
+    default:
+        // `%n`, `%m` (depends on `errno`), wide characters, etc.
+        return false;
+    }
+
+    spec.len = pp + 1 - fmt;
+    return spec.len < _fmt_spec::MAX_LEN;
+}
+
+#define _capture_arg(type)                              \
+    {   type val = va_arg(args, type);                  \
+        if (cur_len + sizeof(type) > blob_size) {       \
+            return false;                               \
+        }                                               \
+        memcpy(blob + cur_len, &val, sizeof(type));     \
+        cur_len += sizeof(type);                        \
+    }
+
+// Capture arguments of the given format into `blob`.
+// Returns `false` if it cannot be deferred.
+static bool _capture_args(const char* format,
+                          va_list args,
+                          char* blob,
+                          size_t blob_size,
+                          size_t& blob_len_out)
+{
+    size_t cur_len = 0;
+    for (const char* pp = format; *pp; ++pp) {
+        if (*pp != '%') continue;
+
+        _fmt_spec spec;
+        if (!_parse_fmt_spec(pp, spec)) return false;
+        pp += spec.len - 1;
+
+        int precision = spec.precision;
+        if (spec.starWidth) _capture_arg(int);
+        if (spec.starPrecision) {
+            _capture_arg(int);
+            memcpy(&precision, blob + cur_len - sizeof(int), sizeof(int));
+        }
+
+        switch (spec.type) {
+        case _fmt_spec::NONE:                                   break;
+        case _fmt_spec::INT:            _capture_arg(int);          break;
+        case _fmt_spec::LONG:           _capture_arg(long);         break;
+        case _fmt_spec::LONG_LONG:      _capture_arg(long long);    break;
+        case _fmt_spec::INTMAX:         _capture_arg(intmax_t);     break;
+        case _fmt_spec::SIZE:           _capture_arg(size_t);       break;
+        case _fmt_spec::PTRDIFF:        _capture_arg(ptrdiff_t);    break;
+        case _fmt_spec::DOUBLE:         _capture_arg(double);       break;
+        case _fmt_spec::LONG_DOUBLE:    _capture_arg(long double);  break;
+        case _fmt_spec::POINTER:        _capture_arg(void*);        break;
+        case _fmt_spec::STRING: {
+            const char* str = va_arg(args, const char*);
+            uint32_t str_len = UINT32_MAX;
+            if (str) {
+                // String may not be null-terminated if precision is given.
+                str_len = (precision >= 0)
+                          ? strnlen(str, precision)
+                          : strlen(str);
+            }
+            size_t space = sizeof(uint32_t) + ((str) ? (str_len + 1) : 0);
+            if (cur_len + space > blob_size) return false;
+            memcpy(blob + cur_len, &str_len, sizeof(uint32_t));
+            cur_len += sizeof(uint32_t);
+            if (str) {
+                memcpy(blob + cur_len, str, str_len);
+                blob[cur_len + str_len] = 0;
+                cur_len += str_len + 1;
+            }
+            break; }
+        }
+    }
+    blob_len_out = cur_len;
+    return true;
+}
+#undef _capture_arg
+
+template<typename T>
+static int _render_arg(char* out,
+                       size_t out_size,
+                       const char* fmt,
+                       const _fmt_spec& spec,
+                       int width,
+                       int precision,
+                       T val)
+{
+    if (spec.starWidth && spec.starPrecision) {
+        return snprintf(out, out_size, fmt, width, precision, val);
+    } else if (spec.starWidth) {
+        return snprintf(out, out_size, fmt, width, val);
+    } else if (spec.starPrecision) {
+        return snprintf(out, out_size, fmt, precision, val);
+    }
+    return snprintf(out, out_size, fmt, val);
+}
+
+#define _render_captured(type)                                      \
+    {   type val;                                                   \
+        memcpy(&val, blob + blob_pos, sizeof(type));                \
+        blob_pos += sizeof(type);                                   \
+        piece_len = _render_arg(dst, room, spec_str, spec,          \
+                                width, precision, val);             \
+    }
+
+// Render a format string with captured arguments.
+// The result is exactly the same as that of `vsnprintf`.
+static int _render_captured_args(char* out,
+                                 size_t out_size,
+                                 const char* format,
+                                 const char* blob)
+{
+    size_t total = 0;
+    size_t blob_pos = 0;
+    const char* pp = format;
+    while (*pp) {
+        size_t room = (out_size > total) ? (out_size - total) : 0;
+        char* dst = out + ((room) ? total : 0);
+
+        if (*pp != '%') {
+            // Literal part.
+            const char* end = strchr(pp, '%');
+            size_t lit_len = (end) ? (size_t)(end - pp) : strlen(pp);
+            if (room) {
+                size_t to_copy = std::min(lit_len, room - 1);
+                memcpy(dst, pp, to_copy);
+                dst[to_copy] = 0;
+            }
+            total += lit_len;
+            pp += lit_len;
+            continue;
+        }
+
+        _fmt_spec spec;
+        _parse_fmt_spec(pp, spec);
+        char spec_str[_fmt_spec::MAX_LEN];
+        memcpy(spec_str, pp, spec.len);
+        spec_str[spec.len] = 0;
+        pp += spec.len;
+
+        int width = 0, precision = 0;
+        if (spec.starWidth) {
+            memcpy(&width, blob + blob_pos, sizeof(int));
+            blob_pos += sizeof(int);
+        }
+        if (spec.starPrecision) {
+            memcpy(&precision, blob + blob_pos, sizeof(int));
+            blob_pos += sizeof(int);
+        }
+
+        int piece_len = 0;
+        switch (spec.type) {
+        case _fmt_spec::NONE:
+            piece_len = snprintf(dst, room, "%%");
+            break;
+        case _fmt_spec::INT:            _render_captured(int);          break;
+        case _fmt_spec::LONG:           _render_captured(long);         break;
+        case _fmt_spec::LONG_LONG:      _render_captured(long long);    break;
+        case _fmt_spec::INTMAX:         _render_captured(intmax_t);     break;
+        case _fmt_spec::SIZE:           _render_captured(size_t);       break;
+        case _fmt_spec::PTRDIFF:        _render_captured(ptrdiff_t);    break;
+        case _fmt_spec::DOUBLE:         _render_captured(double);       break;
+        case _fmt_spec::LONG_DOUBLE:    _render_captured(long double);  break;
+        case _fmt_spec::POINTER:        _render_captured(void*);        break;
+        case _fmt_spec::STRING: {
+            uint32_t str_len = 0;
+            memcpy(&str_len, blob + blob_pos, sizeof(uint32_t));
+            blob_pos += sizeof(uint32_t);
+            const char* str = nullptr;
+            if (str_len != UINT32_MAX) {
+                str = blob + blob_pos;
+                blob_pos += str_len + 1;
+            }
+            piece_len = _render_arg(dst, room, spec_str, spec,
+                                    width, precision, str);
+            break; }
+        }
+        if (piece_len > 0) total += piece_len;
+    }
+    if (!total && out_size) out[0] = 0;
+    return (int)total;
+}
+#undef _render_captured
+
+size_t SimpleLogger::renderDeferred(const char* blob,
+                                    char* msg,
+                                    size_t msg_size,
+                                    size_t& full_len_out)
+{
+    DeferredMeta meta;
+    memcpy(&meta, blob, sizeof(meta));
+    const char* format = blob + sizeof(meta);
+    const char* args = format + meta.formatLen + 1;
+
+    std::chrono::system_clock::time_point tp
+        ( (std::chrono::system_clock::duration(meta.timeRaw)) );
+    SimpleLoggerMgr::TimeCache& tc = _my_time_cache();
+    tc.update(tp, tzGap);
+
+    size_t user_pos = 0, user_len = 0;
+    return _compose_log_line
+           ( msg, msg_size, meta.level, tc, meta.tidDigits, meta.tidHash,
+             meta.sourceFile, meta.funcName, meta.lineNumber,
+             [format, args](char* out, size_t out_size) -> size_t {
+                 int len = _render_captured_args(out, out_size,
+                                                 format, args);
+                 return (len > 0) ? len : 0;
+             },
+             full_len_out, user_pos, user_len );
+}
+
+SimpleLogger::LogRing* SimpleLogger::getThreadRing() {
+    ThreadWrapper& tw = _my_thread_wrapper();
+    for (ThreadWrapper::ThreadRing& entry: tw.rings) {
+        if (entry.loggerId == loggerId) return entry.ring.get();
+    }
+
+    // First log of this thread: get one from the pool, or make a new one.
+    std::shared_ptr<LogRing> new_ring;
+    size_t capacity = threadRingCapacity.load(MOR);
+    {   std::lock_guard<std::mutex> l(threadRingsLock);
+        while (!freeThreadRings.empty()) {
+            std::shared_ptr<LogRing> free_ring = freeThreadRings.back();
+            freeThreadRings.pop_back();
+            if (free_ring->getCapacity() >= capacity) {
+                new_ring = free_ring;
+                new_ring->reuse();
+                break;
+            }
+        }
+        if (!new_ring) {
+            new_ring = std::make_shared<LogRing>(capacity, true);
+        }
+        threadRings.push_back(new_ring);
+        numThreadRings.store(threadRings.size(), MOR);
+    }
+
+    // Remove rings of destroyed loggers.
+    auto& rings = tw.rings;
+    rings.erase( std::remove_if( rings.begin(), rings.end(),
+                                 [](const ThreadWrapper::ThreadRing& entry) {
+                                     return entry.ring.use_count() == 1;
+                                 } ),
+                 rings.end() );
+    rings.push_back( ThreadWrapper::ThreadRing{loggerId, new_ring} );
+    return new_ring.get();
+}
+
+SimpleLogger::BackpressureStats SimpleLogger::getBackpressureStats() const {
+    BackpressureStats stats;
+    stats.numFull = numFull.load(MOR);
+    stats.numDropped = numDropped.load(MOR);
+    stats.numInlineFlushes = numInlineFlushes.load(MOR);
+    return stats;
+}
 
-#ifndef LOGGER_NO_COLOR
-    _snprintf(msg, avail_len, cur_len, msg_len, _CLM_END);
+bool SimpleLogger::discardOldest(LogRing* dst) {
+    // Only the one who holds `flushingLogs` can consume.
+    std::unique_lock<std::mutex> ll(flushingLogs, std::try_to_lock);
+    if (!ll.owns_lock()) return false;
+
+    // The oldest one may not be published yet.
+    LogRing::Record rec;
+    if (!dst->front(rec)) return false;
+    dst->pop();
+    dst->notifyConsumed();
+    numDropped.fetch_add(1, MOR);
+    return true;
+}
+
+void SimpleLogger::requestFlush() {
+    if (flushRequested.load(MOR)) return;
+    if (flushRequested.exchange(true)) return;
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) mgr->invokeFlusher();
+}
+
+void SimpleLogger::writeRecord(LogRing* dst,
+                               LogRing::RecordType type,
+                               int64_t time_raw,
+                               const char* data,
+                               size_t len)
+{
+    char* payload = nullptr;
+    uint32_t seq = 0;
+    bool full = false;
+    while (true) {
+        // Should be read before `reserve()`, not to miss the wake-up.
+        uint32_t epoch = dst->getConsumedEpoch();
+        payload = dst->reserve(len, seq);
+        if (payload) break;
+
+        // Ring is full.
+        if (!full) {
+            full = true;
+            numFull.fetch_add(1, MOR);
+        }
+        requestFlush();
+
+        BackpressurePolicy policy = bpPolicy;
+        if (policy == BLOCK) {
+            SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+            if ( !mgr || mgr->chkTermination() || _flushing_all_loggers ||
+                 !registered.load(MOR) ) {
+                // BG flusher cannot make progress.
+                policy = FLUSH_INLINE;
+            }
+        }
+
+        switch (policy) {
+        case DROP_NEW:
+            numDropped.fetch_add(1, MOR);
+            return;
+
+        case OVERWRITE_OLDEST:
+            if (!discardOldest(dst)) dst->waitForSpace(epoch);
+            break;
+
+        case BLOCK:
+            dst->waitForSpace(epoch);
+            break;
+
+        case FLUSH_INLINE:
+        default:
+            // Allow only one thread to flush, other threads: wait.
+            if (flush()) {
+                numInlineFlushes.fetch_add(1, MOR);
+            } else {
+                dst->waitForSpace(epoch);
+            }
+            break;
+        }
+    }
+    memcpy(payload, data, len);
+    dst->publish(seq, type, time_raw);
+
+    // Wake up the BG flusher early, before the ring gets full.
+    if ( !flushRequested.load(MOR) &&
+         dst->getUsedBytes() > dst->getCapacity() / 4 * 3 ) {
+        requestFlush();
+    }
+}
+
+// Thread ID (or its hash) to be displayed, and its width.
+static inline uint32_t _my_tid_hash(int& tid_digits_out) {
+#ifdef __linux__
+    tid_digits_out = tid_digits;
+    thread_local uint32_t tid_hash = _my_thread_wrapper().myTid;
+#else
+    tid_digits_out = 4;
+    thread_local std::thread::id tid = std::this_thread::get_id();
+    thread_local uint32_t tid_hash = std::hash<std::thread::id>{}(tid) % 0x10000;
 #endif
+    return tid_hash;
+}
+
+void SimpleLogger::put(int level,
+                       const char* source_file,
+                       const char* func_name,
+                       size_t line_number,
+                       const char* format,
+                       ...)
+{
+    // Pointers can be kept only if they are static.
+    bool static_callsite = (level & STATIC_CALLSITE);
+    level &= ~STATIC_CALLSITE;
+    if (!checkLevel(level)) return;
+    if (sink.isFailed()) return;
+
+    std::chrono::system_clock::time_point now = getCurrentTime(this);
+
+    size_t format_len = 0;
+    if ( static_callsite &&
+         deferredFormat.load(MOR) &&
+         level > curDispLevel.load(MOR) &&
+         (format_len = strlen(format)) < MSG_SIZE - sizeof(DeferredMeta) ) {
+        // Capture the format and arguments only, the flusher will format it.
+        char msg[MSG_SIZE];
+        DeferredMeta meta;
+        meta.formatLen = format_len;
+        meta.sourceFile = source_file;
+        meta.funcName = func_name;
+        meta.lineNumber = line_number;
+        meta.timeRaw = now.time_since_epoch().count();
+        meta.tidHash = _my_tid_hash(meta.tidDigits);
+        meta.level = level;
+        memcpy(msg, &meta, sizeof(meta));
+        size_t header_len = sizeof(meta) + format_len + 1;
+        memcpy(msg + sizeof(meta), format, format_len + 1);
+
+        size_t blob_len = 0;
+        va_list args;
+        va_start(args, format);
+        bool captured = _capture_args(format, args,
+                                      msg + header_len,
+                                      MSG_SIZE - header_len,
+                                      blob_len);
+        va_end(args);
+
+        if (captured) {
+            LogRing* dst = perThreadBuffer.load(MOR) ? getThreadRing() : &ring;
+            writeRecord(dst, LogRing::DEFERRED, meta.timeRaw,
+                        msg, header_len + blob_len);
+            syncOnLevel(level);
+            return;
+        }
+        // Otherwise: format it now.
+    }
 
+    va_list args;
+    va_start(args, format);
+    putInternal( level, source_file, func_name, line_number, now,
+                 [format, &args](char* out, size_t out_size) -> size_t {
+                     // Called again if the message is too long.
+                     va_list args_copy;
+                     va_copy(args_copy, args);
+                     int len = vsnprintf(out, out_size, format, args_copy);
+                     va_end(args_copy);
+                     return (len > 0) ? len : 0;
+                 } );
     va_end(args);
-    (void)cur_len;
+}
 
-    std::unique_lock<std::mutex> l(SimpleLoggerMgr::displayLock);
-    std::cout << msg << std::endl;
-    l.unlock();
+void SimpleLogger::putRaw(int level,
+                          const char* source_file,
+                          const char* func_name,
+                          size_t line_number,
+                          const char* data,
+                          size_t len)
+{
+    if (!checkLevel(level)) return;
+    if (sink.isFailed()) return;
+
+    putInternal( level, source_file, func_name, line_number,
+                 getCurrentTime(this),
+                 [data, len](char* out, size_t out_size) -> size_t {
+                     // Same as `snprintf`.
+                     if (!out_size) return len;
+                     size_t copy_len = std::min(len, out_size - 1);
+                     memcpy(out, data, copy_len);
+                     out[copy_len] = 0;
+                     return len;
+                 } );
+}
+
+void SimpleLogger::putWith(int level,
+                           const char* source_file,
+                           const char* func_name,
+                           size_t line_number,
+                           MsgWriter writer,
+                           const void* ctx)
+{
+    if (!checkLevel(level)) return;
+    if (sink.isFailed()) return;
+
+    putInternal( level, source_file, func_name, line_number,
+                 getCurrentTime(this),
+                 [writer, ctx](char* out, size_t out_size) -> size_t {
+                     return writer(out, out_size, ctx);
+                 } );
+}
+
+// `user_msg(out, out_size)` writes the user message into `out`,
+// in the same way as `snprintf`.
+template<typename UserMsgFunc>
+void SimpleLogger::putInternal(int level,
+                               const char* source_file,
+                               const char* func_name,
+                               size_t line_number,
+                               std::chrono::system_clock::time_point now,
+                               UserMsgFunc user_msg)
+{
+    char msg[MSG_SIZE];
+    int TID_DIGITS = 0;
+    uint32_t tid_hash = _my_tid_hash(TID_DIGITS);
+    int64_t time_raw = now.time_since_epoch().count();
+    LogRing* dst = perThreadBuffer.load(MOR) ? getThreadRing() : &ring;
+
+    SimpleLoggerMgr::TimeCache& tc = _my_time_cache();
+    tc.update(now, tzGap);
+    const SimpleLoggerMgr::TimeInfo& lt = tc.lt;
+    size_t full_len = 0, user_pos = 0, user_len = 0;
+    char* line = msg;
+    size_t line_len = _compose_log_line( msg, MSG_SIZE, level, tc,
+                                         TID_DIGITS, tid_hash,
+                                         source_file, func_name, line_number,
+                                         user_msg, full_len,
+                                         user_pos, user_len );
+
+    char* big_msg = nullptr;
+    if (line_len < full_len) {
+        // Too long message, use heap memory (up to the max size of ring).
+        size_t big_msg_size = std::min(full_len, dst->maxPayloadLen()) + 1;
+        big_msg = (char*)malloc(big_msg_size);
+        line = big_msg;
+        line_len = _compose_log_line( big_msg, big_msg_size, level, tc,
+                                      TID_DIGITS, tid_hash,
+                                      source_file, func_name, line_number,
+                                      user_msg, full_len,
+                                      user_pos, user_len );
+    }
+    writeRecord(dst, LogRing::TEXT, time_raw, line, line_len);
+    syncOnLevel(level);
+
+    if (level <= curDispLevel) {
+        // Console part: decorate the user message already rendered above.
+        SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+        bool color = mgr ? mgr->isConsoleColor() : true;
+        char header[512];
+        size_t header_len =
+            _compose_console_header( header, sizeof(header), lt,
+                                     TID_DIGITS, tid_hash, level,
+                                     source_file, func_name, line_number,
+                                     color );
+        size_t tail_len = 0;
+        const char* tail = _console_tail(color, tail_len);
+        SimpleLoggerMgr::writeConsole( mgr, header, header_len,
+                                       line + user_pos, user_len,
+                                       tail, tail_len );
+    }
+    free(big_msg);
 }
 
 void SimpleLogger::execCmd(const std::string& cmd_given) {
@@ -1225,69 +4830,1024 @@ void SimpleLogger::execCmd(const std::string& cmd_given) {
 }
 
 void SimpleLogger::doCompression(size_t file_num) {
+    // Should be complete before compression, if the flusher
+    // has not closed it yet.
+    closeRetiredSegments();
+
+    if (isCompressOnWrite()) {
+        // Already compressed, only the retention is left.
+        finishCompression(file_num);
+        return;
+    }
+
+    std::string filename = getLogFilePath(file_num);
+    CompressionFormat format = compFormat.load(MOR);
+    if (format == ZLIB_DICT) {
+        std::string cur_dict = getDictionary(file_num);
+        // Keep the original file if failed. Without a dictionary,
+        // e.g., too small to train, `gzip` instead.
+        int ret = (cur_dict.empty())
+                  ? gzipFile(filename, filename + ".gz")
+                  : compressWithDictionary(filename, filename + ".zz", cur_dict);
+        if (ret == 0) remove(filename.c_str());
+
+    } else if (format == GZIP) {
+        SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+        uint64_t file_size = 0;
+        FILE* fp = fopen(filename.c_str(), "rb");
+        if (fp) {
+            fseek(fp, 0, SEEK_END);
+            long size = ftell(fp);
+            if (size > 0) file_size = size;
+            fclose(fp);
+        }
+        size_t num_blocks = (file_size + COMP_BLOCK_SIZE - 1) / COMP_BLOCK_SIZE;
+        if (mgr && mgr->getNumCompressors() > 1 && num_blocks > 1) {
+            // Other compressor threads take the rest of blocks,
+            // and the last one finishes the job.
+            std::shared_ptr<CompSplit> split
+                ( new CompSplit(file_num, filename, file_size, num_blocks) );
+            for (size_t ii=1; ii<num_blocks; ++ii) {
+                SimpleLoggerMgr::CompElem* elem =
+                    new SimpleLoggerMgr::CompElem(file_num, this);
+                elem->split = split;
+                elem->blockIdx = ii;
+                mgr->addCompElem(elem);
+            }
+            compressBlock(split, 0);
+            return;
+        }
+
+        // Keep the original file if failed.
+        if (gzipFile(filename, filename + ".gz") == 0) {
+            remove(filename.c_str());
+        }
+    } else {
 #if defined(__linux__) || defined(__APPLE__)
+        std::string cmd;
+        cmd = "tar zcvf " + filename + ".tar.gz " + filename;
+        execCmd(cmd);
+        remove(filename.c_str());
+#endif
+    }
+    finishCompression(file_num);
+}
+
+void SimpleLogger::compressBlock(const std::shared_ptr<CompSplit>& split,
+                                 size_t block_idx)
+{
+    uint64_t offset = block_idx * COMP_BLOCK_SIZE;
+    uint64_t len = std::min(COMP_BLOCK_SIZE, split->fileSize - offset);
+    if (gzipBlock(split->srcPath, offset, len, split->getPartPath(block_idx)) != 0) {
+        split->failed = true;
+    }
+    if (split->numLeft.fetch_sub(1) != 1) return;
+
+    // The last block: the first part becomes the output file,
+    // and the others are appended to it in order.
+    std::string dst_path = split->srcPath + ".gz";
+    bool ok = !split->failed &&
+              rename(split->getPartPath(0).c_str(), dst_path.c_str()) == 0;
+    if (ok) {
+        FILE* out = fopen(dst_path.c_str(), "ab");
+        ok = (out != nullptr);
+        std::vector<char> buf(ok ? COMP_COPY_BUF_SIZE : 0);
+        for (size_t ii=1; ok && ii<split->numBlocks; ++ii) {
+            FILE* in = fopen(split->getPartPath(ii).c_str(), "rb");
+            ok = (in != nullptr);
+            while (ok) {
+                size_t num_read = fread(buf.data(), 1, buf.size(), in);
+                if (!num_read) break;
+                ok = (fwrite(buf.data(), 1, num_read, out) == num_read);
+            }
+            if (in) {
+                if (ferror(in)) ok = false;
+                fclose(in);
+            }
+        }
+        if (out && fclose(out) != 0) ok = false;
+    }
+    for (size_t ii=0; ii<split->numBlocks; ++ii) {
+        remove(split->getPartPath(ii).c_str());
+    }
+
+    // Keep the original file if failed.
+    if (ok) {
+        remove(split->srcPath.c_str());
+    } else {
+        remove(dst_path.c_str());
+    }
+    finishCompression(split->fileNum);
+}
+
+void SimpleLogger::finishCompression(size_t file_num) {
+    {   std::lock_guard<std::mutex> l(retentionLock);
+        addArchivedFile(file_num);
+    }
+    // Old files are removed by the background flusher.
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) mgr->invokeFlusher();
+
+    numCompJobs.fetch_sub(1);
+    _wake_waiters(numCompJobs, numCompJobWaiters);
+}
+
+void SimpleLogger::addArchivedFile(size_t file_num) {
+    // Compressed one first, the original may remain if failed.
+    static const char* SUFFIXES[] = {".gz", ".zz", ".tar.gz", ""};
     std::string filename = getLogFilePath(file_num);
-    std::string cmd;
-    cmd = "tar zcvf " + filename + ".tar.gz " + filename;
-    execCmd(cmd);
+    for (const char* suffix: SUFFIXES) {
+        struct stat st;
+        std::string path = filename + suffix;
+        if (stat(path.c_str(), &st) != 0) continue;
+
+        ArchivedFile file;
+        file.revnum = file_num;
+        file.path = path;
+        file.size = st.st_size;
+        file.mtime = st.st_mtime;
+        // Compression jobs can finish out of order.
+        auto itr = archivedFiles.end();
+        while (itr != archivedFiles.begin() && (itr - 1)->revnum > file_num) {
+            --itr;
+        }
+        archivedFiles.insert(itr, file);
+        archivedBytes += file.size;
+        return;
+    }
+}
+
+void SimpleLogger::popArchivedFile(std::vector<std::string>& paths_out) {
+    if (archivedFiles.empty()) return;
+    ArchivedFile& file = archivedFiles.front();
+    paths_out.push_back(file.path);
+    archivedBytes -= file.size;
+    minRevnum = std::max(minRevnum, file.revnum + 1);
+    archivedFiles.pop_front();
+
+    // Dictionaries not used by remaining files: each one is used
+    // until the next one.
+    std::lock_guard<std::mutex> l(dictLock);
+    while (dictRevnums.size() > 1) {
+        std::set<size_t>::iterator second = std::next(dictRevnums.begin());
+        if (*second > minRevnum) break;
+        paths_out.push_back(getLogFilePath(*dictRevnums.begin()) + ".zdict");
+        dictRevnums.erase(dictRevnums.begin());
+    }
+}
+
+void SimpleLogger::collectExpiredFiles(int64_t now_sec,
+                                       std::vector<std::string>& paths_out)
+{
+    size_t max_files = maxLogFiles.load();
+    uint64_t max_bytes = maxTotalBytes.load();
+    uint64_t max_age = maxAgeSec.load();
+
+    std::lock_guard<std::mutex> l(retentionLock);
+    while (!archivedFiles.empty()) {
+        const ArchivedFile& oldest = archivedFiles.front();
+        if ( !(max_files && archivedFiles.size() > max_files) &&
+             !(max_bytes && archivedBytes > max_bytes) &&
+             !(max_age && oldest.mtime + (int64_t)max_age < now_sec) ) {
+            break;
+        }
+        popArchivedFile(paths_out);
+    }
+}
+
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+// Large chunks, to read and write with a few system calls.
+static const size_t ZLIB_CHUNK_SIZE = 1024 * 1024;
+
+// Compress up to `len` bytes from `in`, and pass the output to
+// `write_func(data, size)`. The output is a gzip member, or a zlib
+// stream if `dict` is given (gzip does not support dictionaries).
+// Returns 0 on success.
+template<typename WriteFunc>
+static int _deflate_stream(FILE* in,
+                           uint64_t len,
+                           const std::string& dict,
+                           WriteFunc write_func)
+{
+    const size_t CHUNK_SIZE = ZLIB_CHUNK_SIZE;
+
+    z_stream zs;
+    memset(&zs, 0x0, sizeof(zs));
+    // +16: gzip header and trailer, instead of zlib's.
+    int window_bits = (dict.empty()) ? 15 + 16 : 15;
+    if ( deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       window_bits, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+        return -1;
+    }
+    if ( !dict.empty() &&
+         deflateSetDictionary( &zs, (const Bytef*)dict.data(),
+                               dict.size() ) != Z_OK ) {
+        deflateEnd(&zs);
+        return -1;
+    }
+
+    std::vector<unsigned char> in_buf(CHUNK_SIZE);
+    std::vector<unsigned char> out_buf(CHUNK_SIZE);
+    int ret = 0;
+    int flush = Z_NO_FLUSH;
+    while (flush != Z_FINISH && ret == 0) {
+        size_t to_read = std::min((uint64_t)CHUNK_SIZE, len);
+        size_t num_read = fread(in_buf.data(), 1, to_read, in);
+        if (ferror(in)) {
+            ret = -1;
+            break;
+        }
+        len -= num_read;
+        flush = (feof(in) || !len) ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in_buf.data();
+        zs.avail_in = num_read;
+        do {
+            zs.next_out = out_buf.data();
+            zs.avail_out = CHUNK_SIZE;
+            deflate(&zs, flush);
+            size_t num_out = CHUNK_SIZE - zs.avail_out;
+            if (!write_func(out_buf.data(), num_out)) {
+                ret = -1;
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+    deflateEnd(&zs);
+    return ret;
+}
+#endif
+
+int SimpleLogger::gzipFile(const std::string& src_path,
+                           const std::string& dst_path)
+{
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    FILE* in = fopen(src_path.c_str(), "rb");
+    if (!in) return -1;
+    FILE* out = fopen(dst_path.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    int ret = _deflate_stream( in, UINT64_MAX, std::string(),
+        [out](const unsigned char* data, size_t size) {
+            return fwrite(data, 1, size, out) == size;
+        } );
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    if (ret != 0) remove(dst_path.c_str());
+    return ret;
+
+#else
+    (void)src_path;
+    (void)dst_path;
+    return -1;
+#endif
+}
+
+int SimpleLogger::gzipBlock(const std::string& src_path,
+                            uint64_t offset,
+                            uint64_t len,
+                            const std::string& dst_path)
+{
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    FILE* in = fopen(src_path.c_str(), "rb");
+    if (!in) return -1;
+    if (fseek(in, offset, SEEK_SET) != 0) {
+        fclose(in);
+        return -1;
+    }
+    FILE* out = fopen(dst_path.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    int ret = _deflate_stream( in, len, std::string(),
+        [out](const unsigned char* data, size_t size) {
+            return fwrite(data, 1, size, out) == size;
+        } );
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    if (ret != 0) remove(dst_path.c_str());
+    return ret;
+
+#else
+    (void)src_path;
+    (void)offset;
+    (void)len;
+    (void)dst_path;
+    return -1;
+#endif
+}
+
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+// Read up to `max_len` bytes from the beginning of a file.
+static int _read_file(const std::string& path, size_t max_len, std::string& out) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return -1;
+    out.clear();
+    std::vector<char> buf(ZLIB_CHUNK_SIZE);
+    while (out.size() < max_len) {
+        size_t to_read = std::min(buf.size(), max_len - out.size());
+        size_t num_read = fread(buf.data(), 1, to_read, fp);
+        out.append(buf.data(), num_read);
+        if (num_read < to_read) break;
+    }
+    int ret = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return ret;
+}
+
+// Find the dictionary whose ID (Adler-32) is `dict_id`. Without
+// `dict_path`, look for `file.K.zdict` from K = N (of `file.N.zz`) down.
+static int _load_dictionary(const std::string& src_path,
+                            const std::string& dict_path,
+                            uLong dict_id,
+                            std::string& dict_out)
+{
+    const size_t MAX_DICT_SIZE = 32 * 1024;
+    auto try_load = [&](const std::string& path) {
+        if (_read_file(path, MAX_DICT_SIZE, dict_out) != 0) return false;
+        uLong id = adler32( adler32(0L, Z_NULL, 0),
+                            (const Bytef*)dict_out.data(), dict_out.size() );
+        return id == dict_id;
+    };
+    if (!dict_path.empty()) return try_load(dict_path) ? 0 : -1;
+
+    std::string base = src_path;
+    if (base.size() > 3 && base.compare(base.size() - 3, 3, ".zz") == 0) {
+        base.resize(base.size() - 3);
+    }
+    size_t revnum = 0;
+    size_t dot = base.rfind(".");
+    if ( dot != std::string::npos && dot + 1 < base.size() &&
+         base.find_first_not_of("0123456789", dot + 1) == std::string::npos ) {
+        revnum = strtoull(base.c_str() + dot + 1, nullptr, 10);
+        base.resize(dot);
+    }
+    for (size_t kk = revnum + 1; kk-- > 0; ) {
+        std::string path = (kk) ? base + "." + std::to_string(kk) : base;
+        if (try_load(path + ".zdict")) return 0;
+    }
+    return -1;
+}
+#endif
+
+int SimpleLogger::finishGzipStream(const std::string& path) {
+#if defined(SIMPLELOGGER_WITH_ZLIB) && (defined(__linux__) || defined(__APPLE__))
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+    z_stream zs;
+    memset(&zs, 0x0, sizeof(zs));
+    // +16: gzip only.
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        ::close(fd);
+        return -1;
+    }
+
+    std::vector<unsigned char> in_buf(ZLIB_CHUNK_SIZE);
+    std::vector<unsigned char> out_buf(ZLIB_CHUNK_SIZE);
+    uint64_t in_offset = 0;
+    // CRC and length of the data of the current member.
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t out_len = 0;
+    // The last point the file can be cut: the end of a member, or
+    // the end of a byte-aligned block (e.g., by `Z_SYNC_FLUSH`).
+    uint64_t safe_offset = 0;
+    bool safe_member_end = true;
+    uLong safe_crc = crc;
+    uint64_t safe_len = 0;
+    bool in_member = false;
+    bool broken = false;
+    while (!broken) {
+        ssize_t num_read = pread(fd, in_buf.data(), in_buf.size(), in_offset);
+        if (num_read < 0 && errno == EINTR) continue;
+        if (num_read <= 0) {
+            broken = (num_read < 0);
+            break;
+        }
+        zs.next_in = in_buf.data();
+        zs.avail_in = num_read;
+        while (zs.avail_in) {
+            zs.next_out = out_buf.data();
+            zs.avail_out = out_buf.size();
+            int r = inflate(&zs, Z_BLOCK);
+            size_t num_out = out_buf.size() - zs.avail_out;
+            crc = crc32(crc, out_buf.data(), num_out);
+            out_len += num_out;
+            uint64_t pos = in_offset + (num_read - zs.avail_in);
+            if (r == Z_STREAM_END) {
+                inflateReset(&zs);
+                crc = crc32(0L, Z_NULL, 0);
+                out_len = 0;
+                in_member = false;
+                safe_offset = pos;
+                safe_member_end = true;
+                continue;
+            }
+            if (r != Z_OK && r != Z_BUF_ERROR) {
+                broken = true;
+                break;
+            }
+            in_member = true;
+            // 128: end of the header or a block, 64: the final block,
+            // 0-7: unused bits.
+            if ( (zs.data_type & 128) && !(zs.data_type & 64) &&
+                 (zs.data_type & 7) == 0 ) {
+                safe_offset = pos;
+                safe_member_end = false;
+                safe_crc = crc;
+                safe_len = out_len;
+            }
+        }
+        in_offset += num_read;
+    }
+    inflateEnd(&zs);
+
+    int ret = 0;
+    if (in_member || broken) {
+        // Cut at the last safe point. Finish the member by an empty
+        // final block, and the trailer.
+        if (ftruncate(fd, safe_offset) != 0) ret = -1;
+        if (ret == 0 && !safe_member_end) {
+            unsigned char tail[13] = {0x01, 0x00, 0x00, 0xff, 0xff};
+            for (size_t ii=0; ii<4; ++ii) {
+                tail[5 + ii] = (safe_crc >> (ii * 8)) & 0xff;
+                tail[9 + ii] = (safe_len >> (ii * 8)) & 0xff;
+            }
+            if (pwrite(fd, tail, sizeof(tail), safe_offset) != sizeof(tail)) {
+                ret = -1;
+            }
+        }
+    }
+    ::close(fd);
+    return ret;
 
-    cmd = "rm -f " + filename;
-    execCmd(cmd);
+#else
+    (void)path;
+    return -1;
+#endif
+}
 
-    size_t max_log_files = maxLogFiles.load();
-    // Remove previous log files.
-    if (max_log_files && file_num >= max_log_files) {
-        for (size_t ii=minRevnum; ii<=file_num-max_log_files; ++ii) {
-            filename = getLogFilePath(ii);
-            std::string filename_tar = getLogFilePath(ii) + ".tar.gz";
-            cmd = "rm -f " + filename + " " + filename_tar;
-            execCmd(cmd);
-            minRevnum = ii+1;
+int SimpleLogger::trainDictionary(const std::string& src_path,
+                                  std::string& dict_out)
+{
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    // Same as the window size of deflate, a longer one is useless.
+    const size_t DICT_SIZE = 32 * 1024;
+    const size_t SAMPLE_SIZE = 4 * 1024 * 1024;
+    const size_t MIN_FRAGMENT = 4;
+    const size_t MAX_FRAGMENT = 256;
+
+    std::string sample;
+    if (_read_file(src_path, SAMPLE_SIZE, sample) != 0) return -1;
+
+    // Numbers (time, thread ID, values, ...) change on each line, while
+    // the fragments between them are repeated.
+    std::unordered_map<std::string, size_t> counts;
+    size_t pos = 0;
+    while (pos < sample.size()) {
+        size_t end = pos;
+        while (end < sample.size() && !isdigit((unsigned char)sample[end])) end++;
+        if (end - pos >= MIN_FRAGMENT) {
+            counts[sample.substr(pos, std::min(end - pos, MAX_FRAGMENT))]++;
         }
+        pos = end;
+        while (pos < sample.size() && isdigit((unsigned char)sample[pos])) pos++;
+    }
+
+    // Bytes saved by each fragment, if it appears more than once.
+    std::vector< std::pair<uint64_t, const std::string*> > scored;
+    for (auto& entry: counts) {
+        if (entry.second < 2) continue;
+        scored.push_back( std::make_pair( (entry.second - 1) * entry.first.size(),
+                                          &entry.first ) );
+    }
+    std::sort( scored.begin(), scored.end(),
+               []( const std::pair<uint64_t, const std::string*>& a,
+                   const std::pair<uint64_t, const std::string*>& b ) {
+                   return a.first > b.first;
+               } );
+
+    std::vector<const std::string*> chosen;
+    size_t total = 0;
+    for (auto& entry: scored) {
+        if (total + entry.second->size() > DICT_SIZE) continue;
+        chosen.push_back(entry.second);
+        total += entry.second->size();
+    }
+
+    // The rest of the space: the last lines of the sample, as a small
+    // file would be compressed with the previous one.
+    dict_out.clear();
+    if (total < DICT_SIZE) {
+        size_t tail_pos = sample.size() - std::min(sample.size(), DICT_SIZE - total);
+        size_t line_pos = sample.find('\n', tail_pos);
+        if (line_pos != std::string::npos) dict_out = sample.substr(line_pos + 1);
     }
+    // The most valuable fragments at the end, closest to the data.
+    for (auto itr = chosen.rbegin(); itr != chosen.rend(); ++itr) {
+        dict_out += **itr;
+    }
+    return (dict_out.empty()) ? -1 : 0;
+
+#else
+    (void)src_path;
+    (void)dict_out;
+    return -1;
 #endif
+}
 
-    numCompJobs.fetch_sub(1);
+int SimpleLogger::compressWithDictionary(const std::string& src_path,
+                                         const std::string& dst_path,
+                                         const std::string& dict)
+{
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    if (dict.empty()) return -1;
+    FILE* in = fopen(src_path.c_str(), "rb");
+    if (!in) return -1;
+    FILE* out = fopen(dst_path.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    int ret = _deflate_stream( in, UINT64_MAX, dict,
+        [out](const unsigned char* data, size_t size) {
+            return fwrite(data, 1, size, out) == size;
+        } );
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    if (ret != 0) remove(dst_path.c_str());
+    return ret;
+
+#else
+    (void)src_path;
+    (void)dst_path;
+    (void)dict;
+    return -1;
+#endif
 }
 
-bool SimpleLogger::flush(size_t start_pos) {
-    std::unique_lock<std::mutex> ll(flushingLogs, std::try_to_lock);
-    if (!ll.owns_lock()) return false;
+int SimpleLogger::decompressFile(const std::string& src_path,
+                                 const std::string& dst_path,
+                                 const std::string& dict_path)
+{
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const size_t CHUNK_SIZE = ZLIB_CHUNK_SIZE;
+
+    FILE* in = fopen(src_path.c_str(), "rb");
+    if (!in) return -1;
+    FILE* out = fopen(dst_path.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
 
-    size_t num = logs.size();
-    // Circular flush into file.
-    for (size_t ii=start_pos; ii<num; ++ii) {
-        LogElem& ll = logs[ii];
-        ll.flush(fs);
+    z_stream zs;
+    memset(&zs, 0x0, sizeof(zs));
+    // +32: detect gzip or zlib header.
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        fclose(in);
+        fclose(out);
+        return -1;
     }
-    for (size_t ii=0; ii<start_pos; ++ii) {
-        LogElem& ll = logs[ii];
-        ll.flush(fs);
+
+    std::vector<unsigned char> in_buf(CHUNK_SIZE);
+    std::vector<unsigned char> out_buf(CHUNK_SIZE);
+    std::string cur_dict;
+    int ret = 0;
+    bool in_stream = false;
+    while (ret == 0) {
+        size_t num_read = fread(in_buf.data(), 1, CHUNK_SIZE, in);
+        if (ferror(in)) ret = -1;
+        if (!num_read) break;
+        zs.next_in = in_buf.data();
+        zs.avail_in = num_read;
+        do {
+            zs.next_out = out_buf.data();
+            zs.avail_out = CHUNK_SIZE;
+            int r = inflate(&zs, Z_NO_FLUSH);
+            if (r == Z_NEED_DICT) {
+                r = ( _load_dictionary( src_path, dict_path,
+                                        zs.adler, cur_dict ) == 0 )
+                    ? inflateSetDictionary( &zs,
+                                            (const Bytef*)cur_dict.data(),
+                                            cur_dict.size() )
+                    : Z_DATA_ERROR;
+            }
+            if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+                ret = -1;
+                break;
+            }
+            size_t num_out = CHUNK_SIZE - zs.avail_out;
+            if (num_out && fwrite(out_buf.data(), 1, num_out, out) != num_out) {
+                ret = -1;
+                break;
+            }
+            // `Z_BUF_ERROR`: no progress, e.g., nothing left after the end.
+            if (r == Z_OK) in_stream = true;
+            if (r == Z_STREAM_END) {
+                // Next gzip member, e.g., by multiple compressor threads.
+                in_stream = false;
+                inflateReset(&zs);
+            }
+        } while (zs.avail_in || zs.avail_out == 0);
     }
-    fs.flush();
+    // Truncated.
+    if (in_stream) ret = -1;
 
-    if ( maxLogFileSize &&
-         fs.tellp() > (int64_t)maxLogFileSize ) {
-        // Exceeded limit, make a new file.
-        curRevnum++;
-        fs.close();
-        fs.open(getLogFilePath(curRevnum), std::ofstream::out | std::ofstream::app);
+    inflateEnd(&zs);
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    if (ret != 0) remove(dst_path.c_str());
+    return ret;
 
-        // Compress it (tar gz). Register to the global queue.
-        SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
-        if (mgr) {
-            numCompJobs.fetch_add(1);
-            SimpleLoggerMgr::CompElem* elem =
-                new SimpleLoggerMgr::CompElem(curRevnum-1, this);
-            mgr->addCompElem(elem);
+#else
+    (void)src_path;
+    (void)dst_path;
+    (void)dict_path;
+    return -1;
+#endif
+}
+
+std::string SimpleLogger::getDictionary(size_t file_num) {
+    std::lock_guard<std::mutex> l(dictLock);
+    // Compressed out of order (multiple compressor threads), the current
+    // dictionary is not found by the decompressor. Do without it.
+    if (!dict.empty() && file_num < dictRevnum) return std::string();
+    if (!dict.empty() && file_num < dictRevnum + dictRetrainInterval.load()) {
+        return dict;
+    }
+
+    std::string new_dict;
+    if (trainDictionary(getLogFilePath(file_num), new_dict) != 0) {
+        return dict;
+    }
+    // Stored next to log files, before any file uses it.
+    std::string dict_path = getLogFilePath(file_num) + ".zdict";
+    FILE* fp = fopen(dict_path.c_str(), "wb");
+    if (!fp) return dict;
+    bool ok = (fwrite(new_dict.data(), 1, new_dict.size(), fp) == new_dict.size());
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) {
+        remove(dict_path.c_str());
+        return dict;
+    }
+
+    dict = new_dict;
+    dictRevnum = file_num;
+    dictRevnums.insert(file_num);
+    return dict;
+}
+
+void SimpleLogger::prepareNextSegment() {
+    if (!maxLogFileSize) return;
+    size_t revnum = curRevnum.load() + 1;
+    {   std::lock_guard<std::mutex> l(nextSegmentLock);
+        if (FileSink::isValidHandle(nextSegment)) {
+            if (nextSegmentRevnum == revnum) return;
+            // Stale, the flusher opened it by itself. Do not trim,
+            // the flusher may be writing to the same file.
+            FileSink::closeFile(nextSegment, 0, false);
+            nextSegment = FileSink::invalidHandle();
+        }
+    }
+
+    uint64_t size = 0;
+    // The size of a compressed file is unknown, do not preallocate.
+    FileSink::Handle h = FileSink::openFile( getActiveFilePath(revnum),
+                                             size,
+                                             isCompressOnWrite()
+                                             ? 0 : maxLogFileSize );
+    if (!FileSink::isValidHandle(h)) return;
+
+    std::lock_guard<std::mutex> l(nextSegmentLock);
+    if ( revnum != curRevnum.load() + 1 ||
+         FileSink::isValidHandle(nextSegment) ) {
+        // Rotated meanwhile, and `rotate()` opened it by itself as
+        // the active file, or `start()` has prepared it concurrently.
+        // Do not trim, it may be being written.
+        FileSink::closeFile(h, 0, false);
+        return;
+    }
+    nextSegment = h;
+    nextSegmentRevnum = revnum;
+    nextSegmentSize = size;
+}
+
+void SimpleLogger::closeRetiredSegments() {
+    std::lock_guard<std::mutex> l(retiredCloseLock);
+    std::deque<RetiredSegment> segments;
+    {   std::lock_guard<std::mutex> ll(retiredSegmentLock);
+        segments.swap(retiredSegments);
+    }
+    for (RetiredSegment& segment: segments) {
+        FileSink::closeFile(segment.handle, segment.trimSize, true);
+        numSyncs.fetch_add(1, MOR);
+    }
+}
+
+void SimpleLogger::discardNextSegment() {
+    std::lock_guard<std::mutex> l(nextSegmentLock);
+    if (!FileSink::isValidHandle(nextSegment)) return;
+    if (nextSegmentRevnum <= curRevnum.load()) {
+        // Stale, the same file as the active (or a previous) one.
+        FileSink::closeFile(nextSegment, 0, false);
+    } else {
+        // Not used by anyone. Remove it, if it was created for nothing.
+        FileSink::closeFile(nextSegment, nextSegmentSize, false);
+        if (!nextSegmentSize) {
+            remove(getActiveFilePath(nextSegmentRevnum).c_str());
+        }
+    }
+    nextSegment = FileSink::invalidHandle();
+}
+
+void SimpleLogger::rotate() {
+    curRevnum++;
+
+    FileSink::Handle next = FileSink::invalidHandle();
+    uint64_t next_size = 0;
+    {   std::lock_guard<std::mutex> l(nextSegmentLock);
+        if ( FileSink::isValidHandle(nextSegment) &&
+             nextSegmentRevnum == curRevnum ) {
+            next = nextSegment;
+            next_size = nextSegmentSize;
+            nextSegment = FileSink::invalidHandle();
         }
     }
+    if (!FileSink::isValidHandle(next)) {
+        // Not prepared yet, open it here.
+        numSlowRotations.fetch_add(1, MOR);
+        next = FileSink::openFile(getActiveFilePath(curRevnum), next_size);
+    }
+
+    FileSink::Handle prev = FileSink::invalidHandle();
+    uint64_t prev_size = 0;
+    {   std::lock_guard<std::mutex> l(syncLock);
+        prev = sink.swapFile(next, next_size, prev_size);
+        syncedOffset = 0;
+    }
+
+    // Closing (with sync) and compression are done by the background
+    // thread. `syncFile()` syncs it if the thread has not done it yet.
+    if (FileSink::isValidHandle(prev)) {
+        std::lock_guard<std::mutex> l(retiredSegmentLock);
+        RetiredSegment segment;
+        segment.handle = prev;
+        segment.trimSize = prev_size;
+        retiredSegments.push_back(segment);
+    }
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+    if (mgr) {
+        // To close the previous file and prepare the next one.
+        mgr->invokeFlusher();
+
+        // Queue the rotated file for the compressor pool, to be
+        // compressed in the configured format.
+        numCompJobs.fetch_add(1);
+        SimpleLoggerMgr::CompElem* elem =
+            new SimpleLoggerMgr::CompElem(curRevnum-1, this);
+        mgr->addCompElem(elem);
+    }
+}
 
+void SimpleLogger::flushRecord(const LogRing::Record& rec, size_t max_len) {
+    const char* payload = rec.payload;
+    if (rec.type != LogRing::DEFERRED) {
+        // Written directly from the ring.
+        sink.append(payload, rec.len);
+        return;
+    }
+
+    char* msg = sink.getStagingBuf(MSG_SIZE);
+    size_t full_len = 0;
+    size_t msg_len = renderDeferred(payload, msg, MSG_SIZE, full_len);
+    if (msg_len == full_len) {
+        sink.appendStaged(msg_len);
+        return;
+    }
+    // Too long, should be the same as `put()`.
+    size_t big_msg_size = std::min(full_len, max_len) + 1;
+    char* big_msg = (char*)malloc(big_msg_size);
+    msg_len = renderDeferred(payload, big_msg, big_msg_size, full_len);
+    sink.append(big_msg, msg_len);
+    sink.commit();
+    free(big_msg);
+}
+
+void SimpleLogger::recycleThreadRings
+     ( const std::vector< std::shared_ptr<LogRing> >& rings )
+{
+    // Keep a few, to avoid holding too much memory.
+    const size_t MAX_FREE_RINGS = 16;
+
+    std::lock_guard<std::mutex> l(threadRingsLock);
+    for (const std::shared_ptr<LogRing>& rr: rings) {
+        auto entry = std::find(threadRings.begin(), threadRings.end(), rr);
+        if (entry == threadRings.end()) continue;
+        threadRings.erase(entry);
+        numThreadRings.store(threadRings.size(), MOR);
+        if (freeThreadRings.size() < MAX_FREE_RINGS) {
+            freeThreadRings.push_back(rr);
+        }
+    }
+}
+
+void SimpleLogger::beginFlush(FlushBatch& batch) {
+    batch.srcs.assign(1, &ring);
+    // Rings that have logs, or need to be recycled.
+    if (numThreadRings.load(MOR)) {
+        std::lock_guard<std::mutex> l(threadRingsLock);
+        for (std::shared_ptr<LogRing>& rr: threadRings) {
+            if (!rr->empty() || rr->isRetired()) batch.rings.push_back(rr);
+        }
+    }
+    // Should be checked before draining, as retired rings
+    // do not get new logs.
+    for (std::shared_ptr<LogRing>& rr: batch.rings) {
+        if (rr->isRetired()) batch.retiredRings.push_back(rr);
+        batch.srcs.push_back(rr.get());
+    }
+    batch.seqs.resize(batch.srcs.size());
+    batch.endSeqs.resize(batch.srcs.size());
+    for (size_t ii=0; ii<batch.srcs.size(); ++ii) {
+        batch.seqs[ii] = batch.srcs[ii]->frontSeq();
+        batch.endSeqs[ii] = batch.srcs[ii]->backSeq();
+    }
+}
+
+size_t SimpleLogger::fillBatch(FlushBatch& batch) {
+    // Records are read ahead, and consumed once they are written.
+    size_t num_records = 0;
+    LogRing::Record rec;
+    if (batch.srcs.size() == 1) {
+        uint32_t& seq = batch.seqs[0];
+        while ( sink.hasRoom() &&
+                seq != batch.endSeqs[0] &&
+                ring.peek(seq, rec) ) {
+            flushRecord(rec, ring.maxPayloadLen());
+            seq++;
+            num_records++;
+        }
+
+    } else {
+        // Merge logs from all rings in timestamp order.
+        // {timestamp, index of ring}.
+        typedef std::pair<int64_t, size_t> HeapElem;
+        std::priority_queue< HeapElem,
+                             std::vector<HeapElem>,
+                             std::greater<HeapElem> > heap;
+        for (size_t ii=0; ii<batch.srcs.size(); ++ii) {
+            if ( batch.seqs[ii] != batch.endSeqs[ii] &&
+                 batch.srcs[ii]->peek(batch.seqs[ii], rec) ) {
+                heap.push( HeapElem(rec.timeRaw, ii) );
+            }
+        }
+        while (!heap.empty() && sink.hasRoom()) {
+            size_t idx = heap.top().second;
+            heap.pop();
+            LogRing* src = batch.srcs[idx];
+            src->peek(batch.seqs[idx], rec);
+            flushRecord(rec, src->maxPayloadLen());
+            batch.seqs[idx]++;
+            num_records++;
+            if ( batch.seqs[idx] != batch.endSeqs[idx] &&
+                 src->peek(batch.seqs[idx], rec) ) {
+                heap.push( HeapElem(rec.timeRaw, idx) );
+            }
+        }
+    }
+    batch.numRecords += num_records;
+    return num_records;
+}
+
+void SimpleLogger::releaseBatch(FlushBatch& batch) {
+    for (size_t ii=0; ii<batch.srcs.size(); ++ii) {
+        if (batch.srcs[ii]->frontSeq() == batch.seqs[ii]) continue;
+        batch.srcs[ii]->popUntil(batch.seqs[ii]);
+        batch.srcs[ii]->notifyConsumed();
+    }
+}
+
+void SimpleLogger::endFlush(FlushBatch& batch) {
+    if (!batch.retiredRings.empty()) recycleThreadRings(batch.retiredRings);
+
+    // Nothing has been written to the file.
+    if (!batch.numRecords) return;
+
+    // Written logs should be readable from the compressed file.
+    sink.flushStream();
+
+    if ( maxLogFileSize &&
+         sink.getOffset() > maxLogFileSize ) {
+        // Exceeded limit, switch to the next file.
+        rotate();
+    }
+}
+
+bool SimpleLogger::flush(bool wait, bool drain) {
+    // Idle logger: nothing to do, even without the lock.
+    // If someone else is flushing, it will be done after the lock.
+    if (ring.empty() && !numThreadRings.load(MOR)) {
+        // Allow the next request.
+        if (flushRequested.load(MOR)) flushRequested.store(false, MOR);
+        if (!wait) return true;
+    }
+
+    std::unique_lock<std::mutex> ll(flushingLogs, std::defer_lock);
+    if (wait) {
+        ll.lock();
+    } else if (!ll.try_lock()) {
+        return false;
+    }
+    flushRequested.store(false, MOR);
+
+    FlushBatch batch;
+    beginFlush(batch);
+    while (true) {
+        if (fillBatch(batch)) {
+            sink.commit();
+            releaseBatch(batch);
+            continue;
+        }
+        if (!drain || batch.seqs == batch.endSeqs) break;
+        // A record reserved before `beginFlush()` is being written,
+        // it will be published soon.
+        std::this_thread::yield();
+    }
+    endFlush(batch);
     return true;
 }
 
 void SimpleLogger::flushAll() {
-    uint64_t start_pos = cursor.load(MOR);
-    flush(start_pos);
+    flush();
+}
+
+void SimpleLogger::setDurability(Durability mode,
+                                 int sync_level,
+                                 uint64_t sync_interval_ms)
+{
+    syncLevel = sync_level;
+    syncIntervalMs = sync_interval_ms;
+    durability = mode;
+}
+
+void SimpleLogger::syncFile(uint64_t min_interval_ms) {
+    // Logs in the previous file should be durable as well.
+    if (!min_interval_ms) closeRetiredSegments();
+
+    std::lock_guard<std::mutex> l(syncLock);
+    uint64_t offset = sink.getOffset();
+    // Nothing has been written since the last sync.
+    if (offset == syncedOffset) return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( min_interval_ms &&
+         now - lastSyncTime < std::chrono::milliseconds(min_interval_ms) ) {
+        return;
+    }
+
+    // Data written after reading `offset` may be synced as well,
+    // which is harmless.
+    sink.sync();
+    numSyncs.fetch_add(1, MOR);
+    syncedOffset = offset;
+    lastSyncTime = now;
+}
+
+void SimpleLogger::flushBarrier(BarrierLevel level) {
+    std::unique_lock<std::mutex> l(barrierLock);
+    uint64_t ticket = ++barrierTicket;
+    if (level == DURABLE) barrierSyncRequested = true;
+    const uint64_t& done = (level == DURABLE) ? durableTicket : writtenTicket;
+
+    while (done < ticket) {
+        if (barrierLeaderActive) {
+            barrierCv.wait(l);
+            continue;
+        }
+
+        // Become the leader, on behalf of all callers so far.
+        barrierLeaderActive = true;
+        uint64_t covered = barrierTicket;
+        bool do_sync = barrierSyncRequested;
+        barrierSyncRequested = false;
+        l.unlock();
+
+        // All logs put before `covered` callers are in the rings,
+        // some of them may not be published yet.
+        flush(true, true);
+        if (do_sync) syncFile();
+
+        l.lock();
+        writtenTicket = covered;
+        if (do_sync) durableTicket = covered;
+        barrierLeaderActive = false;
+        barrierCv.notify_all();
+    }
 }
 
@@ -34,19 +34,32 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#if __cplusplus >= 201703L
+    #include <string_view>
+#endif
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #if defined(__linux__) || defined(__APPLE__)
     #include <sys/time.h>
+    #include <sys/uio.h>
 #endif
 
 // To suppress false alarms by thread sanitizer,
@@ -61,11 +74,41 @@
 // 5: Debug   [DEBG]
 // 6: Trace   [TRAC]
 
+// Logs whose level is greater than this (i.e., less important) are
+// removed at compile time, including the evaluation of their arguments.
+// The runtime log level still works for the remaining levels.
+// e.g.) -DSIMPLELOGGER_MIN_LEVEL=4: DEBUG and TRACE logs are removed.
+#ifndef SIMPLELOGGER_MIN_LEVEL
+#define SIMPLELOGGER_MIN_LEVEL (6)
+#endif
+
+#define _SL_LEVEL_ENABLED(level) ((level) <= SIMPLELOGGER_MIN_LEVEL)
+
+#if defined(__GNUC__)
+    #define _SL_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+    #define _SL_LIKELY(x) (x)
+#endif
+
+// Each log macro has its own `SimpleLoggerCallsite`, which can be
+// enabled or disabled individually. See `SimpleLoggerMgr::enableCallsites`.
+// `_sl_cs_.logLevel` is the level to be passed to the logger.
+#define _SL_CALLSITE_CHECK(level, l)                                    \
+    SimpleLoggerCallsite::Result _sl_cs_ =                              \
+        !_SL_LEVEL_ENABLED(level)                                       \
+        ? SimpleLoggerCallsite::Result()                                \
+        : SimpleLoggerCallsite::check                                   \
+          ( []() -> SimpleLoggerCallsite& {                             \
+                static SimpleLoggerCallsite cs;                         \
+                return cs; }(),                                         \
+            level, l, __FILE__, __func__, __LINE__ )
+
 
 // printf style log macro
-#define _log_(level, l, ...)        \
-    if (l && l->getLogLevel() >= level) \
-        (l)->put(level, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define _log_(level, l, ...)                                            \
+    if (_SL_CALLSITE_CHECK(level, l))                                   \
+        (l)->put( _sl_cs_.logLevel | SimpleLogger::STATIC_CALLSITE,     \
+                  __FILE__, __func__, __LINE__, __VA_ARGS__ )
 
 #define _log_sys(l, ...)    _log_(SimpleLogger::SYS,     l, __VA_ARGS__)
 #define _log_fatal(l, ...)  _log_(SimpleLogger::FATAL,   l, __VA_ARGS__)
@@ -76,10 +119,33 @@
 #define _log_trace(l, ...)  _log_(SimpleLogger::TRACE,   l, __VA_ARGS__)
 
 
+// {}-style format log macro.
+// The format string should be a string literal, and it is checked at
+// compile time: the number of `{}` should be the same as the number of
+// arguments. Use `{{` and `}}` for literal braces.
+#define _log_fmt_(level, l, ...)                                        \
+    if (_SL_CALLSITE_CHECK(level, l))                                   \
+        (l)->template putFmt                                            \
+            < SimpleLogger::Fmt::countPlaceholders                      \
+                  ( _SL_FIRST_ARG(__VA_ARGS__) ) >                      \
+            (_sl_cs_.logLevel, __FILE__, __func__, __LINE__, __VA_ARGS__)
+
+#define _SL_FIRST_ARG(...)          _SL_FIRST_ARG_(__VA_ARGS__, 0)
+#define _SL_FIRST_ARG_(first, ...)  first
+
+#define _log_fmt_sys(l, ...)    _log_fmt_(SimpleLogger::SYS,     l, __VA_ARGS__)
+#define _log_fmt_fatal(l, ...)  _log_fmt_(SimpleLogger::FATAL,   l, __VA_ARGS__)
+#define _log_fmt_err(l, ...)    _log_fmt_(SimpleLogger::ERROR,   l, __VA_ARGS__)
+#define _log_fmt_warn(l, ...)   _log_fmt_(SimpleLogger::WARNING, l, __VA_ARGS__)
+#define _log_fmt_info(l, ...)   _log_fmt_(SimpleLogger::INFO,    l, __VA_ARGS__)
+#define _log_fmt_debug(l, ...)  _log_fmt_(SimpleLogger::DEBUG,   l, __VA_ARGS__)
+#define _log_fmt_trace(l, ...)  _log_fmt_(SimpleLogger::TRACE,   l, __VA_ARGS__)
+
+
 // stream log macro
 #define _stream_(level, l)              \
-    if (l && l->getLogLevel() >= level) \
-        l->eos() = l->stream(level, l, __FILE__, __func__, __LINE__)
+    if (_SL_CALLSITE_CHECK(level, l))   \
+        l->eos() = l->stream(_sl_cs_.logLevel, l, __FILE__, __func__, __LINE__)
 
 #define _s_sys(l)   _stream_(SimpleLogger::SYS,     l)
 #define _s_fatal(l) _stream_(SimpleLogger::FATAL,   l)
@@ -97,14 +163,14 @@
 // This function is global throughout the process, so that
 // multiple threads will share the interval.
 #define _timed_log_g(l, interval_ms, lv1, lv2, ...)                     \
-{                                                                       \
+if (_SL_LEVEL_ENABLED(lv1) || _SL_LEVEL_ENABLED(lv2)) {                 \
     _timed_log_definition(static);                                      \
     _timed_log_body(l, interval_ms, lv1, lv2, __VA_ARGS__);             \
 }
 
 // Same as `_timed_log_g` but per-thread level.
 #define _timed_log_t(l, interval_ms, lv1, lv2, ...)                     \
-{                                                                       \
+if (_SL_LEVEL_ENABLED(lv1) || _SL_LEVEL_ENABLED(lv2)) {                 \
     _timed_log_definition(thread_local);                                \
     _timed_log_body(l, interval_ms, lv1, lv2, __VA_ARGS__);             \
 }
@@ -117,13 +183,13 @@
 
 #define _timed_log_body(l, interval_ms, lv1, lv2, ...)                  \
     std::chrono::system_clock::time_point cur =                         \
-        std::chrono::system_clock::now();                               \
+        SimpleLogger::getCurrentTime(l);                                \
     bool timeout = false;                                               \
-    {   std::lock_guard<std::mutex> l(timer_lock);                      \
+    {   std::lock_guard<std::mutex> timer_guard(timer_lock);            \
         std::chrono::duration<double> elapsed = cur - last_timeout;     \
         if ( elapsed.count() * 1000 > interval_ms ||                    \
              !first_event_fired ) {                                     \
-            cur = std::chrono::system_clock::now();                     \
+            cur = SimpleLogger::getCurrentTime(l);                      \
             elapsed = cur - last_timeout;                               \
             if ( elapsed.count() * 1000 > interval_ms ||                \
                  !first_event_fired ) {                                 \
@@ -140,11 +206,21 @@
 
 
 class SimpleLoggerMgr;
+class SimpleLoggerIoUring;
+struct ThreadWrapper;
 class SimpleLogger {
     friend class SimpleLoggerMgr;
+    friend struct ThreadWrapper;
 public:
     static const int MSG_SIZE = 4096;
+    // Flag in the level passed to `put()` by a force-enabled callsite,
+    // to print the log regardless of the log level.
+    static const int FORCED_LEVEL = 0x100;
+    // Flag in the level passed to `put()` by `_log_` macros, whose
+    // source file and function name are static, so that it can be deferred.
+    static const int STATIC_CALLSITE = 0x200;
     static const std::memory_order MOR = std::memory_order_relaxed;
+    static const size_t CACHE_LINE_SIZE = 64;
 
     enum Levels {
         SYS         = 0,
@@ -157,28 +233,215 @@ public:
         UNKNOWN     = 99,
     };
 
+    enum ClockSource {
+        // `std::chrono::system_clock`.
+        SYSTEM_CLOCK    = 0,
+        // `CLOCK_REALTIME_COARSE` (Linux only, otherwise system clock).
+        // Cheaper, but resolution is a few milliseconds.
+        COARSE_CLOCK    = 1,
+        // CPU timestamp counter, calibrated against wall time by
+        // the background flusher (x86-64 and ARM64 only, otherwise
+        // system clock).
+        TSC_CLOCK       = 2,
+    };
+
+    // What to do when the log buffer is full.
+    enum BackpressurePolicy {
+        // Wait until the background flusher makes space.
+        BLOCK               = 0,
+        // Discard the new log.
+        DROP_NEW            = 1,
+        // Discard the oldest logs that are not flushed yet.
+        OVERWRITE_OLDEST    = 2,
+        // Flush the buffer on the caller's thread.
+        FLUSH_INLINE        = 3,
+    };
+
+    // When logs are made durable on disk (`fdatasync`).
+    enum Durability {
+        // Never sync, the OS writes them back eventually.
+        NO_SYNC             = 0,
+        // The background flusher syncs at most once per sync interval.
+        PERIODIC_SYNC       = 1,
+        // Logs at the sync level (or more important ones) are durable
+        // when the log call returns.
+        SYNC_ON_LEVEL       = 2,
+    };
+
+    // What `flushBarrier()` waits for.
+    enum BarrierLevel {
+        // Written to the log file, but can be lost by power failure.
+        WRITTEN             = 0,
+        // Durable on disk.
+        DURABLE             = 1,
+    };
+
+    // How rotated log files are compressed.
+    enum CompressionFormat {
+        // `file.tar.gz`, by an external `tar` program (Linux and Mac).
+        TAR_GZ              = 0,
+        // `file.gz`, in-process. Needs zlib (`SIMPLELOGGER_WITH_ZLIB`).
+        GZIP                = 1,
+        // `file.zz`, a zlib stream with a preset dictionary trained
+        // from recent log files (`file.N.zdict`). Needs zlib.
+        ZLIB_DICT           = 2,
+    };
+
+    struct BackpressureStats {
+        BackpressureStats()
+            : numFull(0), numDropped(0), numInlineFlushes(0)
+            {}
+        // Number of logs that found the buffer full.
+        uint64_t numFull;
+        // Number of discarded logs (`DROP_NEW` and `OVERWRITE_OLDEST`).
+        uint64_t numDropped;
+        // Number of flushes done by the caller's thread (`FLUSH_INLINE`).
+        uint64_t numInlineFlushes;
+    };
+
+    // Budget of rotated log files. The oldest files are removed until
+    // all limits are met. Zero means no limit.
+    struct RetentionPolicy {
+        RetentionPolicy(size_t max_files = 0,
+                        uint64_t max_total_bytes = 0,
+                        uint64_t max_age_sec = 0)
+            : maxFiles(max_files)
+            , maxTotalBytes(max_total_bytes)
+            , maxAgeSec(max_age_sec)
+            {}
+        bool isUnlimited() const {
+            return !maxFiles && !maxTotalBytes && !maxAgeSec;
+        }
+        // Number of rotated files.
+        size_t maxFiles;
+        // Total size of rotated files (after compression).
+        uint64_t maxTotalBytes;
+        // Seconds since the last modification of rotated files.
+        uint64_t maxAgeSec;
+    };
+
+    // Stream buffer over a per-thread memory, which is reused by
+    // all logs of the thread, and grows on demand.
+    class LogStreamBuf : public std::streambuf {
+    public:
+        LogStreamBuf() : arena(MSG_SIZE) { reset(); }
+
+        inline void reset() {
+            // Do not keep too much memory after a huge log.
+            if (arena.size() > MAX_ARENA_SIZE) {
+                std::vector<char>(MSG_SIZE).swap(arena);
+            }
+            setp(arena.data(), arena.data() + arena.size());
+        }
+
+        inline const char* data() const { return pbase(); }
+        inline size_t size() const { return pptr() - pbase(); }
+
+        // Get space for (at least) `len` bytes, should be followed by
+        // `commit()` with the actual length.
+        inline char* reserve(size_t len) {
+            if ((size_t)(epptr() - pptr()) < len) grow(len);
+            return pptr();
+        }
+        inline void commit(size_t len) { pbump((int)len); }
+
+        inline void append(const char* str, size_t len) {
+            memcpy(reserve(len), str, len);
+            commit(len);
+        }
+
+    protected:
+        int_type overflow(int_type ch) override {
+            if (traits_type::eq_int_type(ch, traits_type::eof())) {
+                return traits_type::not_eof(ch);
+            }
+            *reserve(1) = traits_type::to_char_type(ch);
+            commit(1);
+            return ch;
+        }
+
+        std::streamsize xsputn(const char* str, std::streamsize len) override {
+            append(str, len);
+            return len;
+        }
+
+    private:
+        static const size_t MAX_ARENA_SIZE = 16 * MSG_SIZE;
+
+        void grow(size_t len) {
+            size_t cur_len = size();
+            size_t new_size = arena.size() * 2;
+            while (new_size < cur_len + len) new_size *= 2;
+            arena.resize(new_size);
+            setp(arena.data(), arena.data() + arena.size());
+            commit(cur_len);
+        }
+
+        std::vector<char> arena;
+    };
+
     class LoggerStream : public std::ostream {
     public:
         LoggerStream() : std::ostream(&buf), level(0), logger(nullptr)
                        , file(nullptr), func(nullptr), line(0) {}
 
+        // Fast paths for common types, only if the format is not
+        // changed. Otherwise (and for other types), `std::ostream`.
+        inline LoggerStream& operator<<(const char* str) {
+            if (!str || !defaultFormat()) return fallback(str);
+            buf.append(str, strlen(str));
+            return *this;
+        }
+
+        inline LoggerStream& operator<<(const std::string& str) {
+            if (!defaultFormat()) return fallback(str);
+            buf.append(str.data(), str.size());
+            return *this;
+        }
+
+#if __cplusplus >= 201703L
+        inline LoggerStream& operator<<(std::string_view str) {
+            if (!defaultFormat()) return fallback(str);
+            buf.append(str.data(), str.size());
+            return *this;
+        }
+#endif
+
+        inline LoggerStream& operator<<(char ch) {
+            if (!defaultFormat()) return fallback(ch);
+            buf.append(&ch, 1);
+            return *this;
+        }
+
+        inline LoggerStream& operator<<(short val)      { return writeSigned(val); }
+        inline LoggerStream& operator<<(int val)        { return writeSigned(val); }
+        inline LoggerStream& operator<<(long val)       { return writeSigned(val); }
+        inline LoggerStream& operator<<(long long val)  { return writeSigned(val); }
+
+        inline LoggerStream& operator<<(unsigned short val)     { return writeUnsigned(val); }
+        inline LoggerStream& operator<<(unsigned int val)       { return writeUnsigned(val); }
+        inline LoggerStream& operator<<(unsigned long val)      { return writeUnsigned(val); }
+        inline LoggerStream& operator<<(unsigned long long val) { return writeUnsigned(val); }
+
+        inline LoggerStream& operator<<(float val)  { return writeFloat(val); }
+        inline LoggerStream& operator<<(double val) { return writeFloat(val); }
+
         template<typename T>
         inline LoggerStream& operator<<(const T& data) {
-            sStream << data;
-            return *this;
+            return fallback(data);
         }
 
         using MyCout = std::basic_ostream< char, std::char_traits<char> >;
         typedef MyCout& (*EndlFunc)(MyCout&);
         inline LoggerStream& operator<<(EndlFunc func) {
-            func(sStream);
+            func(*this);
             return *this;
         }
 
         inline void put() {
             if (logger) {
-                logger->put( level, file, func, line,
-                             "%s", sStream.str().c_str() );
+                logger->putRaw( level, file, func, line,
+                                buf.data(), buf.size() );
             }
         }
 
@@ -188,7 +451,15 @@ public:
                                const char* _func,
                                size_t _line)
         {
-            sStream.str(std::string());
+            buf.reset();
+            // Format changes do not last beyond a log.
+            if (!defaultFormat()) {
+                flags(std::ios_base::skipws | std::ios_base::dec);
+                width(0);
+                precision(6);
+                fill(' ');
+            }
+            clear();
             level = _level;
             logger = _logger;
             file = _file;
@@ -197,8 +468,51 @@ public:
         }
 
     private:
-        std::stringbuf buf;
-        std::stringstream sStream;
+        inline bool defaultFormat() const {
+            return flags() == (std::ios_base::skipws | std::ios_base::dec) &&
+                   width() == 0 &&
+                   precision() == 6;
+        }
+
+        template<typename T>
+        inline LoggerStream& fallback(const T& data) {
+            static_cast<std::ostream&>(*this) << data;
+            return *this;
+        }
+
+        template<typename T>
+        inline LoggerStream& writeSigned(T val) {
+            if (!defaultFormat()) return fallback(val);
+            unsigned long long abs_val = val;
+            if (val < 0) {
+                buf.append("-", 1);
+                abs_val = 0ULL - abs_val;
+            }
+            return writeDigits(abs_val);
+        }
+
+        template<typename T>
+        inline LoggerStream& writeUnsigned(T val) {
+            if (!defaultFormat()) return fallback(val);
+            return writeDigits(val);
+        }
+
+        inline LoggerStream& writeDigits(unsigned long long val) {
+            buf.commit( Fmt::formatUnsigned( buf.reserve(Fmt::MAX_INT_LEN),
+                                             val ) );
+            return *this;
+        }
+
+        inline LoggerStream& writeFloat(double val) {
+            if (!defaultFormat()) return fallback(val);
+            // Same as `std::ostream` with default format.
+            const size_t MAX_LEN = 32;
+            int len = snprintf(buf.reserve(MAX_LEN), MAX_LEN, "%g", val);
+            if (len > 0 && len < (int)MAX_LEN) buf.commit(len);
+            return *this;
+        }
+
+        LogStreamBuf buf;
         int level;
         SimpleLogger* logger;
         const char* file;
@@ -206,6 +520,201 @@ public:
         size_t line;
     };
 
+    // Formatting for `_log_fmt_` macros.
+    class Fmt {
+    public:
+        /**
+         * Count the number of `{}` in the given format string,
+         * at compile time.
+         *
+         * @return Number of `{}`, or -1 if the format string is invalid
+         *         (unmatched `{` or `}`).
+         */
+        template<size_t N>
+        static constexpr int countPlaceholders(const char (&fmt)[N]) {
+            return countFrom(fmt, 0, N - 1, 0);
+        }
+
+        // C++11 constexpr functions cannot loop, so recursion is per
+        // brace, and the search between braces is split in halves.
+        // Otherwise, long format strings exceed the depth limit.
+        static constexpr int countFrom(const char* fmt, size_t pos,
+                                       size_t len, int count) {
+            return countAt(fmt, findBrace(fmt, pos, len), len, count);
+        }
+
+        static constexpr int countAt(const char* fmt, size_t pos,
+                                     size_t len, int count) {
+            return (pos >= len) ? count
+                 : (fmt[pos] == '{' && fmt[pos + 1] == '{')
+                   ? countFrom(fmt, pos + 2, len, count)
+                 : (fmt[pos] == '}' && fmt[pos + 1] == '}')
+                   ? countFrom(fmt, pos + 2, len, count)
+                 : (fmt[pos] == '{' && fmt[pos + 1] == '}')
+                   ? countFrom(fmt, pos + 2, len, count + 1)
+                 : -1;
+        }
+
+        // Position of the first `{` or `}` in [begin, end), or `end`.
+        static constexpr size_t findBrace(const char* fmt, size_t begin, size_t end) {
+            return (begin >= end) ? end
+                 : (end - begin == 1)
+                   ? ( (fmt[begin] == '{' || fmt[begin] == '}') ? begin : end )
+                 : findBraceRight( fmt,
+                                   findBrace(fmt, begin, begin + (end - begin) / 2),
+                                   begin + (end - begin) / 2,
+                                   end );
+        }
+
+        static constexpr size_t findBraceRight(const char* fmt, size_t left,
+                                               size_t mid, size_t end) {
+            return (left != mid) ? left : findBrace(fmt, mid, end);
+        }
+
+        // Write up to `size - 1` bytes to `out`, and count the full
+        // length, in the same way as `snprintf`.
+        class Writer {
+        public:
+            Writer(char* _out, size_t _size) : out(_out), size(_size), len(0) {}
+
+            inline void append(const char* data, size_t data_len) {
+                if (len < size) {
+                    size_t avail = size - len;
+                    memcpy(out + len, data, (data_len < avail) ? data_len : avail);
+                }
+                len += data_len;
+            }
+
+            // Null-terminate, and return the full length.
+            inline size_t finish() {
+                if (size) out[(len < size) ? len : (size - 1)] = 0;
+                return len;
+            }
+
+        private:
+            char* out;
+            size_t size;
+            size_t len;
+        };
+
+        // Buffer sizes for the kernels below.
+        static const size_t MAX_INT_LEN = 24;
+        static const size_t MAX_HEX_LEN = 16;
+        static const size_t MAX_FLOAT_LEN = 32;
+
+        /**
+         * Formatting kernels: write `val` to `buf` without
+         * null-termination, and return the length.
+         * `buf` should have `MAX_*_LEN` bytes.
+         */
+        static size_t formatUnsigned(char* buf, uint64_t val);
+        static size_t formatSigned(char* buf, int64_t val);
+
+        /**
+         * Write exactly `width` digits, padded with zeros.
+         * Upper digits that do not fit are dropped.
+         */
+        static void formatFixed(char* buf, uint32_t val, int width);
+
+        /**
+         * Lower-case hex, padded with zeros up to `min_width`.
+         */
+        static size_t formatHex(char* buf, uint64_t val, int min_width);
+
+        /**
+         * Shortest representation that reads back to the same value,
+         * in the same style as `%.15g`, or `%.17g` if it needs more
+         * than 15 significant digits. For a float, `%.6g` or `%.9g`.
+         */
+        static size_t formatDouble(char* buf, double val);
+        static size_t formatFloat(char* buf, float val);
+
+        // Write literal part until the next `{}`, and return the
+        // position right after it.
+        static const char* writeLiteral(Writer& w, const char* fmt);
+
+        static void writeUnsigned(Writer& w, unsigned long long val);
+        static void writeSigned(Writer& w, long long val);
+        static void writeFloat(Writer& w, float val);
+        static void writeDouble(Writer& w, double val);
+        static void writePointer(Writer& w, const void* val);
+
+        static inline void write(Writer& w, bool val) {
+            if (val) w.append("true", 4);
+            else w.append("false", 5);
+        }
+        static inline void write(Writer& w, char val) { w.append(&val, 1); }
+
+        static inline void write(Writer& w, short val)      { writeSigned(w, val); }
+        static inline void write(Writer& w, int val)        { writeSigned(w, val); }
+        static inline void write(Writer& w, long val)       { writeSigned(w, val); }
+        static inline void write(Writer& w, long long val)  { writeSigned(w, val); }
+
+        static inline void write(Writer& w, unsigned short val)     { writeUnsigned(w, val); }
+        static inline void write(Writer& w, unsigned int val)       { writeUnsigned(w, val); }
+        static inline void write(Writer& w, unsigned long val)      { writeUnsigned(w, val); }
+        static inline void write(Writer& w, unsigned long long val) { writeUnsigned(w, val); }
+
+        static inline void write(Writer& w, float val)  { writeFloat(w, val); }
+        static inline void write(Writer& w, double val) { writeDouble(w, val); }
+
+        static inline void write(Writer& w, const char* val) {
+            if (val) w.append(val, strlen(val));
+            else w.append("(null)", 6);
+        }
+        static inline void write(Writer& w, char* val) {
+            write(w, (const char*)val);
+        }
+        static inline void write(Writer& w, const std::string& val) {
+            w.append(val.data(), val.size());
+        }
+#if __cplusplus >= 201703L
+        static inline void write(Writer& w, std::string_view val) {
+            w.append(val.data(), val.size());
+        }
+#endif
+        static inline void write(Writer& w, const void* val) { writePointer(w, val); }
+
+        template<typename T>
+        static inline void write(Writer& w, T* val) { writePointer(w, val); }
+
+        // Write the format string with the arguments in `args`.
+        template<size_t I, typename Tuple>
+        static inline
+        typename std::enable_if< (I == std::tuple_size<Tuple>::value) >::type
+            writeArgs(Writer& w, const char* fmt, const Tuple& args)
+        {
+            (void)args;
+            writeLiteral(w, fmt);
+        }
+
+        template<size_t I, typename Tuple>
+        static inline
+        typename std::enable_if< (I < std::tuple_size<Tuple>::value) >::type
+            writeArgs(Writer& w, const char* fmt, const Tuple& args)
+        {
+            fmt = writeLiteral(w, fmt);
+            write(w, std::get<I>(args));
+            writeArgs<I + 1>(w, fmt, args);
+        }
+
+        template<typename... Args>
+        struct Context {
+            Context(const char* _fmt, const Args&... _args)
+                : fmt(_fmt), args(_args...) {}
+
+            static size_t write(char* out, size_t out_size, const void* ctx) {
+                const Context* cc = static_cast<const Context*>(ctx);
+                Writer w(out, out_size);
+                writeArgs<0>(w, cc->fmt, cc->args);
+                return w.finish();
+            }
+
+            const char* fmt;
+            std::tuple<const Args&...> args;
+        };
+    };
+
     class EndOfStmt {
     public:
         EndOfStmt() {}
@@ -229,35 +738,392 @@ public:
     }
 
 private:
-    struct LogElem {
-        enum Status {
-            CLEAN       = 0,
-            WRITING     = 1,
-            DIRTY       = 2,
-            FLUSHING    = 3,
+    // Ring buffer of variable-length log records. Metadata of records
+    // are kept in a dense array of descriptors, separate from the
+    // payload area (a formatted message, or `DeferredMeta` and captured
+    // arguments), so that the consumer does not touch payload pages to
+    // find published records. Multiple producers reserve a descriptor
+    // and payload space at once by advancing `head`, and a single
+    // consumer (who holds `flushingLogs`) consumes published records
+    // in order, from `tail`. A per-thread ring has a single producer,
+    // which does not need atomic read-modify-write.
+    class LogRing {
+    public:
+        enum RecordType {
+            TEXT        = 1,
+            DEFERRED    = 2,
+        };
+
+        struct Record {
+            RecordType type;
+            const char* payload;
+            size_t len;
+            // Timestamp, to merge records from multiple rings.
+            int64_t timeRaw;
+        };
+
+        // Average log size, to get the ring size from the number of logs.
+        static const size_t AVG_RECORD_SIZE = 256;
+
+        LogRing(size_t capacity, bool single_producer = false);
+        ~LogRing();
+
+        /**
+         * Reserve space for a record whose payload size is `len`.
+         *
+         * @param len Payload size, should not exceed `maxPayloadLen()`.
+         * @param[out] seq_out Sequence number of the reserved record.
+         * @return Pointer to payload, `nullptr` if the ring is full.
+         */
+        char* reserve(size_t len, uint32_t& seq_out);
+
+        /**
+         * Make the reserved record visible to the consumer.
+         */
+        void publish(uint32_t seq, RecordType type, int64_t time_raw);
+
+        /**
+         * Get the oldest published record, without consuming it.
+         * Only one thread can call `front()`, `pop()`, `peek()`, and
+         * `popUntil()` at a time.
+         *
+         * @param[out] rec_out Record.
+         * @return `false` if there is no published record.
+         */
+        bool front(Record& rec_out);
+
+        /**
+         * Consume the record returned by `front()`.
+         */
+        void pop();
+
+        /**
+         * Sequence number of the oldest record, to read ahead
+         * records by `peek()`.
+         */
+        uint32_t frontSeq() const { return tail.load(MOR) >> 32; }
+
+        /**
+         * Sequence number of the next record to be reserved, to bound
+         * a pass of the consumer.
+         */
+        uint32_t backSeq() const { return head.load(MOR) >> 32; }
+
+        /**
+         * Get the published record `seq`, without consuming it.
+         * Records from `frontSeq()` can be read ahead, and they
+         * remain valid until they are consumed by `popUntil()`.
+         *
+         * @param seq Sequence number, `frontSeq()` or later.
+         * @param[out] rec_out Record.
+         * @return `false` if record `seq` is not published yet.
+         */
+        bool peek(uint32_t seq, Record& rec_out) const;
+
+        /**
+         * Consume all records before `seq`.
+         */
+        void popUntil(uint32_t seq);
+
+        bool empty() const;
+
+        size_t getCapacity() const { return capacity; }
+
+        // Including records being written and not consumed yet.
+        size_t getUsedBytes() const {
+            return (uint32_t)head.load(MOR) - (uint32_t)tail.load(MOR);
+        }
+
+        // The owner thread of a per-thread ring has exited,
+        // so that no more records will be added.
+        void retire() { retired.store(true, std::memory_order_release); }
+        bool isRetired() const { return retired.load(std::memory_order_acquire); }
+        void reuse() { retired.store(false, MOR); }
+
+        // Increased whenever the consumer makes space.
+        uint32_t getConsumedEpoch() const { return consumedEpoch.load(); }
+
+        /**
+         * Spin for a while, and then sleep until the consumer makes
+         * space since `epoch`. It may return early.
+         */
+        void waitForSpace(uint32_t epoch);
+
+        /**
+         * Wake up the producers waiting for space (if any).
+         */
+        void notifyConsumed();
+
+        // The largest payload that is guaranteed to fit.
+        size_t maxPayloadLen() const { return capacity / 2; }
+
+    private:
+        // Two descriptors per cache line.
+        struct Desc {
+            // `seq + 1` once record `seq` is published.
+            std::atomic<uint32_t> seq;
+            uint32_t type;
+            uint32_t len;
+            // Position of payload area right after this record.
+            uint32_t end;
+            int64_t timeRaw;
+            int64_t reserved;
         };
 
-        LogElem();
+        static size_t recordSize(size_t len) {
+            return (len + 7) & ~((size_t)7);
+        }
+
+        // `head` and `tail` are {descriptor sequence number (upper 32 bits),
+        // payload position (lower 32 bits)}, both keep increasing and wrap
+        // around, so that the capacity can be up to 2 GB.
+        static uint64_t makePos(uint32_t seq, uint32_t pos) {
+            return ((uint64_t)seq << 32) | pos;
+        }
+
+        // Read-only after construction.
+        void* mem;
+        Desc* descs;
+        char* buf;
+        size_t capacity;
+        uint32_t numDescs;
+        bool singleProducer;
+
+        char padding0[CACHE_LINE_SIZE];
+
+        // Updated by producers.
+        std::atomic<uint64_t> head;
+
+        char padding1[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+
+        // Updated by the consumer.
+        std::atomic<uint64_t> tail;
+        std::atomic<uint32_t> consumedEpoch;
+
+        char padding2[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)
+                                      - sizeof(std::atomic<uint32_t>)];
+
+        // Rarely updated.
+        std::atomic<uint32_t> numWaiters;
+        std::atomic<bool> retired;
+    };
+
+    // Raw file descriptor writer of a log file. It gathers pieces of
+    // logs (records in rings, or messages rendered in its staging area)
+    // without copying them, and writes them by a single `writev` call.
+    // Pieces should remain valid until `commit()`.
+    class FileSink {
+    public:
+        FileSink();
+        ~FileSink();
+
+        // Open the file in append mode, returns 0 on success.
+        int open(const std::string& path);
+        void close();
+        bool isOpen() const;
+
+#if defined(__linux__) || defined(__APPLE__)
+        typedef int Handle;
+#else
+        typedef FILE* Handle;
+#endif
+        static Handle invalidHandle();
+        static bool isValidHandle(Handle h);
+
+        /**
+         * Open a file in append mode, without attaching it to a sink.
+         *
+         * @param path Path of the file.
+         * @param[out] size_out Current size of the file.
+         * @param prealloc_size If non-zero, disk space to reserve
+         *        (Linux only). The file size does not change.
+         * @return Handle of the file, invalid on failure.
+         */
+        static Handle openFile(const std::string& path,
+                               uint64_t& size_out,
+                               uint64_t prealloc_size = 0);
+
+        /**
+         * Close a file returned by `openFile()` or `swapFile()`.
+         *
+         * @param h Handle of the file.
+         * @param trim_size If non-zero, the file is truncated to this
+         *        size, to release the preallocated space. Should be
+         *        the size of the data, no one else writes to the file.
+         * @param sync If `true`, sync the file before closing it.
+         * @return void.
+         */
+        static void closeFile(Handle h, uint64_t trim_size, bool sync);
+
+        /**
+         * Switch to another file opened by `openFile()`. All pending
+         * pieces should have been written.
+         *
+         * @param h Handle of the new file.
+         * @param size Current size of the new file.
+         * @param[out] prev_size_out Size of the previous file.
+         * @return Handle of the previous file.
+         */
+        Handle swapFile(Handle h, uint64_t size, uint64_t& prev_size_out);
+
+        // Open or write failed. Same as a failed `std::ofstream`,
+        // logs are not accepted anymore.
+        bool isFailed() const { return failed; }
+
+        // `false` if the next piece cannot be added without `commit()`.
+        bool hasRoom() const { return numPieces < maxPieces; }
+
+        /**
+         * Add a piece to be written.
+         *
+         * @param data Data, should remain valid until `commit()`.
+         * @param len Length of `data`.
+         */
+        void append(const char* data, size_t len);
+
+        /**
+         * Get the free space in the staging area, to render a message
+         * into it. Pending pieces are written if there is not enough
+         * space.
+         *
+         * @param len Required space.
+         * @return Pointer to the free space.
+         */
+        char* getStagingBuf(size_t len);
+
+        /**
+         * Add the message rendered by `getStagingBuf()` as a piece.
+         *
+         * @param len Length of the message.
+         */
+        void appendStaged(size_t len);
+
+        /**
+         * Write all pending pieces.
+         *
+         * @return Number of bytes written.
+         */
+        size_t commit();
+
+        /**
+         * Compress all data written from now on into a gzip stream
+         * (a member per file). Should be called while no file is open.
+         *
+         * @param enable New flag value.
+         * @return `false` if not supported (without zlib).
+         */
+        bool setCompression(bool enable);
+
+        bool isCompressing() const { return deflater != nullptr; }
+
+        /**
+         * Make all data written so far readable from the file
+         * (`Z_SYNC_FLUSH`), if compressing. Otherwise, do nothing.
+         *
+         * @return void.
+         */
+        void flushStream();
+
+        /**
+         * Make written data durable (`fdatasync`). It can be called
+         * concurrently with `commit()`, but not with `open()` or
+         * `close()`.
+         *
+         * @return 0 on success.
+         */
+        int sync();
+
+#if defined(__linux__) || defined(__APPLE__)
+        // Pending pieces, to be written by others (io_uring).
+        // They should not be changed until `completeWrite()`.
+        int getFd() const { return fd; }
+        const struct iovec* getPieces(size_t& num_out) const {
+            // Should be compressed by `commit()`.
+            num_out = (deflater) ? 0 : numPieces;
+            return pieces.data();
+        }
+#endif
 
-        // True if dirty.
-        bool needToFlush();
+        /**
+         * Finish writing pending pieces by others. Remaining pieces
+         * (partial write) are written synchronously.
+         *
+         * @param res Number of bytes written, or negative error code.
+         */
+        void completeWrite(int64_t res);
 
-        // True if no other thread is working on it.
-        bool available();
+        // Current file size, including the data written by others.
+        // Can be read without holding the writer's lock.
+        uint64_t getOffset() const { return offset.load(MOR); }
 
-        int write(size_t _len, char* msg);
-        int flush(std::ofstream& fs);
+        // Size of the staging area.
+        static const size_t STAGING_SIZE = 64 * 1024;
 
-        size_t len;
-        char ctx[MSG_SIZE];
-        std::atomic<Status> status;
+    private:
+#if defined(__linux__) || defined(__APPLE__)
+        typedef struct iovec Piece;
+        int fd;
+#else
+        struct Piece {
+            void* iov_base;
+            size_t iov_len;
+        };
+        FILE* fp;
+#endif
+        void skipWritten(size_t len);
+
+        // Write all data to the current file, and update `offset`.
+        void writeAll(const char* data, size_t len);
+
+        // Compress pending pieces with the given zlib flush mode,
+        // and write the output.
+        void deflatePieces(int mode);
+
+        // Compression state, defined in the source file.
+        struct Deflater;
+        std::unique_ptr<Deflater> deflater;
+
+        std::vector<Piece> pieces;
+        size_t numPieces;
+        size_t maxPieces;
+        std::vector<char> staging;
+        size_t stagingLen;
+        std::atomic<uint64_t> offset;
+        bool failed;
+    };
+
+    // Header of a log record whose formatting is deferred to the
+    // flusher. A copy of the format string (null-terminated) and
+    // captured arguments follow this struct.
+    struct DeferredMeta {
+        uint32_t formatLen;
+        const char* sourceFile;
+        const char* funcName;
+        size_t lineNumber;
+        int64_t timeRaw;
+        uint32_t tidHash;
+        int tidDigits;
+        int level;
     };
 
 public:
+    /**
+     * Create a logger.
+     *
+     * @param file_path Path of the log file.
+     * @param max_log_elems Size of the log buffer, in the number of logs.
+     *        The buffer occupies `max_log_elems * 256` bytes, and a single
+     *        log can be up to half of the buffer.
+     * @param log_file_size_limit Create a new log file if the current
+     *        one exceeds this limit.
+     * @param max_log_files Maximum number of log files to keep.
+     * @param backpressure_policy What to do when the buffer is full.
+     */
     SimpleLogger(const std::string& file_path,
                  size_t max_log_elems           = 4096,
                  uint64_t log_file_size_limit   = 32*1024*1024,
-                 uint32_t max_log_files         = 16);
+                 uint32_t max_log_files         = 16,
+                 BackpressurePolicy backpressure_policy = FLUSH_INLINE);
     ~SimpleLogger();
 
     static void setCriticalInfo(const std::string& info_str);
@@ -279,17 +1145,306 @@ public:
 
     void setLogLevel(int level);
     void setDispLevel(int level);
+
+    /**
+     * Set the maximum number of rotated log files of this logger.
+     * Exceeding files are removed by the background flusher.
+     *
+     * @param max_log_files Number of files. Zero means no limit,
+     *                      the same as the constructor.
+     * @return void.
+     */
     void setMaxLogFiles(size_t max_log_files);
 
+    /**
+     * Set the retention budget of rotated log files of this logger.
+     * Exceeding files are removed by the background flusher.
+     * `maxFiles` is the same as `setMaxLogFiles()`: zero means no limit.
+     *
+     * @param policy New budget.
+     * @return void.
+     */
+    void setRetentionPolicy(const RetentionPolicy& policy);
+
+    RetentionPolicy getRetentionPolicy() const;
+
+    /**
+     * Set the compression format of rotated log files.
+     * The default is `GZIP` if built with zlib, otherwise `TAR_GZ`.
+     *
+     * @param format New format.
+     * @return `true` if the format is supported and set.
+     */
+    bool setCompressionFormat(CompressionFormat format);
+
+    inline CompressionFormat getCompressionFormat() const {
+        return compFormat.load(MOR);
+    }
+
+    /**
+     * Set how often the dictionary of `ZLIB_DICT` format is retrained.
+     * A new dictionary is trained from the file being compressed, and
+     * used for the given number of files. The default is 16.
+     *
+     * Note that deflate refers to the dictionary only within its 32 KB
+     * window, so it helps small files the most.
+     *
+     * @param num_files Number of files compressed by each dictionary.
+     * @return void.
+     */
+    void setDictRetrainInterval(size_t num_files);
+
+    /**
+     * Train a compression dictionary (up to 32 KB) from the fragments
+     * repeated in a log file: headers, source locations, and format
+     * strings.
+     *
+     * @param src_path Log file.
+     * @param[out] dict_out Trained dictionary.
+     * @return 0 on success.
+     */
+    static int trainDictionary(const std::string& src_path,
+                               std::string& dict_out);
+
+    /**
+     * Compress a file into a gzip file.
+     *
+     * @param src_path File to compress.
+     * @param dst_path Output file.
+     * @return 0 on success.
+     */
+    static int gzipFile(const std::string& src_path,
+                        const std::string& dst_path);
+
+    /**
+     * Compress a file into a zlib stream with a preset dictionary.
+     *
+     * @param src_path File to compress.
+     * @param dst_path Output file.
+     * @param dict Dictionary.
+     * @return 0 on success.
+     */
+    static int compressWithDictionary(const std::string& src_path,
+                                      const std::string& dst_path,
+                                      const std::string& dict);
+
+    /**
+     * Decompress a rotated log file (`.gz` or `.zz`). The dictionary
+     * of `.zz` file is found next to it (`file.K.zdict`, the latest one
+     * up to its number), unless it is given.
+     *
+     * @param src_path Compressed file.
+     * @param dst_path Output file.
+     * @param dict_path Dictionary file, optional.
+     * @return 0 on success.
+     */
+    static int decompressFile(const std::string& src_path,
+                              const std::string& dst_path,
+                              const std::string& dict_path = std::string());
+
+    /**
+     * Enable or disable compress-on-write. If enabled, the log file
+     * is written as a gzip stream (`file.gz`), and all logs written
+     * by each flush are readable (e.g., `zcat`) even before rotation.
+     * Rotated files are not compressed again, and the file size limit
+     * applies to the compressed size.
+     *
+     * On restart, a new gzip member is appended to the last file. If
+     * its stream was not finished (e.g., by a crash), it is finished
+     * at its last complete block first.
+     *
+     * Should be called before `start()`. Needs zlib
+     * (`SIMPLELOGGER_WITH_ZLIB`). The default is `false`.
+     *
+     * @param enable New flag value.
+     * @return `true` if the mode is set.
+     */
+    bool setCompressOnWrite(bool enable);
+
+    inline bool isCompressOnWrite() const { return sink.isCompressing(); }
+
+    /**
+     * Enable or disable deferred formatting.
+     * If enabled, `put()` only captures the format string and its
+     * arguments (strings are deep-copied), and the actual formatting
+     * is done by the background flusher. Logs to be displayed on
+     * the terminal are still formatted immediately.
+     *
+     * Only logs by `_log_*` macros are deferred, as the source file
+     * and function name are kept as pointers (the format is copied).
+     * Others, e.g., `put()` called directly, are formatted immediately.
+     * The default is `false`.
+     *
+     * @param enable New flag value.
+     * @return void.
+     */
+    void setDeferredFormat(bool enable);
+
+    inline bool isDeferredFormat() const { return deferredFormat.load(MOR); }
+
+    /**
+     * Enable or disable per-thread log buffers.
+     * If enabled, each thread gets its own single-producer buffer on
+     * its first log, so that threads do not contend on the shared
+     * buffer. The flusher merges logs from all buffers in timestamp
+     * order. Buffers of exited threads are returned to a pool,
+     * and reused by new threads.
+     * The default is `false`.
+     *
+     * @param enable New flag value.
+     * @param max_log_elems_per_thread Size of each per-thread buffer,
+     *        in the number of logs.
+     * @return void.
+     */
+    void setPerThreadBuffer(bool enable,
+                            size_t max_log_elems_per_thread = 512);
+
+    inline bool isPerThreadBuffer() const { return perThreadBuffer.load(MOR); }
+
+    /**
+     * Set the clock source for timestamps of logs.
+     * The default is `SYSTEM_CLOCK`.
+     *
+     * @param src New clock source.
+     * @return void.
+     */
+    void setClockSource(ClockSource src);
+
+    inline ClockSource getClockSource() const { return clockSource.load(MOR); }
+
+    /**
+     * Get the current time using the given clock source.
+     */
+    static std::chrono::system_clock::time_point getCurrentTime(ClockSource src);
+
+    /**
+     * Get the current time using the clock source of the given logger.
+     * If `logger` is `nullptr`, system clock will be used.
+     */
+    static inline std::chrono::system_clock::time_point
+        getCurrentTime(const SimpleLogger* logger)
+    {
+        if (!logger || logger->getClockSource() == SYSTEM_CLOCK) {
+            return std::chrono::system_clock::now();
+        }
+        return getCurrentTime(logger->getClockSource());
+    }
+
     inline int getLogLevel()  const { return curLogLevel.load(MOR); }
     inline int getDispLevel() const { return curDispLevel.load(MOR); }
 
+    inline BackpressurePolicy getBackpressurePolicy() const { return bpPolicy; }
+
+    /**
+     * Set the durability mode of the log file.
+     * The default is `NO_SYNC`.
+     *
+     * @param mode New durability mode.
+     * @param sync_level For `SYNC_ON_LEVEL`: logs at this level or more
+     *        important ones (e.g., `FATAL` and `ERROR`) are synced.
+     * @param sync_interval_ms For `PERIODIC_SYNC`: sync interval.
+     *        The background flusher wakes up every 500 ms, so that
+     *        a shorter interval is the same as 500 ms.
+     * @return void.
+     */
+    void setDurability(Durability mode,
+                       int sync_level = ERROR,
+                       uint64_t sync_interval_ms = 1000);
+
+    inline Durability getDurability() const { return durability.load(MOR); }
+
+    /**
+     * Block until all logs put before this call are written to the
+     * log file (`WRITTEN`), or synced to disk (`DURABLE`).
+     * Concurrent callers are group-committed: one of them flushes and
+     * syncs on behalf of all the others.
+     *
+     * @param level What to wait for.
+     * @return void.
+     */
+    void flushBarrier(BarrierLevel level = DURABLE);
+
+    /**
+     * Get the number of syncs (`fdatasync`) so far.
+     *
+     * @return Number of syncs.
+     */
+    uint64_t getNumSyncs() const { return numSyncs.load(MOR); }
+
+    /**
+     * Get the number of rotations whose next file was not prepared
+     * in advance, so that it was opened by the flusher itself.
+     *
+     * @return Number of rotations without a prepared file.
+     */
+    uint64_t getNumSlowRotations() const { return numSlowRotations.load(MOR); }
+
+    /**
+     * Get the statistics of what happened when the buffer was full.
+     *
+     * @return Statistics.
+     */
+    BackpressureStats getBackpressureStats() const;
+
     void put(int level,
              const char* source_file,
              const char* func_name,
              size_t line_number,
              const char* format,
              ...);
+
+    /**
+     * Same as `put()`, but with `{}`-style format string.
+     * Use `_log_fmt_` macros, which check the format string
+     * and give `NUM_PLACEHOLDERS` at compile time.
+     */
+    template<int NUM_PLACEHOLDERS, typename... Args>
+    void putFmt(int level,
+                const char* source_file,
+                const char* func_name,
+                size_t line_number,
+                const char* format,
+                const Args&... args)
+    {
+        static_assert( NUM_PLACEHOLDERS >= 0,
+                       "invalid format string: unmatched '{' or '}'" );
+        static_assert( NUM_PLACEHOLDERS == (int)sizeof...(Args),
+                       "the number of '{}' does not match "
+                       "the number of arguments" );
+        Fmt::Context<Args...> ctx(format, args...);
+        putWith( level, source_file, func_name, line_number,
+                 &Fmt::Context<Args...>::write, &ctx );
+    }
+
+    // Write a log message in the same way as `snprintf`.
+    typedef size_t (*MsgWriter)(char* out, size_t out_size, const void* ctx);
+
+    /**
+     * Same as `put()`, but `writer(out, out_size, ctx)` writes the log
+     * message. It is called once, and once more only if the message
+     * does not fit in `MSG_SIZE`. The console log reuses the result.
+     */
+    void putWith(int level,
+                 const char* source_file,
+                 const char* func_name,
+                 size_t line_number,
+                 MsgWriter writer,
+                 const void* ctx);
+
+    /**
+     * Same as `put()`, but the given bytes are used as the log message
+     * as they are, instead of a format string.
+     *
+     * @param data Log message, does not need to be null-terminated.
+     * @param len Length of the log message.
+     * @return void.
+     */
+    void putRaw(int level,
+                const char* source_file,
+                const char* func_name,
+                size_t line_number,
+                const char* data,
+                size_t len);
     void flushAll();
 
 private:
@@ -301,18 +1456,196 @@ private:
                                   size_t& max_revnum,
                                   std::string& f_name);
     std::string getLogFilePath(size_t file_num) const;
+    // Path of the file being written, `.gz` in compress-on-write mode.
+    std::string getActiveFilePath(size_t file_num) const;
+    // In compress-on-write mode, continue the last file of the previous
+    // run, instead of starting a new one.
+    void resumeCompressedFile();
+    // Finish the last gzip member of the file, if it was not finished.
+    // Returns 0 if the file is a complete gzip file.
+    static int finishGzipStream(const std::string& path);
+
+    // Check the log level, and clear `FORCED_LEVEL` flag in `level`.
+    inline bool checkLevel(int& level) const {
+        if (level & FORCED_LEVEL) {
+            level &= ~FORCED_LEVEL;
+            return true;
+        }
+        return level <= curLogLevel.load(MOR);
+    }
     void execCmd(const std::string& cmd);
     void doCompression(size_t file_num);
-    bool flush(size_t start_pos);
+    // Dictionary for `file_num`, trained from it if it is time to do.
+    // Empty if not available.
+    std::string getDictionary(size_t file_num);
+    // Compress a range of `src_path` into a gzip member, written to `dst_path`.
+    static int gzipBlock(const std::string& src_path,
+                         uint64_t offset,
+                         uint64_t len,
+                         const std::string& dst_path);
+    // A rotated file compressed in blocks, by multiple compressor threads.
+    struct CompSplit;
+    void compressBlock(const std::shared_ptr<CompSplit>& split,
+                       size_t block_idx);
+    // Register `file_num` for the retention, and finish its
+    // compression job.
+    void finishCompression(size_t file_num);
+    // Add a rotated file of any format to `archivedFiles`.
+    // Should hold `retentionLock`.
+    void addArchivedFile(size_t file_num);
+    // Remove the oldest one from `archivedFiles`, and append the files
+    // to be removed to `paths_out`. Should hold `retentionLock`.
+    void popArchivedFile(std::vector<std::string>& paths_out);
+    // Pop files exceeding the budget of this logger.
+    void collectExpiredFiles(int64_t now_sec,
+                             std::vector<std::string>& paths_out);
+    // By the background flusher: close the previous file, and open
+    // the next one before the rotation.
+    void prepareNextSegment();
+    void closeRetiredSegments();
+    void discardNextSegment();
+    // Switch to the next file. Should hold `flushingLogs`.
+    void rotate();
+    template<typename UserMsgFunc>
+    void putInternal(int level,
+                     const char* source_file,
+                     const char* func_name,
+                     size_t line_number,
+                     std::chrono::system_clock::time_point now,
+                     UserMsgFunc user_msg);
+    LogRing* getThreadRing();
+    void writeRecord(LogRing* dst,
+                     LogRing::RecordType type,
+                     int64_t time_raw,
+                     const char* data,
+                     size_t len);
+    size_t renderDeferred(const char* blob,
+                          char* msg,
+                          size_t msg_size,
+                          size_t& full_len_out);
+    bool discardOldest(LogRing* dst);
+    void requestFlush();
+    void flushRecord(const LogRing::Record& rec, size_t max_len);
+    void recycleThreadRings(const std::vector< std::shared_ptr<LogRing> >& rings);
+
+    // Logs are written in batches, each of which fits in a single
+    // write of `sink`. Records of a batch are consumed once they are
+    // written. Should hold `flushingLogs`.
+    struct FlushBatch {
+        FlushBatch() : numRecords(0) {}
+        // Rings to drain, and the next record to read of each.
+        std::vector<LogRing*> srcs;
+        std::vector<uint32_t> seqs;
+        // Records reserved after `beginFlush()` are left to the next
+        // pass, so that a pass ends (and rotates) under sustained load.
+        std::vector<uint32_t> endSeqs;
+        // Per-thread rings in `srcs`, and exited threads' ones among them.
+        std::vector< std::shared_ptr<LogRing> > rings;
+        std::vector< std::shared_ptr<LogRing> > retiredRings;
+        size_t numRecords;
+    };
+    void beginFlush(FlushBatch& batch);
+    // Returns the number of records added to `sink`.
+    size_t fillBatch(FlushBatch& batch);
+    // Consume the records of the batch, once they are written.
+    void releaseBatch(FlushBatch& batch);
+    void endFlush(FlushBatch& batch);
+    // If `wait` is `true`, wait for the other flusher instead of
+    // returning `false`. If `drain` is `true`, wait for the records
+    // reserved before the flush to be published, and write them all.
+    bool flush(bool wait = false, bool drain = false);
+    // Sync the log file, if something has been written since the last
+    // sync, and at least `min_interval_ms` has passed.
+    void syncFile(uint64_t min_interval_ms = 0);
+    // For `SYNC_ON_LEVEL`.
+    inline void syncOnLevel(int level) {
+        if ( durability.load(MOR) == SYNC_ON_LEVEL &&
+             level <= syncLevel.load(MOR) ) {
+            flushBarrier(DURABLE);
+        }
+    }
 
     std::string filePath;
     size_t minRevnum;
-    size_t curRevnum;
+    // Read by the background flusher.
+    std::atomic<size_t> curRevnum;
     std::atomic<size_t> maxLogFiles;
-    std::ofstream fs;
+    FileSink sink;
 
     uint64_t maxLogFileSize;
+    std::atomic<CompressionFormat> compFormat;
     std::atomic<uint32_t> numCompJobs;
+    std::atomic<uint32_t> numCompJobWaiters;
+    // Compression jobs of this logger can run in parallel.
+    // Protects `minRevnum` and `archivedFiles`.
+    std::mutex retentionLock;
+
+    // === Retention, without scanning the directory.
+    // A rotated (and compressed) file.
+    struct ArchivedFile {
+        size_t revnum;
+        std::string path;
+        uint64_t size;
+        // Last modification time, in seconds since epoch.
+        int64_t mtime;
+    };
+    // Ordered by `revnum`.
+    std::deque<ArchivedFile> archivedFiles;
+    uint64_t archivedBytes;
+    std::atomic<uint64_t> maxTotalBytes;
+    std::atomic<uint64_t> maxAgeSec;
+
+    // === Dictionary of `ZLIB_DICT` format.
+    std::mutex dictLock;
+    std::string dict;
+    // Number of the file that `dict` was trained from.
+    size_t dictRevnum;
+    // Numbers of all dictionary files, to remove unused ones.
+    std::set<size_t> dictRevnums;
+    std::atomic<size_t> dictRetrainInterval;
+
+    // === Rotation, without opening or closing files in `flush()`.
+    // Next file, opened and preallocated by the background thread.
+    std::mutex nextSegmentLock;
+    FileSink::Handle nextSegment;
+    size_t nextSegmentRevnum;
+    uint64_t nextSegmentSize;
+    // Previous files, to be synced and closed by the background thread.
+    // `rotate()` only queues them, and `syncFile()` also closes them.
+    struct RetiredSegment {
+        FileSink::Handle handle;
+        uint64_t trimSize;
+    };
+    std::mutex retiredSegmentLock;
+    std::deque<RetiredSegment> retiredSegments;
+    // Held while closing, so that `syncFile()` returns after all
+    // retired files are synced.
+    std::mutex retiredCloseLock;
+    std::atomic<uint64_t> numSlowRotations;
+
+    std::mutex displayLock;
+
+    // Capacity of a per-thread buffer, in bytes.
+    std::atomic<size_t> threadRingCapacity;
+
+    // Per-thread buffers, including ones of exited threads
+    // that are not drained yet.
+    std::vector< std::shared_ptr<LogRing> > threadRings;
+
+    // Drained buffers of exited threads, to be reused.
+    std::vector< std::shared_ptr<LogRing> > freeThreadRings;
+
+    // Size of `threadRings`, to check it without lock.
+    std::atomic<size_t> numThreadRings;
+
+    // Lock for `threadRings` and `freeThreadRings`.
+    std::mutex threadRingsLock;
+
+    // Members below are grouped by access pattern,
+    // and each group is on its own cache line(s).
+    char padding0[CACHE_LINE_SIZE];
+
+    // === Read by every `put()`, rarely updated.
 
     // Log up to `curLogLevel`, default: 6.
     // Disable: -1.
@@ -323,16 +1656,161 @@ private:
     // Disable: -1.
     std::atomic<int> curDispLevel;
 
-    std::mutex displayLock;
+    // If `true`, formatting is done by the background flusher.
+    std::atomic<bool> deferredFormat;
+
+    // If `true`, each thread writes logs into its own buffer.
+    std::atomic<bool> perThreadBuffer;
+
+    std::atomic<ClockSource> clockSource;
 
     int tzGap;
-    std::atomic<uint64_t> cursor;
-    std::vector<LogElem> logs;
+
+    // Unique ID of this logger, as the address can be reused.
+    uint64_t loggerId;
+
+    const BackpressurePolicy bpPolicy;
+
+    // `true` while the background flusher drains the buffer,
+    // i.e., between `addLogger()` and `removeLogger()`.
+    std::atomic<bool> registered;
+
+    char padding1[CACHE_LINE_SIZE];
+
+    // === Updated by every flush.
+
     std::mutex flushingLogs;
+
+    // `true` if the background flusher was invoked,
+    // and this logger has not been flushed after that.
+    std::atomic<bool> flushRequested;
+
+    char padding2[CACHE_LINE_SIZE];
+
+    // === Updated when the buffer is full.
+
+    // Backpressure statistics.
+    std::atomic<uint64_t> numFull;
+    std::atomic<uint64_t> numDropped;
+    std::atomic<uint64_t> numInlineFlushes;
+
+    char padding3[CACHE_LINE_SIZE];
+
+    // === Durability.
+
+    std::atomic<Durability> durability;
+    std::atomic<int> syncLevel;
+    std::atomic<uint64_t> syncIntervalMs;
+
+    // Group commit of `flushBarrier()` callers. The first caller
+    // becomes the leader, who flushes and syncs for all the callers
+    // whose ticket is up to `barrierTicket` at the time it starts.
+    std::mutex barrierLock;
+    std::condition_variable barrierCv;
+    uint64_t barrierTicket;
+    uint64_t writtenTicket;
+    uint64_t durableTicket;
+    bool barrierLeaderActive;
+    // A caller waiting for `DURABLE` since the last leader started.
+    bool barrierSyncRequested;
+
+    // Held while syncing, and while opening or closing the log file,
+    // so that sync does not block writes.
+    std::mutex syncLock;
+    // File offset synced so far, and when, protected by `syncLock`.
+    uint64_t syncedOffset;
+    std::chrono::steady_clock::time_point lastSyncTime;
+    std::atomic<uint64_t> numSyncs;
+
+    // Has its own padding inside.
+    LogRing ring;
 };
 
+// Log callsite, registered to `SimpleLoggerMgr` on the first hit.
+// Should be a static variable, see `_SL_CALLSITE_CHECK`.
+struct SimpleLoggerCallsite {
+    enum State {
+        UNREGISTERED    = 0,
+        // Follow the log level of the logger.
+        FOLLOW_LEVEL    = 1,
+        // Print logs regardless of the log level of the logger.
+        FORCE_ON        = 2,
+        // Do not print any logs.
+        FORCE_OFF       = 3,
+    };
+
+    // Level to be passed to the logger, or negative number
+    // if the log should be skipped.
+    struct Result {
+        Result(int _log_level = -1) : logLevel(_log_level) {}
+        explicit operator bool() const { return logLevel >= 0; }
+        int logLevel;
+    };
+
+    // Bits of `levels`.
+    static const uint8_t ALL_LEVELS = 0x7f;
+    // Set if all loggers have the same log level, so that the bits
+    // of levels are exact and the logger's level need not be checked.
+    static const uint8_t EXACT_LEVELS = 0x80;
+
+    constexpr SimpleLoggerCallsite()
+        : levels(ALL_LEVELS), state(UNREGISTERED)
+        , file(nullptr), func(nullptr), line(0), level(0) {}
+
+    template<typename LoggerPtr>
+    static inline Result check(SimpleLoggerCallsite& cs,
+                               int level,
+                               const LoggerPtr& l,
+                               const char* file,
+                               const char* func,
+                               size_t line)
+    {
+        uint8_t cur_levels = cs.levels.load(std::memory_order_relaxed);
+        if (level >= 0 && level < 7) {
+            // Disabled callsite: one relaxed load, same as `getLogLevel()`.
+            if (_SL_LIKELY( !((cur_levels >> level) & 0x1) )) return Result();
+            // Enabled for all loggers: no more loads.
+            if (cur_levels & EXACT_LEVELS) return l ? Result(level) : Result();
+        }
+
+        uint8_t cur_state = cs.state.load(std::memory_order_relaxed);
+        if (cur_state == UNREGISTERED) {
+            cur_state = registerCallsite(cs, level, file, func, line);
+        }
+        if (!l || cur_state == FORCE_OFF) return Result();
+        if (cur_state == FORCE_ON) return Result(level | SimpleLogger::FORCED_LEVEL);
+        if (l->getLogLevel() < level) return Result();
+        return Result(level);
+    }
+
+    // Register the callsite, and return its state. If the manager
+    // does not exist yet, it follows the log level until the manager
+    // adopts it.
+    static uint8_t registerCallsite(SimpleLoggerCallsite& cs,
+                                    int level,
+                                    const char* file,
+                                    const char* func,
+                                    size_t line);
+
+    // Bit N: level N can be enabled, and `EXACT_LEVELS`.
+    // `ALL_LEVELS` if unregistered.
+    std::atomic<uint8_t> levels;
+
+    // `State`.
+    std::atomic<uint8_t> state;
+
+    // Set on registration.
+    const char* file;
+    const char* func;
+    size_t line;
+    int level;
+};
+
+
 // Singleton class
 class SimpleLoggerMgr {
+    friend class SimpleLogger;
+    friend struct SimpleLoggerCallsite;
 public:
     struct CompElem;
 
@@ -349,6 +1827,29 @@ public:
         int usec;
     };
 
+    // Calendar fields and rendered `YYYY-MM-DDTHH:MM:SS` and `+HH:MM`
+    // parts of the current second, shared by file and console logs.
+    // They are refreshed only when the second rolls over (or timezone
+    // gap changes), so that `localtime_r` is not called for every log.
+    struct TimeCache {
+        static const size_t TIMESTAMP_LEN = 33;
+
+        TimeCache();
+
+        // Update the cache for the given time.
+        void update(std::chrono::system_clock::time_point now, int tz_gap);
+
+        // Write `YYYY-MM-DDTHH:MM:SS.mmm_uuu+HH:MM` into `buf`,
+        // returns the length (`TIMESTAMP_LEN`).
+        size_t write(char* buf) const;
+
+        int64_t curSec;
+        int tzGap;
+        TimeInfo lt;
+        char dateTime[19];
+        char tzStr[6];
+    };
+
     struct RawStackInfo {
         RawStackInfo() : tidHash(0), kernelTid(0), crashOrigin(false) {}
         uint32_t tidHash;
@@ -367,27 +1868,214 @@ public:
 #if defined(__linux__) || defined(__APPLE__)
     static void handleStackTrace(int sig, siginfo_t* info, void* secret);
 #endif
-    static void flushWorker();
-    static void compressWorker();
+    // Workers take the instance being created, as `get()` would wait
+    // for `instanceLock` held by `init()` (or by a quick `destroy()`).
+    static void flushWorker(SimpleLoggerMgr* mgr);
+    static void compressWorker(SimpleLoggerMgr* mgr, size_t idx);
+    static void consoleWorker(SimpleLoggerMgr* mgr);
+
+    /**
+     * Write a console log, given as three pieces so that the user
+     * message rendered for the log file can be used as it is.
+     * It is queued and written by the background console writer,
+     * or written directly if `mgr` is `nullptr`.
+     * If the queue is full, the log is dropped.
+     *
+     * @param mgr Manager instance, can be `nullptr`.
+     * @param header Header line and color code.
+     * @param header_len Length of `header`.
+     * @param msg User message.
+     * @param msg_len Length of `msg`.
+     * @param tail Color end code and newline.
+     * @param tail_len Length of `tail`.
+     * @return void.
+     */
+    static void writeConsole(SimpleLoggerMgr* mgr,
+                             const char* header,
+                             size_t header_len,
+                             const char* msg,
+                             size_t msg_len,
+                             const char* tail,
+                             size_t tail_len);
+
+    /**
+     * Re-calibrate TSC clock against wall time. The background
+     * flusher calls it periodically once any logger uses TSC clock.
+     * It slews the clock to follow the wall time, so that the clock
+     * never goes backward. If the wall time itself jumps (more than
+     * 1 second), it steps the clock, and then the clock follows the
+     * new wall time even if it is backward.
+     *
+     * @param wall_ns Wall time to calibrate against, in nanoseconds since
+     *                epoch. If 0, the current system clock is used.
+     * @return void.
+     */
+    static void calibrateTscClock(int64_t wall_ns = 0);
 
     void logStackBacktrace(size_t timeout_ms = 60*1000);
     void flushCriticalInfo();
     void enableOnlyOneDisplayer();
     void flushAllLoggers() { flushAllLoggers(0, std::string()); }
     void flushAllLoggers(int level, const std::string& msg);
+
+    /**
+     * Same as `flushAllLoggers()`, but writes of all loggers are
+     * submitted at once by io_uring, if it is enabled.
+     * Used by the background flusher.
+     */
+    void flushAllLoggersAsync();
+
+    /**
+     * Sync the log files of `PERIODIC_SYNC` loggers, if their sync
+     * interval has passed. Used by the background flusher.
+     */
+    void syncAllLoggers();
+
+    /**
+     * Close the previous log files of rotated loggers, and open
+     * (and preallocate) their next log files in advance.
+     * Used by the background flusher.
+     */
+    void prepareAllSegments();
+
+    /**
+     * Remove rotated files exceeding the retention budget of each
+     * logger, and then the global budget, oldest first. Files are
+     * removed in batches (`unlinkat`), tracked in memory without
+     * scanning directories. Used by the background flusher.
+     *
+     * @return Number of removed files.
+     */
+    size_t enforceRetention();
+
+    /**
+     * Set the retention budget of rotated files of all loggers
+     * together, on top of the budget of each logger. The oldest files
+     * of any logger are removed first. The default is no limit.
+     *
+     * @param policy New budget.
+     * @return void.
+     */
+    void setGlobalRetentionPolicy(const SimpleLogger::RetentionPolicy& policy);
+
+    /**
+     * Let the background flusher write log files by io_uring (Linux).
+     * It falls back to the synchronous writes if io_uring is not
+     * available (e.g., old kernel or blocked by seccomp).
+     *
+     * @param enable `true` to use io_uring.
+     * @return `true` if io_uring is being used.
+     */
+    bool setIoUring(bool enable);
+
+    /**
+     * Check if the background flusher uses io_uring.
+     *
+     * @return `true` if io_uring is being used.
+     */
+    bool isIoUringEnabled();
+
+    /**
+     * Get the number of writes done by io_uring so far.
+     *
+     * @return Number of writes.
+     */
+    uint64_t getNumIoUringWrites() const { return numIoUringWrites.load(); }
+
+    /**
+     * Set the number of background compressor threads, shared by all
+     * loggers. With more than one thread, a large rotated file is split
+     * into blocks compressed in parallel (`GZIP` only).
+     * The default is one thread.
+     *
+     * @param num_threads Number of threads, at least one, and at most
+     *        the number of cores.
+     * @param nice_level Nice value of the threads (Linux only), from
+     *        0 (same as the application) to 19 (lowest priority).
+     * @return Number of threads.
+     */
+    size_t setCompressorPool(size_t num_threads, int nice_level = 0);
+
+    size_t getNumCompressors() const { return numCompressors.load(); }
     void addLogger(SimpleLogger* logger);
     void removeLogger(SimpleLogger* logger);
     void addThread(uint64_t tid);
     void removeThread(uint64_t tid);
     void addCompElem(SimpleLoggerMgr::CompElem* elem);
     void sleepFlusher(size_t ms);
-    void sleepCompressor(size_t ms);
+    void invokeFlusher();
     bool chkTermination() const;
     void setCriticalInfo(const std::string& info_str);
     void setCrashDumpPath(const std::string& path,
                           bool origin_only);
     void setStackTraceOriginOnly(bool origin_only);
 
+    /**
+     * Write all queued console logs to stdout.
+     *
+     * @return Number of console logs written.
+     */
+    size_t flushConsole();
+
+    /**
+     * Check if console logs are colored. They are colored only when
+     * stdout is a terminal.
+     *
+     * @return `true` if colored.
+     */
+    bool isConsoleColor() const { return consoleColor; }
+
+    /**
+     * Get the number of console logs dropped so far, as the console
+     * could not keep up.
+     *
+     * @return Number of dropped console logs.
+     */
+    uint64_t getNumConsoleDropped() const { return numConsoleDropped.load(); }
+
+    /**
+     * Force enable the log callsites (`_log_*`, `_log_fmt_*`, `_s_*`)
+     * matching the given glob patterns (`*` and `?`). They print logs
+     * regardless of the log level of the logger, e.g., to see TRACE
+     * logs of a single file. Later calls of `enableCallsites` and
+     * `disableCallsites` take precedence, and they also apply to
+     * the callsites hit for the first time later.
+     *
+     * @param file_pattern Pattern for the source file. If it does not
+     *                     contain `/`, only the file name is matched.
+     * @param func_pattern Pattern for the function name.
+     * @return Number of registered callsites matched.
+     */
+    size_t enableCallsites(const std::string& file_pattern,
+                           const std::string& func_pattern = "*");
+
+    /**
+     * Force disable the log callsites matching the given glob patterns.
+     * See `enableCallsites`.
+     *
+     * @param file_pattern Pattern for the source file.
+     * @param func_pattern Pattern for the function name.
+     * @return Number of registered callsites matched.
+     */
+    size_t disableCallsites(const std::string& file_pattern,
+                            const std::string& func_pattern = "*");
+
+    /**
+     * Clear all `enableCallsites` and `disableCallsites` settings,
+     * so that all callsites follow the log level again.
+     *
+     * @return void.
+     */
+    void resetCallsites();
+
+    /**
+     * Get the number of callsites hit so far.
+     *
+     * @return Number of registered callsites.
+     */
+    size_t getNumCallsites();
+
+
     /**
      * Set the flag regarding exiting on crash.
      * If flag is `true`, custom segfault handler will not invoke
@@ -432,28 +2120,120 @@ private:
     std::mutex loggersLock;
     std::unordered_set<SimpleLogger*> loggers;
 
+    // Budget of all loggers, by `setGlobalRetentionPolicy()`.
+    std::mutex globalRetentionLock;
+    SimpleLogger::RetentionPolicy globalRetention;
+
     std::mutex activeThreadsLock;
     std::unordered_set<uint64_t> activeThreads;
 
+    // Pattern set by `enableCallsites` or `disableCallsites`.
+    struct CallsiteRule {
+        std::string filePattern;
+        std::string funcPattern;
+        bool enable;
+    };
+
+    uint8_t registerCallsite(SimpleLoggerCallsite* cs,
+                             int level,
+                             const char* file,
+                             const char* func,
+                             size_t line);
+    // Apply rules and `maxLogLevel` to the callsite, and return its state.
+    // `callsitesLock` should be held.
+    uint8_t applyCallsiteRules(SimpleLoggerCallsite* cs);
+    // Take the callsites hit before this instance was created.
+    void adoptPendingCallsites();
+    size_t addCallsiteRule(const std::string& file_pattern,
+                           const std::string& func_pattern,
+                           bool enable);
+    // Set the log level of the given logger, and update callsites
+    // if `maxLogLevel` or `uniformLogLevel` is changed.
+    void setLoggerLevel(SimpleLogger* logger, int level);
+    // Add (`delta` = 1) or remove (-1) a logger for callsite levels.
+    void countLoggerLevel(SimpleLogger* logger, int delta);
+    // Re-calculate `maxLogLevel` and `uniformLogLevel` from
+    // `loggerLevels`. `callsitesLock` should be held.
+    void updateCallsiteLevels();
+
+    // Lock order: `loggersLock` -> `callsitesLock`.
+    std::mutex callsitesLock;
+    std::vector<SimpleLoggerCallsite*> callsites;
+    std::vector<CallsiteRule> callsiteRules;
+
+    // Below are protected by `callsitesLock`.
+    // Log level of each running logger.
+    std::unordered_map<SimpleLogger*, int> loggerLevels;
+    // Max log level of all loggers, 6 if there is no running logger.
+    int maxLogLevel;
+    // `true` if all loggers have the same log level, `false` if there
+    // is no running logger.
+    bool uniformLogLevel;
+
     // Periodic log flushing thread.
     std::thread tFlush;
 
-    // Old log file compression thread.
-    std::thread tCompress;
+    // Old log file compression threads, shared by all loggers.
+    std::vector<std::thread> tCompressors;
+
+    // Protects `tCompressors`.
+    std::mutex compressorsLock;
 
-    // List of files to be compressed.
+    // Number of compression threads to run, and their nice value.
+    std::atomic<size_t> numCompressors;
+    std::atomic<int> compressorNice;
+
+    // io_uring instance for the background flusher, `nullptr` if
+    // not enabled.
+    std::unique_ptr<SimpleLoggerIoUring> ioUring;
+
+    // Protects `ioUring`.
+    std::mutex ioUringLock;
+
+    std::atomic<uint64_t> numIoUringWrites;
+
+    // Console writer thread.
+    std::thread tConsole;
+
+    // Queued console logs, `nullptr` if console logs are written directly.
+    std::unique_ptr<SimpleLogger::LogRing> consoleRing;
+
+    // Only one thread can consume `consoleRing` at a time.
+    std::mutex consoleFlushLock;
+
+    // Console logs are coalesced here, protected by `consoleFlushLock`.
+    std::vector<char> consoleBatch;
+
+    // Increased when a console log is queued while the writer is waiting.
+    std::atomic<uint32_t> consoleEpoch;
+    std::atomic<uint32_t> numConsoleWaiters;
+
+    std::atomic<uint64_t> numConsoleDropped;
+
+    // Number of dropped logs notified to the console so far,
+    // protected by `consoleFlushLock`.
+    uint64_t numConsoleDroppedNotified;
+
+    // `true` if stdout is a terminal.
+    bool consoleColor;
+
+    // List of files (or blocks of them) to be compressed.
     std::list<CompElem*> pendingCompElems;
 
-    // Lock for `pendingCompFiles`.
+    // Lock for `pendingCompElems` and `cvCompressor`.
     std::mutex pendingCompElemsLock;
 
     // Condition variable for BG flusher.
     std::condition_variable cvFlusher;
     std::mutex cvFlusherLock;
 
-    // Condition variable for BG compressor.
+    // `true` if someone wants BG flusher to run now,
+    // protected by `cvFlusherLock`.
+    bool flusherInvoked;
+
+    // Condition variable for BG compressors, waiting for
+    // `pendingCompElems`.
     std::condition_variable cvCompressor;
-    std::mutex cvCompressorLock;
 
     // Termination signal.
     std::atomic<bool> termination;
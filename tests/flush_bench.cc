@@ -0,0 +1,535 @@
+#include "logger.h"
+
+#include "test_common.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// I/O stat of this process so far, e.g., `syscw:` (Linux only).
+static uint64_t get_io_stat(const std::string& name) {
+    std::ifstream fs("/proc/self/io");
+    std::string key;
+    uint64_t value = 0;
+    while (fs >> key >> value) {
+        if (key == name) return value;
+    }
+    return 0;
+}
+
+// Number of write system calls of this process so far.
+static uint64_t get_num_write_calls() {
+    return get_io_stat("syscw:");
+}
+
+// CPU time (user + system) of this process and its waited children.
+static uint64_t get_cpu_us() {
+    uint64_t us = 0;
+    struct rusage ru;
+    for (int who: {RUSAGE_SELF, RUSAGE_CHILDREN}) {
+        if (getrusage(who, &ru) != 0) continue;
+        us += ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+        us += ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+    }
+    return us;
+}
+
+static uint64_t get_file_size(const std::string& filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+int flush_bench(size_t msg_len) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Big enough buffer, and no file size limit.
+    SimpleLogger* ll = new SimpleLogger(filename, 64 * 1024, 0, 0);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+    ll->flushAll();
+
+    const size_t NUM_ROUNDS = 20;
+    const size_t NUM_PER_ROUND = 10000;
+    std::string msg(msg_len, 'x');
+    uint64_t size_begin = get_file_size(filename);
+    uint64_t num_writes_begin = get_num_write_calls();
+    uint64_t flush_us = 0;
+    for (size_t ii=0; ii<NUM_ROUNDS; ++ii) {
+        for (size_t jj=0; jj<NUM_PER_ROUND; ++jj) {
+            _log_info(ll, "%s", msg.c_str());
+        }
+        TestSuite::Timer tt;
+        ll->flushAll();
+        flush_us += tt.getTimeUs();
+    }
+    uint64_t num_writes = get_num_write_calls() - num_writes_begin;
+    uint64_t bytes = get_file_size(filename) - size_begin;
+    size_t num_records = NUM_ROUNDS * NUM_PER_ROUND;
+
+    // The background flusher may write some of them.
+    TestSuite::_msg("message %zu bytes, record %.1f bytes, "
+                    "%.4f syscalls/record, %.1f MB/s\n",
+                    msg_len, (double)bytes / num_records,
+                    (double)num_writes / num_records,
+                    (double)bytes / (flush_us ? flush_us : 1));
+
+    delete ll;
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int multi_logger_flush_bench(bool io_uring) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    bool enabled = mgr->setIoUring(io_uring);
+    if (io_uring && !enabled) {
+        TestSuite::_msg("io_uring is not available\n");
+    }
+
+    const size_t NUM_LOGGERS = 8;
+    std::vector<std::string> filenames(NUM_LOGGERS);
+    std::vector<SimpleLogger*> loggers(NUM_LOGGERS);
+    for (size_t ii=0; ii<NUM_LOGGERS; ++ii) {
+        filenames[ii] = TestSuite::getTestFileName(prefix) +
+                        "_" + std::to_string(ii) + ".log";
+        loggers[ii] = new SimpleLogger(filenames[ii], 16 * 1024, 0, 0);
+        loggers[ii]->start();
+        loggers[ii]->setLogLevel(SimpleLogger::INFO);
+        loggers[ii]->setDispLevel(-1);
+    }
+    mgr->flushAllLoggersAsync();
+
+    const size_t NUM_ROUNDS = 20;
+    const size_t NUM_PER_ROUND = 2000;
+    std::string msg(128, 'x');
+    uint64_t size_begin = 0;
+    for (const std::string& filename: filenames) {
+        size_begin += get_file_size(filename);
+    }
+    uint64_t num_writes_begin = get_num_write_calls();
+    uint64_t num_async_begin = mgr->getNumIoUringWrites();
+    uint64_t flush_us = 0;
+    for (size_t ii=0; ii<NUM_ROUNDS; ++ii) {
+        for (size_t jj=0; jj<NUM_PER_ROUND; ++jj) {
+            for (SimpleLogger* ll: loggers) {
+                _log_info(ll, "%s", msg.c_str());
+            }
+        }
+        // Same as what the background flusher does.
+        TestSuite::Timer tt;
+        mgr->flushAllLoggersAsync();
+        flush_us += tt.getTimeUs();
+    }
+    uint64_t num_writes = get_num_write_calls() - num_writes_begin;
+    uint64_t num_async = mgr->getNumIoUringWrites() - num_async_begin;
+    uint64_t bytes = 0;
+    for (const std::string& filename: filenames) {
+        bytes += get_file_size(filename);
+    }
+    bytes -= size_begin;
+    size_t num_records = NUM_ROUNDS * NUM_PER_ROUND * NUM_LOGGERS;
+
+    TestSuite::_msg("%zu loggers, io_uring %s, %.4f write syscalls/record, "
+                    "%.4f io_uring writes/record, %.1f MB/s\n",
+                    NUM_LOGGERS, enabled ? "on" : "off",
+                    (double)num_writes / num_records,
+                    (double)num_async / num_records,
+                    (double)bytes / (flush_us ? flush_us : 1));
+
+    for (SimpleLogger* ll: loggers) delete ll;
+    mgr->setIoUring(false);
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int rotation_stall_bench(size_t num_threads) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Small buffer, so that producers flush (and rotate) by themselves.
+    const uint64_t FILE_SIZE = 4 * 1024 * 1024;
+    SimpleLogger* ll = new SimpleLogger(filename, 256, FILE_SIZE, 0);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+
+    // About one file per round. Between rounds, let the background
+    // threads finish their jobs (compression), so that the stalls are
+    // not from sharing CPU with them.
+    const size_t NUM_ROUNDS = 20;
+    const size_t LINE_LEN = 180;
+    const size_t NUM_PER_ROUND = FILE_SIZE / LINE_LEN / num_threads;
+    std::vector<uint64_t> round_max_us(NUM_ROUNDS, 0);
+    std::vector<uint64_t> max_us(num_threads);
+    for (size_t rr=0; rr<NUM_ROUNDS; ++rr) {
+        TestSuite::sleep_ms(200);
+        std::vector<std::thread> threads(num_threads);
+        for (size_t ii=0; ii<num_threads; ++ii) {
+            max_us[ii] = 0;
+            threads[ii] = std::thread([&, ii]() {
+                std::string payload(100, 'x');
+                for (size_t jj=0; jj<NUM_PER_ROUND; ++jj) {
+                    std::chrono::steady_clock::time_point start =
+                        std::chrono::steady_clock::now();
+                    _log_info(ll, "%zu %s", jj, payload.c_str());
+                    uint64_t us = std::chrono::duration_cast
+                                  < std::chrono::microseconds >
+                                  ( std::chrono::steady_clock::now() - start )
+                                  .count();
+                    max_us[ii] = std::max(max_us[ii], us);
+                }
+            });
+        }
+        for (size_t ii=0; ii<num_threads; ++ii) {
+            threads[ii].join();
+            round_max_us[rr] = std::max(round_max_us[rr], max_us[ii]);
+        }
+    }
+    uint64_t num_slow = ll->getNumSlowRotations();
+    delete ll;
+
+    size_t num_files = 1;
+    while ( TestSuite::exist(filename + "." + std::to_string(num_files)) ||
+            TestSuite::exist(filename + "." + std::to_string(num_files) +
+                             ".tar.gz") ||
+            TestSuite::exist(filename + "." + std::to_string(num_files) +
+                             ".gz") ) {
+        num_files++;
+    }
+
+    // Longest stall of each round, which includes a rotation.
+    std::sort(round_max_us.begin(), round_max_us.end());
+    TestSuite::_msg("%zu threads, %zu rotations (%zu slow), longest stall "
+                    "per round: median %zu us, max %zu us\n",
+                    num_threads,
+                    num_files - 1,
+                    (size_t)num_slow,
+                    (size_t)round_max_us[NUM_ROUNDS / 2],
+                    (size_t)round_max_us[NUM_ROUNDS - 1]);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int compression_bench(int format_int) {
+    SimpleLogger::CompressionFormat format =
+        (SimpleLogger::CompressionFormat)format_int;
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    const uint64_t FILE_SIZE = 8 * 1024 * 1024;
+    const size_t NUM_FILES = 4;
+    SimpleLogger* ll = new SimpleLogger(filename, 256, FILE_SIZE, 0);
+    if (!ll->setCompressionFormat(format)) {
+        TestSuite::_msg("not supported\n");
+        delete ll;
+        SimpleLogger::shutdown();
+        TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+        return 0;
+    }
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+
+    // Until all rotated files are compressed (`stop()` waits for it).
+    TestSuite::Timer tt;
+    uint64_t max_stall_us = 0;
+    std::string payload(100, 'x');
+    const size_t NUM = FILE_SIZE * NUM_FILES / 180;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        _log_info(ll, "%zu %s", ii, payload.c_str());
+        uint64_t us = std::chrono::duration_cast< std::chrono::microseconds >
+                      ( std::chrono::steady_clock::now() - start ).count();
+        max_stall_us = std::max(max_stall_us, us);
+    }
+    uint64_t put_us = tt.getTimeUs();
+    delete ll;
+    uint64_t total_us = tt.getTimeUs();
+
+    size_t num_files = 0;
+    uint64_t comp_size = 0;
+    const char* ext = (format == SimpleLogger::GZIP) ? ".gz" : ".tar.gz";
+    for (size_t ii=0; ; ++ii) {
+        std::string comp_file = ii ? filename + "." + std::to_string(ii)
+                                   : filename;
+        comp_file += ext;
+        if (!TestSuite::exist(comp_file)) break;
+        comp_size += get_file_size(comp_file);
+        num_files++;
+    }
+
+    TestSuite::_msg("%s: %zu files, %.1f ms to log, %.1f ms until "
+                    "compressed, %.1f%% of the size, longest stall %zu us\n",
+                    (format == SimpleLogger::GZIP) ? "gzip" : "tar.gz",
+                    num_files,
+                    put_us / 1000.0,
+                    total_us / 1000.0,
+                    comp_size * 100.0 / (num_files ? num_files * FILE_SIZE : 1),
+                    (size_t)max_stall_us);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int compressor_pool_bench(size_t num_threads) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    num_threads = mgr->setCompressorPool(num_threads);
+
+    // All loggers rotate at once.
+    const size_t NUM_LOGGERS = 8;
+    const uint64_t FILE_SIZE = 8 * 1024 * 1024;
+    std::vector<SimpleLogger*> loggers(NUM_LOGGERS);
+    for (size_t ii=0; ii<NUM_LOGGERS; ++ii) {
+        std::string filename = TestSuite::getTestFileName(prefix) +
+                               "_" + std::to_string(ii) + ".log";
+        loggers[ii] = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+        loggers[ii]->start();
+        loggers[ii]->setDispLevel(-1);
+    }
+    std::string payload(100, 'x');
+    const size_t NUM = FILE_SIZE / 160 + 1;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        for (SimpleLogger* ll: loggers) {
+            _log_info(ll, "%zu %s", ii, payload.c_str());
+        }
+    }
+    for (SimpleLogger* ll: loggers) ll->flushAll();
+
+    // `stop()` waits for the compression.
+    TestSuite::Timer tt;
+    for (SimpleLogger* ll: loggers) delete ll;
+    uint64_t elapsed_us = tt.getTimeUs();
+
+    TestSuite::_msg("%zu compressor threads, %zu files of %zu MB, "
+                    "%.1f ms until compressed\n",
+                    num_threads, NUM_LOGGERS,
+                    (size_t)(FILE_SIZE / 1024 / 1024),
+                    elapsed_us / 1000.0);
+
+    mgr->setCompressorPool(1);
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+// 0: rotate then tar.gz, 1: rotate then gzip, 2: compress-on-write.
+int compress_on_write_bench(int mode) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    const uint64_t FILE_SIZE = 8 * 1024 * 1024;
+    SimpleLogger* ll = new SimpleLogger(filename, 256, FILE_SIZE, 0);
+    bool ok = (mode == 2)
+              ? ll->setCompressOnWrite(true)
+              : ll->setCompressionFormat( (mode == 0) ? SimpleLogger::TAR_GZ
+                                                      : SimpleLogger::GZIP );
+    if (!ok) {
+        TestSuite::_msg("not supported\n");
+        delete ll;
+        SimpleLogger::shutdown();
+        TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+        return 0;
+    }
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+
+    // Until all rotated files are compressed (`stop()` waits for it).
+    // Written bytes include waited child processes (`tar` and its pipe).
+    uint64_t written_begin = get_io_stat("wchar:");
+    uint64_t cpu_begin = get_cpu_us();
+    std::string payload(100, 'x');
+    const size_t NUM = FILE_SIZE * 4 / 180;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        _log_info(ll, "%zu %s", ii, payload.c_str());
+    }
+    delete ll;
+    uint64_t cpu_us = get_cpu_us() - cpu_begin;
+    uint64_t written = get_io_stat("wchar:") - written_begin;
+
+    // Remaining files, in any format.
+    uint64_t stored = 0;
+    for (size_t ii=0; ii<=NUM; ++ii) {
+        std::string path = ii ? filename + "." + std::to_string(ii)
+                              : filename;
+        uint64_t size = get_file_size(path) +
+                        get_file_size(path + ".gz") +
+                        get_file_size(path + ".tar.gz");
+        if (!size && ii) break;
+        stored += size;
+    }
+
+    const char* names[] = {"rotate + tar.gz", "rotate + gzip",
+                           "compress-on-write"};
+    TestSuite::_msg("%-17s: %.1f bytes written/log, %.1f bytes stored/log, "
+                    "%.2f us CPU/log\n",
+                    names[mode],
+                    (double)written / NUM,
+                    (double)stored / NUM,
+                    (double)cpu_us / NUM);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+// Logs of various callsites, with changing numbers and strings.
+static void gen_real_logs(SimpleLogger* ll, size_t num) {
+    std::mt19937_64 rng(1234);
+    const char* tables[] = {"users", "orders", "sessions", "inventory"};
+    const char* hosts[] = {"10.0.3.17", "10.0.3.42", "10.0.7.5"};
+    for (size_t ii=0; ii<num; ++ii) {
+        uint64_t rr = rng();
+        switch (rr % 8) {
+        case 0:
+        case 1:
+        case 2:
+            _log_info(ll, "request %zu from %s:%d completed in %.3f ms, "
+                      "status %d", ii, hosts[rr % 3], (int)(rr % 60000),
+                      (rr % 100000) / 1000.0, (rr % 16) ? 200 : 404);
+            break;
+        case 3:
+        case 4:
+            _log_debug(ll, "cache lookup key user:%zu hit %d, %zu entries",
+                       (size_t)(rr % 100000), (int)(rr % 2),
+                       (size_t)(rr % 4096));
+            break;
+        case 5:
+            _log_warn(ll, "slow query on table %s: %zu rows scanned, "
+                      "%zu returned", tables[rr % 4], (size_t)(rr % 1000000),
+                      (size_t)(rr % 100));
+            break;
+        case 6:
+            _log_trace(ll, "txn %zu commit, %zu bytes, lsn %zu",
+                       (size_t)(rr % 10000000), (size_t)(rr % 65536), ii);
+            break;
+        default:
+            _log_err(ll, "failed to open /data/shard_%d/segment_%zu.db: "
+                     "errno %d", (int)(rr % 32), (size_t)(rr % 1000),
+                     (int)(rr % 3) + 2);
+            break;
+        }
+    }
+}
+
+int dict_compression_bench(size_t segment_size) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Generate 32 MB of logs in a file, and split them into segments.
+    SimpleLogger* ll = new SimpleLogger(filename, 4096, 0, 0);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::TRACE);
+    ll->setDispLevel(-1);
+    gen_real_logs(ll, 32 * 1024 * 1024 / 120);
+    delete ll;
+
+    std::string data;
+    {   std::ifstream fs(filename, std::ios::binary);
+        data.assign( std::istreambuf_iterator<char>(fs),
+                     std::istreambuf_iterator<char>() );
+    }
+    size_t num_segments = std::min((size_t)64, data.size() / segment_size);
+    CHK_GT(num_segments, 0);
+    for (size_t ii=0; ii<num_segments; ++ii) {
+        std::ofstream fs(filename + "." + std::to_string(ii), std::ios::binary);
+        fs.write(data.data() + ii * segment_size, segment_size);
+    }
+
+    // Trained from the first segment, used for all.
+    TestSuite::Timer tt;
+    std::string dict;
+    CHK_Z(SimpleLogger::trainDictionary(filename + ".0", dict));
+    uint64_t train_us = tt.getTimeUs();
+
+    uint64_t gz_us = 0, dict_us = 0, gz_size = 0, dict_size = 0;
+    for (size_t ii=0; ii<num_segments; ++ii) {
+        std::string seg = filename + "." + std::to_string(ii);
+        tt.reset();
+        CHK_Z(SimpleLogger::gzipFile(seg, seg + ".gz"));
+        gz_us += tt.getTimeUs();
+        tt.reset();
+        CHK_Z(SimpleLogger::compressWithDictionary(seg, seg + ".zz", dict));
+        dict_us += tt.getTimeUs();
+        gz_size += get_file_size(seg + ".gz");
+        dict_size += get_file_size(seg + ".zz");
+    }
+
+    // Should be the same as the original.
+    std::string last = filename + "." + std::to_string(num_segments - 1);
+    std::ofstream(filename + ".dict", std::ios::binary) << dict;
+    CHK_Z(SimpleLogger::decompressFile(last + ".zz", last + ".out",
+                                       filename + ".dict"));
+    CHK_EQ(segment_size, get_file_size(last + ".out"));
+
+    uint64_t total = num_segments * segment_size;
+    TestSuite::_msg("%5zu KB x %2zu: dict %zu bytes in %.1f ms, "
+                    "gzip %.2f%% %.1f MB/s, dict %.2f%% %.1f MB/s\n",
+                    segment_size / 1024, num_segments,
+                    dict.size(), train_us / 1000.0,
+                    gz_size * 100.0 / total,
+                    (double)total / (gz_us ? gz_us : 1),
+                    dict_size * 100.0 / total,
+                    (double)total / (dict_us ? dict_us : 1));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite ts(argc, argv);
+
+    ts.options.printTestMessage = true;
+    ts.doTest("flush bench",
+              flush_bench,
+              TestRange<size_t>({(size_t)16, (size_t)128, (size_t)1024}));
+    ts.doTest("multi logger flush bench",
+              multi_logger_flush_bench,
+              TestRange<bool>({false, true}));
+    ts.doTest("rotation stall bench",
+              rotation_stall_bench,
+              TestRange<size_t>({(size_t)1, (size_t)4}));
+    ts.doTest("compression bench",
+              compression_bench,
+              TestRange<int>({(int)SimpleLogger::TAR_GZ,
+                              (int)SimpleLogger::GZIP}));
+    ts.doTest("compressor pool bench",
+              compressor_pool_bench,
+              TestRange<size_t>({(size_t)1, (size_t)4}));
+    ts.doTest("compress on write bench",
+              compress_on_write_bench,
+              TestRange<int>({0, 1, 2}));
+    ts.doTest("dictionary compression bench",
+              dict_compression_bench,
+              TestRange<size_t>({(size_t)16 * 1024,
+                                 (size_t)64 * 1024,
+                                 (size_t)1024 * 1024,
+                                 (size_t)8 * 1024 * 1024}));
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "logger.h"
+
+#include "test_common.h"
+
+#include <random>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using Fmt = SimpleLogger::Fmt;
+
+static std::vector<uint64_t> gen_numbers(size_t num, int max_bits) {
+    std::mt19937_64 rng(1234);
+    std::vector<uint64_t> ret(num);
+    for (uint64_t& val: ret) {
+        // Mixed magnitudes.
+        int bits = 1 + rng() % max_bits;
+        val = rng() >> (64 - bits);
+    }
+    return ret;
+}
+
+static void print_result(const char* name, uint64_t old_us, uint64_t new_us,
+                         size_t num)
+{
+    TestSuite::_msg("%-9s snprintf: %6.1f ns/call, kernel: %6.1f ns/call, "
+                    "%.1fx\n",
+                    name, old_us * 1000.0 / num, new_us * 1000.0 / num,
+                    (double)old_us / (new_us ? new_us : 1));
+}
+
+int unsigned_bench(size_t num) {
+    std::vector<uint64_t> nums = gen_numbers(num, 64);
+    char buf[32];
+    size_t old_len = 0, new_len = 0;
+
+    TestSuite::Timer tt;
+    for (uint64_t val: nums) {
+        old_len += snprintf(buf, sizeof(buf), "%llu", (unsigned long long)val);
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (uint64_t val: nums) {
+        new_len += Fmt::formatUnsigned(buf, val);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    CHK_EQ(old_len, new_len);
+    print_result("unsigned", old_us, new_us, num);
+    return 0;
+}
+
+int signed_bench(size_t num) {
+    std::vector<uint64_t> nums = gen_numbers(num, 64);
+    char buf[32];
+    size_t old_len = 0, new_len = 0;
+
+    TestSuite::Timer tt;
+    for (uint64_t val: nums) {
+        old_len += snprintf(buf, sizeof(buf), "%lld", (long long)val);
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (uint64_t val: nums) {
+        new_len += Fmt::formatSigned(buf, (int64_t)val);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    CHK_EQ(old_len, new_len);
+    print_result("signed", old_us, new_us, num);
+    return 0;
+}
+
+int fixed_bench(size_t num) {
+    std::vector<uint64_t> nums = gen_numbers(num, 10);
+    char buf[32];
+    size_t old_len = 0, new_len = 0;
+
+    // Same as the timestamp: `%02d` and `%03d`.
+    TestSuite::Timer tt;
+    for (uint64_t val: nums) {
+        old_len += snprintf(buf, sizeof(buf), "%02d%03d",
+                            (int)(val % 100), (int)(val % 1000));
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (uint64_t val: nums) {
+        Fmt::formatFixed(buf, val % 100, 2);
+        Fmt::formatFixed(buf + 2, val % 1000, 3);
+        new_len += 5;
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    CHK_EQ(old_len, new_len);
+    print_result("fixed", old_us, new_us, num);
+    return 0;
+}
+
+int hex_bench(size_t num) {
+    std::vector<uint64_t> nums = gen_numbers(num, 64);
+    char buf[32];
+    size_t old_len = 0, new_len = 0;
+
+    TestSuite::Timer tt;
+    for (uint64_t val: nums) {
+        old_len += snprintf(buf, sizeof(buf), "%04llx", (unsigned long long)val);
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (uint64_t val: nums) {
+        new_len += Fmt::formatHex(buf, val, 4);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    CHK_EQ(old_len, new_len);
+    print_result("hex", old_us, new_us, num);
+    return 0;
+}
+
+int double_bench(size_t num) {
+    std::mt19937_64 rng(1234);
+    std::uniform_real_distribution<double> dist(-1e6, 1e6);
+    std::vector<double> nums(num);
+    for (size_t ii=0; ii<num; ++ii) {
+        // Mixed: integral, short decimal, and full precision numbers.
+        switch (ii % 3) {
+        case 0:  nums[ii] = (double)(int64_t)dist(rng);          break;
+        case 1:  nums[ii] = (int64_t)(dist(rng) * 100) / 100.0;  break;
+        default: nums[ii] = dist(rng);                           break;
+        }
+    }
+    char buf[32];
+    size_t dummy = 0;
+
+    // `%.17g` is the simplest way to get round-trip output with `snprintf`.
+    TestSuite::Timer tt;
+    for (double val: nums) {
+        dummy += snprintf(buf, sizeof(buf), "%.17g", val);
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (double val: nums) {
+        dummy += Fmt::formatDouble(buf, val);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    // Should be read back to the same value.
+    for (double val: nums) {
+        buf[Fmt::formatDouble(buf, val)] = 0;
+        CHK_EQ(val, strtod(buf, nullptr));
+    }
+
+    CHK_GT(dummy, 0);
+    print_result("double", old_us, new_us, num);
+
+    // Full precision numbers only, the slowest case of the kernel.
+    for (double& val: nums) val = dist(rng);
+    tt.reset();
+    for (double val: nums) {
+        dummy += snprintf(buf, sizeof(buf), "%.17g", val);
+    }
+    old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (double val: nums) {
+        dummy += Fmt::formatDouble(buf, val);
+    }
+    new_us = tt.getTimeUs();
+    print_result("double17", old_us, new_us, num);
+    return 0;
+}
+
+int float_bench(size_t num) {
+    std::mt19937_64 rng(1234);
+    std::uniform_real_distribution<float> dist(-1e4f, 1e4f);
+    std::vector<float> nums(num);
+    for (size_t ii=0; ii<num; ++ii) {
+        // Mixed: short decimal numbers, and any bit patterns.
+        if (ii % 2) {
+            nums[ii] = (int32_t)(dist(rng) * 100) / 100.0f;
+        } else {
+            uint32_t bits = rng();
+            memcpy(&nums[ii], &bits, sizeof(float));
+            if (!std::isfinite(nums[ii])) nums[ii] = dist(rng);
+        }
+    }
+    char buf[32];
+    size_t dummy = 0;
+
+    // `%.9g` is the simplest way to get round-trip output with `snprintf`.
+    TestSuite::Timer tt;
+    for (float val: nums) {
+        dummy += snprintf(buf, sizeof(buf), "%.9g", val);
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    tt.reset();
+    for (float val: nums) {
+        dummy += Fmt::formatFloat(buf, val);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    // Should be read back to the same value.
+    for (float val: nums) {
+        buf[Fmt::formatFloat(buf, val)] = 0;
+        CHK_EQ(val, strtof(buf, nullptr));
+    }
+
+    CHK_GT(dummy, 0);
+    print_result("float", old_us, new_us, num);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite ts(argc, argv);
+
+    ts.options.printTestMessage = true;
+    TestRange<size_t> range({(size_t)1000000});
+    ts.doTest("unsigned integer bench", unsigned_bench, range);
+    ts.doTest("signed integer bench", signed_bench, range);
+    ts.doTest("fixed width bench", fixed_bench, range);
+    ts.doTest("hex bench", hex_bench, range);
+    ts.doTest("double bench", double_bench, range);
+    ts.doTest("float bench", float_bench, range);
+
+    return 0;
+}
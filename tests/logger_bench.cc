@@ -0,0 +1,458 @@
+#include "logger.h"
+
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+int timestamp_format_bench(size_t num) {
+    int tz_gap = SimpleLoggerMgr::getTzGap();
+    int tz_gap_abs = (tz_gap < 0) ? (tz_gap * -1) : (tz_gap);
+    char buf[64];
+    size_t dummy = 0;
+
+    // `localtime_r` and `snprintf` on every call.
+    TestSuite::Timer tt;
+    for (size_t ii=0; ii<num; ++ii) {
+        SimpleLoggerMgr::TimeInfo lt( std::chrono::system_clock::now() );
+        dummy += snprintf( buf, 64,
+                           "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d ",
+                           lt.year, lt.month, lt.day,
+                           lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
+                           (tz_gap >= 0)?'+':'-',
+                           tz_gap_abs / 60, tz_gap_abs % 60 );
+    }
+    uint64_t old_us = tt.getTimeUs();
+
+    // Cached prefix.
+    SimpleLoggerMgr::TimeCache tc;
+    tt.reset();
+    for (size_t ii=0; ii<num; ++ii) {
+        tc.update(std::chrono::system_clock::now(), tz_gap);
+        dummy += tc.write(buf);
+    }
+    uint64_t new_us = tt.getTimeUs();
+
+    // Clock only, as a baseline.
+    tt.reset();
+    for (size_t ii=0; ii<num; ++ii) {
+        dummy += std::chrono::system_clock::now().time_since_epoch().count() & 0x1;
+    }
+    uint64_t clock_us = tt.getTimeUs();
+
+    TestSuite::_msg("%s\n", buf);
+    TestSuite::_msg("clock only:         %.1f ns/call\n",
+                    clock_us * 1000.0 / num);
+    TestSuite::_msg("localtime+snprintf: %.1f ns/call\n",
+                    old_us * 1000.0 / num);
+    TestSuite::_msg("cached prefix:      %.1f ns/call\n",
+                    new_us * 1000.0 / num);
+    TestSuite::_msg("saving:             %.1f ns/call\n",
+                    ((double)old_us - new_us) * 1000.0 / num);
+    CHK_GT(dummy, 0);
+    return 0;
+}
+
+int put_st_bench(int clock_src) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(-1);
+    ll->setClockSource((SimpleLogger::ClockSource)clock_src);
+
+    TestSuite::Timer tt(1000);
+    uint64_t count = 0;
+    do {
+        for (size_t ii=0; ii<100; ++ii) {
+            _log_info(ll, "log message %zu, %s", (size_t)count, "abcdefg");
+            count++;
+        }
+    } while (!tt.timeover());
+    uint64_t elapsed_us = tt.getTimeUs();
+    delete ll;
+
+    TestSuite::_msg("%s logs, %.1f ns/log, %s ops/s\n",
+                    TestSuite::countToString(count).c_str(),
+                    elapsed_us * 1000.0 / count,
+                    TestSuite::throughputStr(count, elapsed_us).c_str());
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int stream_st_bench() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(-1);
+
+    TestSuite::Timer tt(1000);
+    uint64_t count = 0;
+    do {
+        for (size_t ii=0; ii<100; ++ii) {
+            _s_info(ll) << "log message " << (size_t)count << ", " << "abcdefg";
+            count++;
+        }
+    } while (!tt.timeover());
+    uint64_t elapsed_us = tt.getTimeUs();
+    delete ll;
+
+    TestSuite::_msg("%s logs, %.1f ns/log, %s ops/s\n",
+                    TestSuite::countToString(count).c_str(),
+                    elapsed_us * 1000.0 / count,
+                    TestSuite::throughputStr(count, elapsed_us).c_str());
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+// Mixed integers and strings, with `printf` or `{}` format.
+int fmt_st_bench(bool use_fmt) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(-1);
+
+    const std::string user = "user_name";
+    TestSuite::Timer tt(1000);
+    uint64_t count = 0;
+    do {
+        for (size_t ii=0; ii<100; ++ii) {
+            int64_t elapsed = (int64_t)(count * 37 % 100000);
+            if (use_fmt) {
+                _log_fmt_info(ll, "request {} from {} took {} us, status {}, "
+                              "size {}", count, user, elapsed, "OK",
+                              (int)(count & 0xffff));
+            } else {
+                _log_info(ll, "request %zu from %s took %ld us, status %s, "
+                          "size %d", (size_t)count, user.c_str(),
+                          (long)elapsed, "OK", (int)(count & 0xffff));
+            }
+            count++;
+        }
+    } while (!tt.timeover());
+    uint64_t elapsed_us = tt.getTimeUs();
+    delete ll;
+
+    TestSuite::_msg("%s: %s logs, %.1f ns/log, %s ops/s\n",
+                    use_fmt ? "{} format" : "printf format",
+                    TestSuite::countToString(count).c_str(),
+                    elapsed_us * 1000.0 / count,
+                    TestSuite::throughputStr(count, elapsed_us).c_str());
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+struct PutWorkerArgs {
+    SimpleLogger* ll;
+    TestSuite::Timer* tt;
+    uint64_t count;
+};
+
+void put_worker(PutWorkerArgs* args) {
+    SimpleLogger* ll = args->ll;
+    TestSuite::Timer& tt = *args->tt;
+    uint64_t count = 0;
+    do {
+        for (size_t ii=0; ii<100; ++ii) {
+            _log_info(ll, "log message %zu, %s", (size_t)count, "abcdefg");
+            count++;
+        }
+    } while (!tt.timeover());
+    args->count = count;
+}
+
+int put_mt_bench_internal(const std::string& prefix,
+                          size_t num_threads,
+                          bool per_thread_buffer)
+{
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(-1);
+    ll->setPerThreadBuffer(per_thread_buffer);
+
+    TestSuite::Timer tt(1000);
+    std::vector<std::thread> threads(num_threads);
+    std::vector<PutWorkerArgs> args(num_threads);
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        args[ii].ll = ll;
+        args[ii].tt = &tt;
+        args[ii].count = 0;
+        threads[ii] = std::thread(put_worker, &args[ii]);
+    }
+    uint64_t count = 0;
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        if (threads[ii].joinable()) threads[ii].join();
+        count += args[ii].count;
+    }
+    uint64_t elapsed_us = tt.getTimeUs();
+    delete ll;
+
+    TestSuite::_msg("%zu threads, %s logs, %s ops/s\n",
+                    num_threads,
+                    TestSuite::countToString(count).c_str(),
+                    TestSuite::throughputStr(count, elapsed_us).c_str());
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int put_mt_bench(size_t num_threads) {
+    return put_mt_bench_internal(TEST_SUITE_AUTO_PREFIX, num_threads, false);
+}
+
+int put_mt_per_thread_bench(size_t num_threads) {
+    return put_mt_bench_internal(TEST_SUITE_AUTO_PREFIX, num_threads, true);
+}
+
+int put_oversubscribed_bench(int policy_int) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Small buffer, so that producers often wait for space.
+    SimpleLogger* ll = new SimpleLogger
+                       ( filename, 64, 32*1024*1024, 16,
+                         (SimpleLogger::BackpressurePolicy)policy_int );
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(-1);
+
+    size_t num_cores = std::thread::hardware_concurrency();
+    if (num_cores < 1) num_cores = 1;
+    size_t num_threads = num_cores * 4;
+
+    std::clock_t cpu_begin = std::clock();
+    TestSuite::Timer tt(1000);
+    std::vector<std::thread> threads(num_threads);
+    std::vector<PutWorkerArgs> args(num_threads);
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        args[ii].ll = ll;
+        args[ii].tt = &tt;
+        args[ii].count = 0;
+        threads[ii] = std::thread(put_worker, &args[ii]);
+    }
+    uint64_t count = 0;
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        if (threads[ii].joinable()) threads[ii].join();
+        count += args[ii].count;
+    }
+    uint64_t elapsed_us = tt.getTimeUs();
+    double cpu_us = (double)(std::clock() - cpu_begin) * 1000000 / CLOCKS_PER_SEC;
+    SimpleLogger::BackpressureStats stats = ll->getBackpressureStats();
+    delete ll;
+
+    // CPU usage is relative to all cores.
+    TestSuite::_msg("%zu threads on %zu cores, %s logs, %s ops/s, "
+                    "CPU usage %.1f%%, full %zu, inline flushes %zu\n",
+                    num_threads, num_cores,
+                    TestSuite::countToString(count).c_str(),
+                    TestSuite::throughputStr(count, elapsed_us).c_str(),
+                    cpu_us * 100 / elapsed_us / num_cores,
+                    (size_t)stats.numFull,
+                    (size_t)stats.numInlineFlushes);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int console_mt_bench(size_t num_threads) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setDispLevel(6);
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+
+    // Display all logs to `/dev/null`.
+    mgr->flushConsole();
+    std::cout.flush();
+    int stdout_fd = dup(STDOUT_FILENO);
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    TestSuite::Timer tt(1000);
+    std::vector<std::thread> threads(num_threads);
+    std::vector<PutWorkerArgs> args(num_threads);
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        args[ii].ll = ll;
+        args[ii].tt = &tt;
+        args[ii].count = 0;
+        threads[ii] = std::thread(put_worker, &args[ii]);
+    }
+    uint64_t count = 0;
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        if (threads[ii].joinable()) threads[ii].join();
+        count += args[ii].count;
+    }
+    uint64_t elapsed_us = tt.getTimeUs();
+    mgr->flushConsole();
+    uint64_t num_dropped = mgr->getNumConsoleDropped();
+    delete ll;
+
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+
+    TestSuite::_msg("%zu threads, %s logs, %s ops/s, %zu dropped\n",
+                    num_threads,
+                    TestSuite::countToString(count).c_str(),
+                    TestSuite::throughputStr(count, elapsed_us).c_str(),
+                    (size_t)num_dropped);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int durable_put_bench(size_t num_threads) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setDispLevel(-1);
+    // Every error log waits for `fdatasync`.
+    ll->setDurability(SimpleLogger::SYNC_ON_LEVEL, SimpleLogger::ERROR);
+
+    TestSuite::Timer tt(1000);
+    std::vector<std::thread> threads(num_threads);
+    std::vector<uint64_t> counts(num_threads, 0);
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        threads[ii] = std::thread([ll, &tt, &counts, ii]() {
+            do {
+                _log_err(ll, "durable log %zu", (size_t)counts[ii]);
+                counts[ii]++;
+            } while (!tt.timeover());
+        });
+    }
+    uint64_t count = 0;
+    for (size_t ii=0; ii<num_threads; ++ii) {
+        threads[ii].join();
+        count += counts[ii];
+    }
+    uint64_t elapsed_us = tt.getTimeUs();
+    uint64_t num_syncs = ll->getNumSyncs();
+    delete ll;
+
+    TestSuite::_msg("%zu threads, %s ops/s, %zu syncs, %.1f logs per sync\n",
+                    num_threads,
+                    TestSuite::throughputStr(count, elapsed_us).c_str(),
+                    (size_t)num_syncs,
+                    (double)count / (num_syncs ? num_syncs : 1));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int idle_flush_bench(size_t num_loggers) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    std::vector<SimpleLogger*> loggers(num_loggers);
+    for (size_t ii=0; ii<num_loggers; ++ii) {
+        std::string filename = TestSuite::getTestFileName(prefix) +
+                               "_" + std::to_string(ii) + ".log";
+        loggers[ii] = new SimpleLogger(filename);
+        loggers[ii]->start();
+        loggers[ii]->setDispLevel(-1);
+    }
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    mgr->flushAllLoggers();
+
+    // All loggers are idle.
+    const size_t NUM = 10000;
+    TestSuite::Timer tt;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        mgr->flushAllLoggers();
+    }
+    uint64_t elapsed_us = tt.getTimeUs();
+
+    for (SimpleLogger*& ll: loggers) delete ll;
+
+    TestSuite::_msg("%zu idle loggers, %.1f us per flushing all loggers\n",
+                    num_loggers, (double)elapsed_us / NUM);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite ts(argc, argv);
+
+    ts.options.printTestMessage = true;
+    ts.doTest("timestamp format bench",
+              timestamp_format_bench,
+              TestRange<size_t>({(size_t)1000000}));
+
+    ts.doTest("single thread put bench",
+              put_st_bench,
+              TestRange<int>({(int)SimpleLogger::SYSTEM_CLOCK,
+                              (int)SimpleLogger::COARSE_CLOCK,
+                              (int)SimpleLogger::TSC_CLOCK}));
+
+    ts.doTest("single thread stream bench", stream_st_bench);
+
+    ts.doTest("single thread format bench",
+              fmt_st_bench,
+              TestRange<bool>({false, true}));
+
+    size_t num_cores = std::thread::hardware_concurrency();
+    if (num_cores < 2) num_cores = 2;
+    ts.doTest("multi thread put bench",
+              put_mt_bench,
+              TestRange<size_t>({num_cores, num_cores * 4}));
+
+    ts.doTest("multi thread put bench with per-thread buffer",
+              put_mt_per_thread_bench,
+              TestRange<size_t>({num_cores, num_cores * 4}));
+
+    ts.doTest("multi thread console bench",
+              console_mt_bench,
+              TestRange<size_t>({num_cores, num_cores * 4}));
+
+    ts.doTest("durable put bench",
+              durable_put_bench,
+              TestRange<size_t>({(size_t)1, num_cores * 4}));
+
+    ts.doTest("idle flush bench",
+              idle_flush_bench,
+              TestRange<size_t>({(size_t)60}));
+
+    ts.doTest("oversubscribed put bench",
+              put_oversubscribed_bench,
+              TestRange<int>({(int)SimpleLogger::BLOCK,
+                              (int)SimpleLogger::FLUSH_INLINE}));
+
+    return 0;
+}
@@ -2,6 +2,18 @@
 
 #include "test_common.h"
 
+#include <iomanip>
+#include <random>
+
+#include <fcntl.h>
+#include <math.h>
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    #include <zlib.h>
+#endif
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
 int get_random_level() {
     size_t n = std::rand() & 0xffffff;
     if (n < 16) return 1;
@@ -355,6 +367,1605 @@ int logger_timed_log_test(bool is_global) {
     return 0;
 }
 
+void log_local_format(SimpleLogger* ll) {
+    // Gone when this function returns.
+    const char fmt[] = "local format %d";
+    _log_info(ll, fmt, 4);
+}
+
+void clobber_stack() {
+    volatile char buf[256];
+    for (size_t ii=0; ii<sizeof(buf); ++ii) buf[ii] = 'x';
+}
+
+void log_various_formats(SimpleLogger* ll) {
+    const char* volatile null_str = nullptr;
+    char not_terminated[4] = {'a', 'b', 'c', 'd'};
+    std::string long_str(SimpleLogger::MSG_SIZE * 2, 'x');
+
+    _log_info(ll, "int %d %5i %-5u| %x %X %#o %c %%",
+              -1, 2, 3u, 255, 255, 8, 'z');
+    _log_info(ll, "long %ld %lld %zu %jd %td %hhd %hd",
+              -4L, 5LL, (size_t)6, (intmax_t)7, (ptrdiff_t)8,
+              (signed char)9, (short)10);
+    _log_info(ll, "float %f %.3e %10.4g %Lf %a",
+              3.14, 1e-10, 2.5, (long double)1.5, 0.5);
+    _log_info(ll, "string %s %10s %-10s| %.2s %.*s %*s %s",
+              "abc", "right", "left", "cut", 4, not_terminated,
+              6, "star", null_str);
+    static int anchor = 0;
+    _log_info(ll, "pointer %p %p", (void*)&anchor, (void*)nullptr);
+    _log_info(ll, "long string %s", long_str.c_str());
+    std::string too_long_str(SimpleLogger::MSG_SIZE * 16, 'y');
+    _log_info(ll, "too long string %s", too_long_str.c_str());
+    _log_info(ll, "positional %1$d", 11);
+    ll->put(SimpleLogger::INFO, nullptr, nullptr, 0, "no stack info %d", 12);
+}
+
+int logger_deferred_format_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+    std::string filename_def = TestSuite::getTestFileName(prefix) + "_def.log";
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    SimpleLogger* ll_def = new SimpleLogger(filename_def, 128, 0, 0);
+    ll->start();
+    ll_def->start();
+    ll->setDispLevel(-1);
+    ll_def->setDispLevel(-1);
+    ll_def->setDeferredFormat(true);
+    CHK_TRUE(ll_def->isDeferredFormat());
+
+    log_various_formats(ll);
+    log_various_formats(ll_def);
+
+    // Formats that are not string literals, changed or gone right after
+    // logging: should be the same as the format at the time of logging.
+    char fmt_buf[32];
+    for (SimpleLogger* cur: {ll, ll_def}) {
+        strcpy(fmt_buf, "runtime format %d");
+        _log_info(cur, fmt_buf, 1);
+        const char* fmt_ptr = fmt_buf;
+        _log_info(cur, fmt_ptr, 2);
+        cur->put(SimpleLogger::INFO, __FILE__, __func__, __LINE__, fmt_buf, 3);
+        strcpy(fmt_buf, "changed format %d");
+        log_local_format(cur);
+        clobber_stack();
+    }
+    // Still alive (and changed) when the flusher renders deferred logs.
+    ll->flushAll();
+    ll_def->flushAll();
+    CHK_EQ(std::string("changed format %d"), std::string(fmt_buf));
+
+    delete ll;
+    delete ll_def;
+
+    // Except for timestamp, the contents should be identical.
+    auto read_lines = [](const std::string& path) {
+        std::vector<std::string> lines;
+        std::ifstream fs(path);
+        std::string line;
+        while (std::getline(fs, line)) {
+            if (line.find(" logger: ") != std::string::npos) continue;
+            lines.push_back(line.substr(line.find(' ')));
+        }
+        return lines;
+    };
+    std::vector<std::string> lines = read_lines(filename);
+    std::vector<std::string> lines_def = read_lines(filename_def);
+    CHK_EQ(lines.size(), lines_def.size());
+    CHK_GT(lines.size(), 0);
+    size_t num_runtime = 0;
+    size_t num_local = 0;
+    for (size_t ii=0; ii<lines.size(); ++ii) {
+        CHK_EQ(lines[ii], lines_def[ii]);
+        CHK_EQ(std::string::npos, lines_def[ii].find("changed format"));
+        if (lines_def[ii].find("runtime format") != std::string::npos) num_runtime++;
+        if (lines_def[ii].find("local format 4") != std::string::npos) num_local++;
+    }
+    CHK_EQ(3, num_runtime);
+    CHK_EQ(1, num_local);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_batched_flush_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // More logs than a single `writev` can take, mixed with deferred
+    // ones that are rendered by the flusher, and too long ones.
+    SimpleLogger* ll = new SimpleLogger(filename, 16 * 1024, 0, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+    ll->setDeferredFormat(true);
+
+    const size_t NUM = 5000;
+    std::string long_str(SimpleLogger::MSG_SIZE, 'x');
+    for (size_t ii=0; ii<NUM; ++ii) {
+        if (ii % 100 == 0) {
+            _log_info(ll, "batch %zu %s", ii, long_str.c_str());
+        } else if (ii % 2) {
+            _log_info(ll, "batch %zu", ii);
+        } else {
+            std::string str = "batch " + std::to_string(ii);
+            ll->putRaw(SimpleLogger::INFO, __FILE__, __func__, __LINE__,
+                       str.data(), str.size());
+        }
+    }
+    delete ll;
+
+    std::ifstream fs(filename);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(fs, line)) {
+        size_t begin = line.find("] batch ");
+        if (begin == std::string::npos) continue;
+        std::string expected = "batch " + std::to_string(idx);
+        if (idx % 100 == 0) expected += " " + long_str;
+        CHK_EQ(expected, line.substr(begin + 2, line.find('\t') - begin - 2));
+        idx++;
+    }
+    CHK_EQ(NUM, idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_io_uring_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    bool enabled = mgr->setIoUring(true);
+    CHK_EQ(enabled, mgr->isIoUringEnabled());
+    TestSuite::_msg("io_uring %s\n", enabled ? "enabled" : "not available");
+    uint64_t num_writes = mgr->getNumIoUringWrites();
+
+    // Writes of all loggers are submitted together.
+    const size_t NUM_LOGGERS = 3;
+    const size_t NUM = 3000;
+    std::vector<std::string> filenames(NUM_LOGGERS);
+    std::vector<SimpleLogger*> loggers(NUM_LOGGERS);
+    for (size_t ii=0; ii<NUM_LOGGERS; ++ii) {
+        filenames[ii] = TestSuite::getTestFileName(prefix) +
+                        "_" + std::to_string(ii) + ".log";
+        loggers[ii] = new SimpleLogger(filenames[ii], 16 * 1024, 0, 0);
+        loggers[ii]->start();
+        loggers[ii]->setDispLevel(-1);
+    }
+    for (size_t ii=0; ii<NUM; ++ii) {
+        for (SimpleLogger* ll: loggers) {
+            _log_info(ll, "async %zu", ii);
+        }
+    }
+    mgr->flushAllLoggersAsync();
+    if (enabled) CHK_GT(mgr->getNumIoUringWrites(), num_writes);
+
+    for (SimpleLogger* ll: loggers) delete ll;
+    mgr->setIoUring(false);
+    CHK_FALSE(mgr->isIoUringEnabled());
+
+    for (const std::string& filename: filenames) {
+        std::ifstream fs(filename);
+        std::string line;
+        size_t idx = 0;
+        while (std::getline(fs, line)) {
+            size_t begin = line.find("] async ");
+            if (begin == std::string::npos) continue;
+            CHK_EQ( "async " + std::to_string(idx),
+                    line.substr(begin + 2, line.find('\t') - begin - 2) );
+            idx++;
+        }
+        CHK_EQ(NUM, idx);
+    }
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+static size_t count_lines(const std::string& filename, const std::string& str) {
+    std::ifstream fs(filename);
+    std::string line;
+    size_t ret = 0;
+    while (std::getline(fs, line)) {
+        if (line.find(str) != std::string::npos) ret++;
+    }
+    return ret;
+}
+
+// If the file has a line containing `str`, after `offset`.
+static bool find_line_from(const std::string& filename,
+                           uint64_t offset,
+                           const std::string& str)
+{
+    std::ifstream fs(filename);
+    fs.seekg(offset);
+    std::string line;
+    while (std::getline(fs, line)) {
+        if (line.find(str) != std::string::npos) return true;
+    }
+    return false;
+}
+
+int logger_durability_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setDispLevel(-1);
+    CHK_EQ(SimpleLogger::NO_SYNC, ll->getDurability());
+
+    // Written, but not synced.
+    for (size_t ii=0; ii<100; ++ii) _log_info(ll, "written %zu", ii);
+    ll->flushBarrier(SimpleLogger::WRITTEN);
+    CHK_EQ(100, count_lines(filename, "] written "));
+    CHK_Z(ll->getNumSyncs());
+
+    // Error logs are durable when they return.
+    ll->setDurability(SimpleLogger::SYNC_ON_LEVEL, SimpleLogger::ERROR);
+    _log_err(ll, "durable error");
+    CHK_EQ(1, count_lines(filename, "] durable error"));
+    uint64_t num_syncs = ll->getNumSyncs();
+    CHK_GT(num_syncs, 0);
+    _log_info(ll, "not durable");
+    CHK_EQ(num_syncs, ll->getNumSyncs());
+
+    // Concurrent barriers share syncs. Each caller's own log should be
+    // in the file when the barrier returns, even if other threads are
+    // still writing theirs to the shared ring.
+    const size_t NUM_THREADS = 8;
+    const size_t NUM_FILLERS = 4;
+    const size_t NUM = 100;
+    std::atomic<bool> stop_fillers(false);
+    std::vector<std::thread> fillers(NUM_FILLERS);
+    for (size_t ii=0; ii<NUM_FILLERS; ++ii) {
+        fillers[ii] = std::thread([ll, &stop_fillers]() {
+            for (size_t jj=0; jj<20000 && !stop_fillers; ++jj) {
+                _log_info(ll, "filler %zu", jj);
+            }
+        });
+    }
+    std::atomic<size_t> num_missing(0);
+    std::vector<std::thread> threads(NUM_THREADS);
+    for (size_t ii=0; ii<NUM_THREADS; ++ii) {
+        threads[ii] = std::thread([ll, ii, NUM, &filename, &num_missing]() {
+            for (size_t jj=0; jj<NUM; ++jj) {
+                std::string str = "barrier " + std::to_string(ii) +
+                                  " " + std::to_string(jj) + "\t";
+                // Appended after the current end of the file.
+                struct stat st;
+                if (stat(filename.c_str(), &st) != 0) st.st_size = 0;
+                _log_info(ll, "%s", str.c_str());
+                ll->flushBarrier(SimpleLogger::WRITTEN);
+                if (!find_line_from(filename, st.st_size, "] " + str)) {
+                    num_missing++;
+                }
+                ll->flushBarrier();
+            }
+        });
+    }
+    for (std::thread& tt: threads) tt.join();
+    stop_fillers = true;
+    for (std::thread& tt: fillers) tt.join();
+    CHK_Z(num_missing.load());
+    CHK_EQ(NUM_THREADS * NUM, count_lines(filename, "] barrier "));
+    num_syncs = ll->getNumSyncs() - num_syncs;
+    CHK_GT(num_syncs, 0);
+    CHK_SMEQ(num_syncs, NUM_THREADS * NUM);
+    TestSuite::_msg("%zu barriers, %zu syncs\n",
+                    NUM_THREADS * NUM, (size_t)num_syncs);
+
+    delete ll;
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_rotation_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Less than a file per round, at most one rotation per round.
+    const size_t FILE_SIZE = 64 * 1024;
+    const size_t NUM_ROUNDS = 10;
+    const size_t LOGS_PER_ROUND = 200;
+    SimpleLogger* ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    std::string payload(100, 'x');
+    for (size_t ii=0; ii<NUM_ROUNDS; ++ii) {
+        // Give the background thread time to prepare the next file.
+        TestSuite::sleep_ms(50);
+        for (size_t jj=0; jj<LOGS_PER_ROUND; ++jj) {
+            _log_info(ll, "round %zu %s", ii, payload.c_str());
+        }
+        ll->flushAll();
+    }
+    CHK_Z(ll->getNumSlowRotations());
+    delete ll;
+
+    // Previous files are compressed, and the current one is kept.
+    size_t last = 1;
+    while ( TestSuite::exist(filename + "." + std::to_string(last) + ".gz") ||
+            TestSuite::exist(filename + "." + std::to_string(last) + ".tar.gz") ) {
+        last++;
+    }
+    CHK_GTEQ(last, 3);
+    std::string last_file = filename + "." + std::to_string(last);
+    CHK_TRUE(TestSuite::exist(last_file));
+    CHK_EQ(1, count_lines(last_file, "Stop logger: "));
+    // The one prepared for the next is removed.
+    CHK_FALSE(TestSuite::exist(filename + "." + std::to_string(last + 1)));
+    // Preallocated space is released.
+    struct stat st;
+    CHK_Z(stat(last_file.c_str(), &st));
+    CHK_SMEQ((uint64_t)st.st_blocks * 512, (uint64_t)st.st_size + FILE_SIZE);
+
+    // Crashed with the next file prepared (empty): the last one is
+    // continued.
+    std::ofstream(filename + "." + std::to_string(last + 1));
+    ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+    _log_info(ll, "after crash");
+    delete ll;
+    CHK_EQ(1, count_lines(last_file, "after crash"));
+    CHK_FALSE(TestSuite::exist(filename + "." + std::to_string(last + 1)));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_rotation_stop_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    // Each log is bigger than a file, so that every flush by this
+    // thread rotates, back to back, while the background thread keeps
+    // preparing the next file. The logger stops right after one of
+    // them: no log in the active file should be lost.
+    const size_t FILE_SIZE = 4 * 1024;
+    const size_t NUM_ITERATIONS = 50;
+    std::string payload(FILE_SIZE, 'x');
+    std::atomic<bool> stop_kicker(false);
+    std::thread kicker([&stop_kicker]() {
+        SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+        while (!stop_kicker) mgr->invokeFlusher();
+    });
+    for (size_t ii=0; ii<NUM_ITERATIONS; ++ii) {
+        std::string filename = TestSuite::getTestFileName(prefix) +
+                               "_" + std::to_string(ii) + ".log";
+        SimpleLogger* ll = new SimpleLogger(filename, 1, FILE_SIZE, 0);
+        ll->start();
+        ll->setDispLevel(-1);
+        const size_t num_logs_put = 10 + ii % 10;
+        for (size_t jj=0; jj<num_logs_put; ++jj) {
+            _log_info(ll, "stop %zu %s", jj, payload.c_str());
+            // Rotate in this thread.
+            ll->flushAll();
+        }
+        ll->stop();
+        delete ll;
+
+        // Rotated files are compressed. `gzread()` reads uncompressed
+        // files as they are.
+        size_t num_logs = 0;
+        size_t num_stops = 0;
+        for (size_t rr=0; rr<=num_logs_put + 2; ++rr) {
+            std::string path = filename;
+            if (rr) path += "." + std::to_string(rr);
+            if (!TestSuite::exist(path)) path += ".gz";
+            if (!TestSuite::exist(path)) continue;
+            gzFile gz = gzopen(path.c_str(), "rb");
+            CHK_NONNULL(gz);
+            char buf[4096];
+            std::string data;
+            int ret = 0;
+            while ((ret = gzread(gz, buf, sizeof(buf))) > 0) data.append(buf, ret);
+            gzclose(gz);
+
+            std::istringstream ss(data);
+            std::string line;
+            while (std::getline(ss, line)) {
+                if (line.find("] stop ") != std::string::npos) num_logs++;
+                if (line.find("] Stop logger: ") != std::string::npos) num_stops++;
+            }
+        }
+        CHK_EQ(num_logs_put, num_logs);
+        CHK_EQ(1, num_stops);
+    }
+    stop_kicker = true;
+    kicker.join();
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_rotation_under_load_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Producers keep the buffer busy: each flush pass should still end,
+    // so that files are rotated at about the size limit.
+    const size_t FILE_SIZE = 64 * 1024;
+    SimpleLogger* ll = new SimpleLogger(filename, 1, FILE_SIZE, 0,
+                                        SimpleLogger::BLOCK);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    const size_t NUM_THREADS = 4;
+    std::atomic<bool> stop(false);
+    std::thread tid[NUM_THREADS];
+    for (size_t ii=0; ii<NUM_THREADS; ++ii) {
+        tid[ii] = std::thread([ll, ii, &stop]() {
+            size_t seq = 0;
+            while (!stop) {
+                _log_info(ll, "thread %zu seq %zu", ii, seq++);
+            }
+        });
+    }
+    TestSuite::sleep_ms(500);
+    stop = true;
+    for (size_t ii=0; ii<NUM_THREADS; ++ii) {
+        if (tid[ii].joinable()) tid[ii].join();
+    }
+    delete ll;
+
+    // At most a pass (a buffer, the smallest one is 4 messages) more
+    // than the limit.
+    const size_t MAX_FILE_SIZE = FILE_SIZE + 2 * 4 * SimpleLogger::MSG_SIZE;
+    size_t num_files = 0;
+    for (size_t idx = 1; ; ++idx) {
+        std::string path = filename + "." + std::to_string(idx) + ".gz";
+        if (!TestSuite::exist(path)) break;
+        gzFile gz = gzopen(path.c_str(), "rb");
+        CHK_NONNULL(gz);
+        char buf[4096];
+        size_t size = 0;
+        int ret = 0;
+        while ((ret = gzread(gz, buf, sizeof(buf))) > 0) size += ret;
+        gzclose(gz);
+        CHK_SMEQ(size, MAX_FILE_SIZE);
+        num_files++;
+    }
+    CHK_GT(num_files, 0);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_compression_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Archive of the old format.
+    std::ofstream(filename + ".3.tar.gz") << "dummy";
+
+    const size_t FILE_SIZE = 64 * 1024;
+    SimpleLogger* ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    CHK_EQ(SimpleLogger::GZIP, ll->getCompressionFormat());
+    ll->start();
+    ll->setDispLevel(-1);
+    // Should continue after the old archive.
+    CHK_TRUE(TestSuite::exist(filename + ".4"));
+
+    const size_t NUM = 1000;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        _log_info(ll, "compressed %zu", ii);
+    }
+    ll->flushAll();
+    delete ll;
+
+    // Rotated file is compressed and removed.
+    CHK_FALSE(TestSuite::exist(filename + ".4"));
+    CHK_TRUE(TestSuite::exist(filename + ".4.gz"));
+
+    // All logs, in the compressed file and the current one.
+    size_t idx = 0;
+    gzFile gz = gzopen((filename + ".4.gz").c_str(), "rb");
+    CHK_NONNULL(gz);
+    char buf[1024];
+    while (gzgets(gz, buf, sizeof(buf))) {
+        const char* pos = strstr(buf, "] compressed ");
+        if (!pos) continue;
+        CHK_EQ(idx, (size_t)atoi(pos + 13));
+        idx++;
+    }
+    gzclose(gz);
+    CHK_GT(idx, 0);
+
+    std::ifstream fs(filename + ".5");
+    std::string line;
+    while (std::getline(fs, line)) {
+        size_t pos = line.find("] compressed ");
+        if (pos == std::string::npos) continue;
+        CHK_EQ(idx, (size_t)atoi(line.c_str() + pos + 13));
+        idx++;
+    }
+    CHK_EQ(NUM, idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_retention_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string base = TestSuite::getTestFileName(prefix);
+    std::string file_a = base + "_a.log";
+    std::string file_b = base + "_b.log";
+    std::string file_c = base + "_c.log";
+
+    // Rotated files of the previous run, with the given age.
+    auto make_file = [](const std::string& path, time_t age_sec) {
+        std::ofstream(path) << std::string(1000, 'x');
+        struct utimbuf times;
+        times.actime = times.modtime = time(nullptr) - age_sec;
+        utime(path.c_str(), &times);
+    };
+    make_file(file_a + ".1.gz", 7200);
+    make_file(file_a + ".2.gz", 300);
+    make_file(file_a + ".3.gz", 200);
+    make_file(file_b + ".1.gz", 400);
+    make_file(file_b + ".2.gz", 100);
+
+    SimpleLogger* ll_a = new SimpleLogger(file_a, 1024, 0, 0);
+    SimpleLogger* ll_b = new SimpleLogger(file_b, 1024, 0, 0);
+    // Up to an hour.
+    ll_a->setRetentionPolicy(SimpleLogger::RetentionPolicy(0, 0, 3600));
+    CHK_EQ(3600, ll_a->getRetentionPolicy().maxAgeSec);
+    // Zero means no limit in both ways.
+    ll_b->setMaxLogFiles(5);
+    CHK_EQ(5, ll_b->getRetentionPolicy().maxFiles);
+    ll_b->setMaxLogFiles(0);
+    CHK_EQ(0, ll_b->getRetentionPolicy().maxFiles);
+    ll_a->start();
+    ll_b->start();
+    ll_a->setDispLevel(-1);
+    ll_b->setDispLevel(-1);
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    mgr->enforceRetention();
+    CHK_FALSE(TestSuite::exist(file_a + ".1.gz"));
+    CHK_TRUE(TestSuite::exist(file_a + ".2.gz"));
+
+    // Up to 3 files of all loggers: the oldest one of any logger.
+    mgr->setGlobalRetentionPolicy(SimpleLogger::RetentionPolicy(3));
+    mgr->enforceRetention();
+    CHK_FALSE(TestSuite::exist(file_b + ".1.gz"));
+    CHK_TRUE(TestSuite::exist(file_a + ".2.gz"));
+    CHK_TRUE(TestSuite::exist(file_a + ".3.gz"));
+    CHK_TRUE(TestSuite::exist(file_b + ".2.gz"));
+
+    // Up to 2000 bytes of all loggers.
+    mgr->setGlobalRetentionPolicy(SimpleLogger::RetentionPolicy(0, 2000));
+    mgr->enforceRetention();
+    CHK_FALSE(TestSuite::exist(file_a + ".2.gz"));
+    CHK_TRUE(TestSuite::exist(file_a + ".3.gz"));
+    CHK_TRUE(TestSuite::exist(file_b + ".2.gz"));
+    mgr->setGlobalRetentionPolicy(SimpleLogger::RetentionPolicy());
+    delete ll_a;
+    delete ll_b;
+
+    // Rotated by this logger, up to 8 KB.
+    const size_t FILE_SIZE = 16 * 1024;
+    const uint64_t MAX_BYTES = 8 * 1024;
+    SimpleLogger* ll_c = new SimpleLogger(file_c, 1024, FILE_SIZE, 0);
+    ll_c->setRetentionPolicy(SimpleLogger::RetentionPolicy(0, MAX_BYTES));
+    ll_c->start();
+    ll_c->setDispLevel(-1);
+    const size_t NUM = 10000;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        _log_info(ll_c, "retention %zu", ii);
+        if (ii % 200 == 0) ll_c->flushAll();
+    }
+    delete ll_c;
+
+    uint64_t total_bytes = 0;
+    size_t num_files = 0;
+    for (size_t ii=1; ii<NUM; ++ii) {
+        std::string path = file_c + "." + std::to_string(ii);
+        for (const char* suffix: {".gz", ".tar.gz"}) {
+            struct stat st;
+            if (stat((path + suffix).c_str(), &st) != 0) continue;
+            total_bytes += st.st_size;
+            num_files++;
+        }
+    }
+    CHK_GT(num_files, 0);
+    CHK_SMEQ(total_bytes, MAX_BYTES);
+    CHK_FALSE(TestSuite::exist(file_c + ".gz"));
+    CHK_FALSE(TestSuite::exist(file_c + ".tar.gz"));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_dict_compression_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    const size_t FILE_SIZE = 64 * 1024;
+    const size_t MAX_FILES = 4;
+    SimpleLogger* ll = new SimpleLogger(filename, 1024, FILE_SIZE, MAX_FILES);
+    CHK_TRUE(ll->setCompressionFormat(SimpleLogger::ZLIB_DICT));
+    ll->setDictRetrainInterval(2);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    const size_t NUM = 5000;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        _log_info(ll, "dict %zu key %zu value %zu", ii, ii % 7, ii * 31);
+        // Rotate many times.
+        if (ii % 200 == 0) ll->flushAll();
+    }
+    delete ll;
+
+    // Remaining files are decompressed with their dictionaries.
+    std::vector<size_t> indices;
+    auto read_lines = [&](const std::string& path) {
+        std::ifstream fs(path);
+        std::string line;
+        while (std::getline(fs, line)) {
+            size_t pos = line.find("] dict ");
+            if (pos == std::string::npos) continue;
+            indices.push_back(atoi(line.c_str() + pos + 7));
+        }
+    };
+    size_t num_zz = 0;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        std::string path = ii ? filename + "." + std::to_string(ii) : filename;
+        if (TestSuite::exist(path + ".zz")) {
+            CHK_Z(SimpleLogger::decompressFile(path + ".zz", path + ".out"));
+            read_lines(path + ".out");
+            num_zz++;
+        } else if (TestSuite::exist(path)) {
+            read_lines(path);
+        }
+    }
+    CHK_EQ(MAX_FILES, num_zz);
+    CHK_GT(indices.size(), 0);
+    for (size_t ii=1; ii<indices.size(); ++ii) {
+        CHK_EQ(indices[ii-1] + 1, indices[ii]);
+    }
+    CHK_EQ(NUM - 1, indices.back());
+
+    // The first dictionary is not used anymore.
+    CHK_FALSE(TestSuite::exist(filename + ".zdict"));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_compress_on_write_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Read logs in the given gzip file, should be in order.
+    auto read_gz = [](const std::string& path, size_t& idx) -> int {
+        gzFile gz = gzopen(path.c_str(), "rb");
+        CHK_NONNULL(gz);
+        char buf[1024];
+        while (gzgets(gz, buf, sizeof(buf))) {
+            const char* pos = strstr(buf, "] cow ");
+            if (!pos) continue;
+            CHK_EQ(idx, (size_t)atoi(pos + 6));
+            idx++;
+        }
+        gzclose(gz);
+        return 0;
+    };
+
+    // Limit of the compressed size.
+    const size_t FILE_SIZE = 16 * 1024;
+    SimpleLogger* ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    CHK_TRUE(ll->setCompressOnWrite(true));
+    CHK_TRUE(ll->isCompressOnWrite());
+    ll->start();
+    ll->setDispLevel(-1);
+    // Cannot be changed while running.
+    CHK_FALSE(ll->setCompressOnWrite(false));
+    // The next file is prepared, without preallocation.
+    struct stat st_next;
+    CHK_Z(stat((filename + ".1.gz").c_str(), &st_next));
+    CHK_Z(st_next.st_blocks);
+    CHK_TRUE(TestSuite::exist(filename + ".gz"));
+    CHK_FALSE(TestSuite::exist(filename));
+
+    // Readable while the file is being written.
+    const size_t NUM1 = 100;
+    for (size_t ii=0; ii<NUM1; ++ii) {
+        _log_info(ll, "cow %zu", ii);
+    }
+    ll->flushAll();
+    size_t idx = 0;
+    CHK_Z(read_gz(filename + ".gz", idx));
+    CHK_EQ(NUM1, idx);
+
+    // Rotated files are complete gzip files.
+    const size_t NUM2 = 20000;
+    for (size_t ii=NUM1; ii<NUM2; ++ii) {
+        _log_info(ll, "cow %zu", ii);
+    }
+    ll->flushAll();
+    delete ll;
+
+    CHK_TRUE(TestSuite::exist(filename + ".1.gz"));
+    CHK_FALSE(TestSuite::exist(filename + ".1"));
+    idx = 0;
+    CHK_Z(read_gz(filename + ".gz", idx));
+    size_t num_files = 1;
+    while (TestSuite::exist(filename + "." + std::to_string(num_files) + ".gz")) {
+        CHK_Z(read_gz(filename + "." + std::to_string(num_files) + ".gz", idx));
+        num_files++;
+    }
+    CHK_EQ(NUM2, idx);
+    TestSuite::_msg("%zu logs in %zu files\n", idx, num_files);
+
+    // Restart: a new gzip member is appended to the last file.
+    std::string last_file = filename + "." + std::to_string(num_files - 1) + ".gz";
+    std::string next_file = filename + "." + std::to_string(num_files) + ".gz";
+    struct stat st;
+    CHK_Z(stat(last_file.c_str(), &st));
+    uint64_t last_size = st.st_size;
+    const size_t NUM3 = NUM2 + 10;
+    ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    CHK_TRUE(ll->setCompressOnWrite(true));
+    ll->start();
+    ll->setDispLevel(-1);
+    for (size_t ii=NUM2; ii<NUM3; ++ii) {
+        _log_info(ll, "cow %zu", ii);
+    }
+    delete ll;
+    CHK_FALSE(TestSuite::exist(next_file));
+    CHK_Z(stat(last_file.c_str(), &st));
+    CHK_GT((uint64_t)st.st_size, last_size);
+
+    // Crash: the last member is flushed but not finished, followed by
+    // a partial block.
+    const size_t NUM4 = NUM3 + 10;
+    {   z_stream zs;
+        memset(&zs, 0x0, sizeof(zs));
+        CHK_EQ(Z_OK, deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                  15 + 16, 8, Z_DEFAULT_STRATEGY));
+        std::string in, out;
+        for (size_t ii=NUM3; ii<NUM4; ++ii) {
+            in += "[crashed] cow " + std::to_string(ii) + "\n";
+        }
+        auto do_deflate = [&](int mode) {
+            char buf[4096];
+            zs.next_in = (Bytef*)in.data();
+            zs.avail_in = in.size();
+            do {
+                zs.next_out = (Bytef*)buf;
+                zs.avail_out = sizeof(buf);
+                deflate(&zs, mode);
+                out.append(buf, sizeof(buf) - zs.avail_out);
+            } while (zs.avail_out == 0);
+        };
+        do_deflate(Z_SYNC_FLUSH);
+        size_t flushed = out.size();
+        in = "lost logs, never flushed\n";
+        do_deflate(Z_FINISH);
+        deflateEnd(&zs);
+        std::ofstream fs(last_file, std::ios::app | std::ios::binary);
+        fs.write(out.data(), flushed + (out.size() - flushed) / 2);
+    }
+
+    const size_t NUM5 = NUM4 + 10;
+    ll = new SimpleLogger(filename, 1024, FILE_SIZE, 0);
+    CHK_TRUE(ll->setCompressOnWrite(true));
+    ll->start();
+    ll->setDispLevel(-1);
+    for (size_t ii=NUM4; ii<NUM5; ++ii) {
+        _log_info(ll, "cow %zu", ii);
+    }
+    delete ll;
+    CHK_FALSE(TestSuite::exist(next_file));
+
+    // Complete, and all logs are in order.
+    CHK_Z(SimpleLogger::decompressFile(last_file, last_file + ".out"));
+    idx = 0;
+    for (size_t ii=0; ii<num_files; ++ii) {
+        CHK_Z(read_gz(ii ? filename + "." + std::to_string(ii) + ".gz"
+                         : filename + ".gz", idx));
+    }
+    CHK_EQ(NUM5, idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_compressor_pool_test() {
+#if defined(SIMPLELOGGER_WITH_ZLIB)
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+    size_t num_threads = mgr->setCompressorPool(4, 10);
+    CHK_GT(num_threads, 0);
+    CHK_SMEQ(num_threads, 4);
+    CHK_EQ(num_threads, mgr->getNumCompressors());
+    TestSuite::_msg("%zu compressor threads\n", num_threads);
+
+    // Rotated at once, files are bigger than a compression block.
+    const size_t NUM_LOGGERS = 3;
+    const size_t FILE_SIZE = 10 * 1024 * 1024;
+    const size_t NUM = FILE_SIZE / 100 + 1;
+    std::vector<std::string> filenames(NUM_LOGGERS);
+    std::vector<SimpleLogger*> loggers(NUM_LOGGERS);
+    for (size_t ii=0; ii<NUM_LOGGERS; ++ii) {
+        filenames[ii] = TestSuite::getTestFileName(prefix) +
+                        "_" + std::to_string(ii) + ".log";
+        loggers[ii] = new SimpleLogger(filenames[ii], 1024, FILE_SIZE, 0);
+        loggers[ii]->start();
+        loggers[ii]->setDispLevel(-1);
+    }
+    std::string payload(64, 'x');
+    for (size_t ii=0; ii<NUM; ++ii) {
+        for (SimpleLogger* ll: loggers) {
+            _log_info(ll, "pool %zu %s", ii, payload.c_str());
+        }
+    }
+    for (SimpleLogger* ll: loggers) delete ll;
+
+    // Logs in order, from the compressed file to the current one.
+    for (const std::string& filename: filenames) {
+        CHK_FALSE(TestSuite::exist(filename));
+        // Compressed blocks are merged, and their part files are removed.
+        CHK_FALSE(TestSuite::exist(filename + ".gz.part0"));
+        CHK_FALSE(TestSuite::exist(filename + ".gz.part1"));
+        gzFile gz = gzopen((filename + ".gz").c_str(), "rb");
+        CHK_NONNULL(gz);
+        size_t idx = 0;
+        char buf[1024];
+        while (gzgets(gz, buf, sizeof(buf))) {
+            const char* pos = strstr(buf, "] pool ");
+            if (!pos) continue;
+            CHK_EQ(idx, (size_t)atoi(pos + 7));
+            idx++;
+        }
+        gzclose(gz);
+
+        std::ifstream fs(filename + ".1");
+        std::string line;
+        while (std::getline(fs, line)) {
+            size_t pos = line.find("] pool ");
+            if (pos == std::string::npos) continue;
+            CHK_EQ(idx, (size_t)atoi(line.c_str() + pos + 7));
+            idx++;
+        }
+        CHK_EQ(NUM, idx);
+    }
+
+    CHK_EQ(1, mgr->setCompressorPool(1, 0));
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+#endif
+    return 0;
+}
+
+int logger_long_message_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    // Longer than `MSG_SIZE`, but fits in the buffer.
+    std::string long_str(SimpleLogger::MSG_SIZE * 2 + 123, 'x');
+    // Longer than the buffer, should be truncated.
+    std::string too_long_str(SimpleLogger::MSG_SIZE * 64, 'y');
+    for (size_t ii=0; ii<10; ++ii) {
+        _log_info(ll, "long %s end", long_str.c_str());
+        _log_info(ll, "too long %s end", too_long_str.c_str());
+    }
+    delete ll;
+
+    std::ifstream fs(filename);
+    std::string line;
+    size_t num_long = 0, num_too_long = 0;
+    while (std::getline(fs, line)) {
+        if (line.find(" too long ") != std::string::npos) {
+            CHK_GT(line.size(), long_str.size());
+            CHK_SM(line.size(), too_long_str.size());
+            CHK_EQ(std::string::npos, line.find(" end"));
+            num_too_long++;
+        } else if (line.find(" long ") != std::string::npos) {
+            CHK_NEQ(std::string::npos, line.find(long_str + " end\t["));
+            CHK_NEQ(std::string::npos, line.find("logger_long_message_test()]"));
+            num_long++;
+        }
+    }
+    CHK_EQ(10, num_long);
+    CHK_EQ(10, num_too_long);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_per_thread_buffer_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+    ll->setPerThreadBuffer(true, 64);
+    CHK_TRUE(ll->isPerThreadBuffer());
+
+    // Short-lived threads, their buffers should be reused.
+    const size_t NUM_ROUNDS = 10;
+    const size_t NUM_THREADS = 4;
+    const size_t NUM_LOGS = 1000;
+    for (size_t ii=0; ii<NUM_ROUNDS; ++ii) {
+        std::thread tid[NUM_THREADS];
+        for (size_t jj=0; jj<NUM_THREADS; ++jj) {
+            size_t thread_num = ii * NUM_THREADS + jj;
+            tid[jj] = std::thread([ll, thread_num, NUM_LOGS]() {
+                for (size_t kk=0; kk<NUM_LOGS; ++kk) {
+                    _log_info(ll, "thread %zu seq %zu", thread_num, kk);
+                }
+            });
+        }
+        for (size_t jj=0; jj<NUM_THREADS; ++jj) {
+            if (tid[jj].joinable()) tid[jj].join();
+        }
+    }
+    delete ll;
+
+    // All logs should exist, in order for each thread.
+    std::vector<size_t> next_seq(NUM_ROUNDS * NUM_THREADS, 0);
+    std::ifstream fs(filename);
+    std::string line;
+    while (std::getline(fs, line)) {
+        size_t pos = line.find(" thread ");
+        if (pos == std::string::npos) continue;
+        size_t thread_num = 0, seq = 0;
+        CHK_EQ(2, sscanf(line.c_str() + pos, " thread %zu seq %zu",
+                         &thread_num, &seq));
+        CHK_SM(thread_num, next_seq.size());
+        CHK_EQ(next_seq[thread_num], seq);
+        next_seq[thread_num]++;
+    }
+    for (size_t seq: next_seq) CHK_EQ(NUM_LOGS, seq);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_backpressure_test(int policy_int) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger::BackpressurePolicy policy =
+        (SimpleLogger::BackpressurePolicy)policy_int;
+    // The smallest buffer, to make it full.
+    SimpleLogger* ll = new SimpleLogger(filename, 1, 0, 0, policy);
+    ll->start();
+    ll->setDispLevel(-1);
+    CHK_EQ(policy, ll->getBackpressurePolicy());
+
+    const size_t NUM_THREADS = 4;
+    const size_t NUM_LOGS = 10000;
+    std::thread tid[NUM_THREADS];
+    for (size_t ii=0; ii<NUM_THREADS; ++ii) {
+        tid[ii] = std::thread([ll, ii, NUM_LOGS]() {
+            for (size_t jj=0; jj<NUM_LOGS; ++jj) {
+                _log_info(ll, "thread %zu seq %zu", ii, jj);
+            }
+        });
+    }
+    for (size_t ii=0; ii<NUM_THREADS; ++ii) {
+        if (tid[ii].joinable()) tid[ii].join();
+    }
+    ll->flushAll();
+    SimpleLogger::BackpressureStats stats = ll->getBackpressureStats();
+    delete ll;
+
+    // Logs of each thread should be in order, except for dropped ones.
+    std::vector<size_t> next_seq(NUM_THREADS, 0);
+    size_t num_logs = 0;
+    std::ifstream fs(filename);
+    std::string line;
+    while (std::getline(fs, line)) {
+        if (line.find("Start logger: ") != std::string::npos) {
+            num_logs++;
+            continue;
+        }
+        size_t pos = line.find(" thread ");
+        if (pos == std::string::npos) continue;
+        size_t thread_num = 0, seq = 0;
+        CHK_EQ(2, sscanf(line.c_str() + pos, " thread %zu seq %zu",
+                         &thread_num, &seq));
+        CHK_SM(thread_num, NUM_THREADS);
+        CHK_GTEQ(seq, next_seq[thread_num]);
+        next_seq[thread_num] = seq + 1;
+        num_logs++;
+    }
+    // Including "Start logger" log.
+    CHK_EQ(NUM_THREADS * NUM_LOGS + 1, num_logs + stats.numDropped);
+
+    switch (policy) {
+    case SimpleLogger::BLOCK:
+        CHK_Z(stats.numDropped);
+        CHK_Z(stats.numInlineFlushes);
+        break;
+    case SimpleLogger::DROP_NEW:
+    case SimpleLogger::OVERWRITE_OLDEST:
+        CHK_Z(stats.numInlineFlushes);
+        if (stats.numFull) CHK_GT(stats.numDropped, 0);
+        break;
+    case SimpleLogger::FLUSH_INLINE:
+    default:
+        CHK_Z(stats.numDropped);
+        break;
+    }
+    TestSuite::_msg("full %zu, dropped %zu, inline flushes %zu\n",
+                    (size_t)stats.numFull,
+                    (size_t)stats.numDropped,
+                    (size_t)stats.numInlineFlushes);
+
+    if (policy == SimpleLogger::BLOCK) {
+        // Not started, nobody else drains the buffer: should not block.
+        ll = new SimpleLogger(filename, 1, 0, 0, policy);
+        ll->setDispLevel(-1);
+        for (size_t ii=0; ii<NUM_LOGS; ++ii) {
+            _log_info(ll, "not started %zu", ii);
+        }
+        CHK_GT(ll->getBackpressureStats().numInlineFlushes, 0);
+        delete ll;
+    }
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_stream_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    // Longer than `MSG_SIZE`, but fits in the buffer.
+    std::string long_str(SimpleLogger::MSG_SIZE * 2, 'x');
+    std::vector<std::string> expected;
+
+    _s_info(ll) << "int " << -123 << " " << (short)-5 << " " << 0
+                << " " << INT64_MIN << " " << UINT64_MAX;
+    expected.push_back("int -123 -5 0 -9223372036854775808 "
+                       "18446744073709551615");
+
+    _s_info(ll) << "float " << 3.14 << " " << 1e-10 << " " << 2.5f
+                << " " << 123456789.0;
+    expected.push_back("float 3.14 1e-10 2.5 1.23457e+08");
+
+    const char* c_str = "abc";
+    _s_info(ll) << "str " << c_str << " " << std::string("def")
+                << " " << 'g' << " " << true;
+    expected.push_back("str abc def g 1");
+
+    // Non-default format.
+    _s_info(ll) << "hex " << std::hex << 255 << " "
+                << std::setw(5) << std::setfill('0') << 42;
+    expected.push_back("hex ff 0002a");
+
+    // Should not affect the next log.
+    _s_info(ll) << "dec " << 255 << " " << std::setprecision(3) << 3.14159;
+    expected.push_back("dec 255 3.14");
+
+    _s_info(ll) << "long " << long_str;
+    expected.push_back("long " + long_str);
+
+    delete ll;
+
+    std::ifstream fs(filename);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(fs, line)) {
+        if (line.find("[INFO] ") == std::string::npos) continue;
+        size_t begin = line.find("[INFO] ") + 7;
+        size_t end = line.find("\t[");
+        CHK_SM(idx, expected.size());
+        CHK_EQ(expected[idx], line.substr(begin, end - begin));
+        idx++;
+    }
+    CHK_EQ(expected.size(), idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_fmt_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    ll->start();
+    ll->setDispLevel(-1);
+
+    static_assert(SimpleLogger::Fmt::countPlaceholders("a {} b {}") == 2, "");
+    static_assert(SimpleLogger::Fmt::countPlaceholders("{{}} {}") == 1, "");
+    static_assert(SimpleLogger::Fmt::countPlaceholders("a { b") == -1, "");
+    static_assert(SimpleLogger::Fmt::countPlaceholders("a } b") == -1, "");
+    // Longer than the constexpr depth limit (512 by default).
+#define _X10(s) s s s s s s s s s s
+    static_assert(SimpleLogger::Fmt::countPlaceholders
+                  ( _X10(_X10("0123456789")) _X10("{} {{}} ") ) == 10, "");
+#undef _X10
+
+    std::string long_str(SimpleLogger::MSG_SIZE * 2, 'x');
+    std::vector<std::string> expected;
+
+    _log_fmt_info(ll, "no args");
+    expected.push_back("no args");
+
+    _log_fmt_info(ll, "int {} {} {} {} {}",
+                  -123, (short)-5, 0, INT64_MIN, UINT64_MAX);
+    expected.push_back("int -123 -5 0 -9223372036854775808 "
+                       "18446744073709551615");
+
+    // Shortest round-trip.
+    _log_fmt_info(ll, "float {} {} {} {} {} {}",
+                  3.14, 1e-10, 2.5f, 0.1f, 123456789.0, 0.1 + 0.2);
+    expected.push_back("float 3.14 1e-10 2.5 0.1 123456789 "
+                       "0.30000000000000004");
+
+    const char* c_str = "abc";
+    const char* null_str = nullptr;
+    _log_fmt_info(ll, "str {} {} {} {} {}",
+                  c_str, std::string("def"), 'g', true, null_str);
+    expected.push_back("str abc def g true (null)");
+
+    _log_fmt_info(ll, "ptr {}", (void*)0x1234);
+    expected.push_back("ptr 0x1234");
+
+    _log_fmt_info(ll, "{{escaped}} {}{}", 1, 2);
+    expected.push_back("{escaped} 12");
+
+    _log_fmt_info(ll, "long {}", long_str);
+    expected.push_back("long " + long_str);
+
+    delete ll;
+
+    std::ifstream fs(filename);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(fs, line)) {
+        if (line.find("[INFO] ") == std::string::npos) continue;
+        size_t begin = line.find("[INFO] ") + 7;
+        size_t end = line.find("\t[");
+        CHK_SM(idx, expected.size());
+        CHK_EQ(expected[idx], line.substr(begin, end - begin));
+        idx++;
+    }
+    CHK_EQ(expected.size(), idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int fmt_kernel_test() {
+    using Fmt = SimpleLogger::Fmt;
+    std::mt19937_64 rng(1234);
+    char buf[64];
+    char expected[64];
+
+    for (size_t ii=0; ii<100000; ++ii) {
+        // Mixed magnitudes.
+        uint64_t val = rng() >> (rng() % 64);
+
+        buf[Fmt::formatUnsigned(buf, val)] = 0;
+        snprintf(expected, 64, "%llu", (unsigned long long)val);
+        CHK_EQ(std::string(expected), std::string(buf));
+
+        buf[Fmt::formatSigned(buf, (int64_t)val)] = 0;
+        snprintf(expected, 64, "%lld", (long long)val);
+        CHK_EQ(std::string(expected), std::string(buf));
+
+        buf[Fmt::formatHex(buf, val, 4)] = 0;
+        snprintf(expected, 64, "%04llx", (unsigned long long)val);
+        CHK_EQ(std::string(expected), std::string(buf));
+
+        // Upper digits are dropped.
+        Fmt::formatFixed(buf, (uint32_t)val, 3);
+        buf[3] = 0;
+        snprintf(expected, 64, "%03u", (unsigned)((uint32_t)val % 1000));
+        CHK_EQ(std::string(expected), std::string(buf));
+
+        double dval = 0;
+        memcpy(&dval, &val, sizeof(dval));
+        if (ii % 2) dval = (int64_t)val / 1000.0;
+        if (!std::isfinite(dval)) continue;
+        buf[Fmt::formatDouble(buf, dval)] = 0;
+        CHK_EQ(dval, strtod(buf, nullptr));
+        // No fewer significant digits can read back.
+        std::string digits;
+        for (const char* pp = buf; *pp && *pp != 'e'; ++pp) {
+            if (*pp >= '0' && *pp <= '9') digits += *pp;
+        }
+        digits.erase(0, digits.find_first_not_of('0'));
+        digits.erase(digits.find_last_not_of('0') + 1);
+        if (digits.size() > 1) {
+            snprintf(expected, 64, "%.*e", (int)digits.size() - 2, dval);
+            CHK_NEQ(dval, strtod(expected, nullptr));
+        }
+        // Same as `%.15g` if it is enough to read back.
+        snprintf(expected, 64, "%.15g", dval);
+        if (std::isnormal(dval) && strtod(expected, nullptr) == dval) {
+            CHK_EQ(std::string(expected), std::string(buf));
+        }
+    }
+
+    buf[Fmt::formatSigned(buf, INT64_MIN)] = 0;
+    CHK_EQ(std::string("-9223372036854775808"), std::string(buf));
+    buf[Fmt::formatHex(buf, 0, 1)] = 0;
+    CHK_EQ(std::string("0"), std::string(buf));
+    buf[Fmt::formatDouble(buf, -0.0)] = 0;
+    CHK_EQ(std::string("-0"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 0.0001)] = 0;
+    CHK_EQ(std::string("0.0001"), std::string(buf));
+    buf[Fmt::formatDouble(buf, -12.5)] = 0;
+    CHK_EQ(std::string("-12.5"), std::string(buf));
+    // 16 digits are enough.
+    buf[Fmt::formatDouble(buf, 1.0 / 3)] = 0;
+    CHK_EQ(std::string("0.3333333333333333"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 0.1 + 0.2)] = 0;
+    CHK_EQ(std::string("0.30000000000000004"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 1e21)] = 0;
+    CHK_EQ(std::string("1e+21"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 123456789012345680.0)] = 0;
+    CHK_EQ(std::string("1.2345678901234568e+17"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 1.23456789012345e-200)] = 0;
+    CHK_EQ(std::string("1.23456789012345e-200"), std::string(buf));
+    buf[Fmt::formatDouble(buf, -1.5e-7)] = 0;
+    CHK_EQ(std::string("-1.5e-07"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 0.000123456789012345)] = 0;
+    CHK_EQ(std::string("0.000123456789012345"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 1.23456789012345e+300)] = 0;
+    CHK_EQ(std::string("1.23456789012345e+300"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 4.9e-324)] = 0;
+    CHK_EQ(std::string("5e-324"), std::string(buf));
+    buf[Fmt::formatDouble(buf, 1.7976931348623157e+308)] = 0;
+    CHK_EQ(std::string("1.7976931348623157e+308"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 3.14f)] = 0;
+    CHK_EQ(std::string("3.14"), std::string(buf));
+    buf[Fmt::formatFloat(buf, -0.0f)] = 0;
+    CHK_EQ(std::string("-0"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 1e6f)] = 0;
+    CHK_EQ(std::string("1e+06"), std::string(buf));
+    // 7 digits or more, written as `%.9g`.
+    buf[Fmt::formatFloat(buf, 1234567.0f)] = 0;
+    CHK_EQ(std::string("1234567"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 16777216.0f)] = 0;
+    CHK_EQ(std::string("16777216"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 0.1f + 0.2f)] = 0;
+    CHK_EQ(std::string("0.3"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 1.0f / 3)] = 0;
+    CHK_EQ(std::string("0.33333334"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 3.4028235e+38f)] = 0;
+    CHK_EQ(std::string("3.4028235e+38"), std::string(buf));
+    buf[Fmt::formatFloat(buf, 1e-45f)] = 0;
+    CHK_EQ(std::string("1e-45"), std::string(buf));
+
+    return 0;
+}
+
+void callsite_func_a(SimpleLogger* ll, int idx) {
+    _log_trace(ll, "trace a %d", idx);
+    _log_info(ll, "info a %d", idx);
+}
+
+void callsite_func_b(SimpleLogger* ll, int idx) {
+    _s_trace(ll) << "trace b " << idx;
+    _log_fmt_info(ll, "info b {}", idx);
+}
+
+void callsite_func_pending(SimpleLogger* ll) {
+    _log_info(ll, "pending");
+}
+
+int logger_callsite_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    // Hit before the manager exists, taken by the manager later.
+    CHK_NULL(SimpleLoggerMgr::getWithoutInit());
+    callsite_func_pending(nullptr);
+
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 0, 0);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+
+    // Follow the log level: info only.
+    callsite_func_a(ll, 0);
+    callsite_func_b(ll, 0);
+    size_t num_callsites = mgr->getNumCallsites();
+    CHK_GTEQ(num_callsites, 5);
+    CHK_EQ(1, mgr->disableCallsites("logger_test.cc", "callsite_func_pending"));
+
+    // Trace of `callsite_func_a` only.
+    CHK_EQ(2, mgr->enableCallsites("logger_test.cc", "*_func_a"));
+    callsite_func_a(ll, 1);
+    callsite_func_b(ll, 1);
+
+    // Rules apply to all levels. Pattern with `/` matches the full path.
+    CHK_EQ(2, mgr->disableCallsites("*/tests/logger_test.cc", "callsite_func_b"));
+    CHK_EQ(0, mgr->disableCallsites("logger_test.cc", "callsite_func_c"));
+    callsite_func_a(ll, 2);
+    callsite_func_b(ll, 2);
+
+    // Later rule wins.
+    CHK_EQ(2, mgr->enableCallsites("logger_?est.cc", "callsite_func_b"));
+    callsite_func_b(ll, 3);
+
+    // Back to normal.
+    mgr->resetCallsites();
+    callsite_func_a(ll, 4);
+    callsite_func_b(ll, 4);
+    CHK_EQ(num_callsites, mgr->getNumCallsites());
+
+    // Another logger with a different level: trace is enabled for it,
+    // but not for `ll`.
+    SimpleLogger* ll2 = new SimpleLogger(TestSuite::getTestFileName(prefix) +
+                                         "_2.log", 128, 0, 0);
+    ll2->start();
+    ll2->setLogLevel(SimpleLogger::TRACE);
+    ll2->setDispLevel(-1);
+    callsite_func_a(ll, 5);
+    delete ll2;
+    callsite_func_a(ll, 6);
+
+    delete ll;
+
+    std::vector<std::string> expected =
+        { "info a 0", "info b 0",
+          "trace a 1", "info a 1", "info b 1",
+          "trace a 2", "info a 2",
+          "trace b 3", "info b 3",
+          "info a 4", "info b 4",
+          "info a 5", "info a 6" };
+    std::ifstream fs(filename);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(fs, line)) {
+        if (line.find(" a ") == std::string::npos &&
+            line.find(" b ") == std::string::npos) continue;
+        size_t begin = line.find("] ", line.find("] [") + 3) + 2;
+        size_t end = line.find("\t[");
+        CHK_SM(idx, expected.size());
+        CHK_EQ(expected[idx], line.substr(begin, end - begin));
+        idx++;
+    }
+    CHK_EQ(expected.size(), idx);
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_sequential_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+
+    // Only one logger at a time: once the first one stops, no logger
+    // is running, which should not disable the second one's logs.
+    std::vector<std::string> filenames;
+    for (size_t ii=0; ii<2; ++ii) {
+        filenames.push_back( TestSuite::getTestFileName(prefix) +
+                             "_" + std::to_string(ii) + ".log" );
+        SimpleLogger* ll = new SimpleLogger(filenames[ii], 128, 0, 0);
+        ll->start();
+        ll->setDispLevel(-1);
+        _log_info(ll, "sequential %zu", ii);
+        ll->stop();
+        delete ll;
+    }
+
+    for (const std::string& filename: filenames) {
+        CHK_EQ(1, count_lines(filename, "] Start logger: "));
+        CHK_EQ(1, count_lines(filename, "] sequential "));
+        CHK_EQ(1, count_lines(filename, "] Stop logger: "));
+    }
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+static size_t num_console_renders = 0;
+
+static size_t console_render(char* out, size_t out_size, const void* ctx) {
+    num_console_renders++;
+    return snprintf(out, out_size, "%s", (const char*)ctx);
+}
+
+int logger_console_test() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+    std::string console_file = TestSuite::getTestFileName(prefix) + ".out";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(SimpleLogger::INFO);
+    SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
+
+    // Redirect stdout to a file, after writing queued logs.
+    mgr->flushConsole();
+    std::cout.flush();
+    fflush(stdout);
+    int stdout_fd = dup(STDOUT_FILENO);
+    int fd = open(console_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    CHK_GTEQ(fd, 0);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    const size_t NUM = 1000;
+    for (size_t ii=0; ii<NUM; ++ii) {
+        _log_info(ll, "console %zu", ii);
+    }
+    _log_debug(ll, "not displayed");
+
+    // The message is rendered once for both file and console,
+    // and twice if it is longer than `MSG_SIZE`.
+    std::string long_msg = "console " + std::to_string(NUM + 1) + " " +
+                           std::string(SimpleLogger::MSG_SIZE, 'x');
+    ll->putWith( SimpleLogger::INFO, __FILE__, __func__, __LINE__,
+                 console_render, "console 1000" );
+    CHK_EQ(1, num_console_renders);
+    ll->putWith( SimpleLogger::INFO, __FILE__, __func__, __LINE__,
+                 console_render, long_msg.c_str() );
+    CHK_EQ(3, num_console_renders);
+    mgr->flushConsole();
+
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+    CHK_Z(mgr->getNumConsoleDropped());
+
+    // In order, and without color codes as it is not a terminal.
+    std::ifstream fs(console_file);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(fs, line)) {
+        CHK_EQ(std::string::npos, line.find("\033["));
+        CHK_EQ(std::string::npos, line.find("not displayed"));
+        // Header line first, and then the message.
+        if (line.find(" [") == 0) {
+            CHK_NEQ(std::string::npos, line.find("[INFO] [logger_test.cc:"));
+            continue;
+        }
+        if (idx == NUM + 1) {
+            CHK_EQ(long_msg, line);
+        } else {
+            CHK_EQ("console " + std::to_string(idx), line);
+        }
+        idx++;
+    }
+    CHK_EQ(NUM + 2, idx);
+
+    delete ll;
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int logger_clock_source_test(int src_int) {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger::ClockSource src = (SimpleLogger::ClockSource)src_int;
+    SimpleLogger* ll = new SimpleLogger(filename, 128, 1024*1024, 0);
+    ll->start();
+    ll->setLogLevel(6);
+    ll->setClockSource(src);
+    CHK_EQ(src, ll->getClockSource());
+
+    // Coarse clock's resolution is a few milliseconds.
+    const int64_t MAX_GAP_US = 100 * 1000;
+    TestSuite::Timer tt(1200);
+    std::chrono::system_clock::time_point last = SimpleLogger::getCurrentTime(ll);
+    size_t count = 0;
+    do {
+        std::chrono::system_clock::time_point cur = SimpleLogger::getCurrentTime(ll);
+        std::chrono::system_clock::time_point sys = std::chrono::system_clock::now();
+        int64_t gap_us = std::chrono::duration_cast<std::chrono::microseconds>
+                         (sys - cur).count();
+        CHK_SMEQ(std::abs(gap_us), MAX_GAP_US);
+        if (src == SimpleLogger::TSC_CLOCK) {
+            // Slewed by calibration, but should not go backward.
+            CHK_SMEQ(last.time_since_epoch().count(), cur.time_since_epoch().count());
+        }
+        last = cur;
+
+        if (count++ % 1000 == 0) {
+            _log_debug(ll, "clock source %d, gap %ld us", src_int, (long)gap_us);
+            SimpleLoggerMgr::calibrateTscClock();
+        }
+    } while (!tt.timeover());
+
+    if (src == SimpleLogger::TSC_CLOCK) {
+        // Wall time is stepped backward: should follow it, not freeze.
+        const int64_t STEP_NS = 10LL * 1000 * 1000 * 1000;
+        int64_t sys_ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+                         ( std::chrono::system_clock::now().time_since_epoch() )
+                         .count();
+        SimpleLoggerMgr::calibrateTscClock(sys_ns - STEP_NS);
+        last = SimpleLogger::getCurrentTime(ll);
+        int64_t gap_us = std::chrono::duration_cast<std::chrono::microseconds>
+                         (std::chrono::system_clock::now() - last).count();
+        CHK_GTEQ(gap_us, STEP_NS / 2000);
+
+        TestSuite::sleep_ms(10);
+        std::chrono::system_clock::time_point cur = SimpleLogger::getCurrentTime(ll);
+        CHK_GT(cur.time_since_epoch().count(), last.time_since_epoch().count());
+
+        // And stepped forward again.
+        SimpleLoggerMgr::calibrateTscClock();
+        cur = SimpleLogger::getCurrentTime(ll);
+        gap_us = std::chrono::duration_cast<std::chrono::microseconds>
+                 (std::chrono::system_clock::now() - cur).count();
+        CHK_SMEQ(std::abs(gap_us), MAX_GAP_US);
+    }
+
+    delete ll;
+
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
 int logger_init_twice_test() {
     const std::string prefix = TEST_SUITE_AUTO_PREFIX;
     TestSuite::clearTestFile(prefix);
@@ -419,5 +2030,55 @@ int main(int argc, char** argv) {
     ts.doTest("logger init twice test",
               logger_init_twice_test);
 
+    ts.doTest("deferred format test",
+              logger_deferred_format_test);
+
+    ts.doTest("long message test", logger_long_message_test);
+
+    ts.doTest("batched flush test", logger_batched_flush_test);
+
+    ts.doTest("io_uring test", logger_io_uring_test);
+
+    ts.doTest("durability test", logger_durability_test);
+
+    ts.doTest("rotation test", logger_rotation_test);
+
+    ts.doTest("rotation stop test", logger_rotation_stop_test);
+    ts.doTest("rotation under load test", logger_rotation_under_load_test);
+
+    ts.doTest("compression test", logger_compression_test);
+
+    ts.doTest("compressor pool test", logger_compressor_pool_test);
+    ts.doTest("compress on write test", logger_compress_on_write_test);
+    ts.doTest("dictionary compression test", logger_dict_compression_test);
+    ts.doTest("retention test", logger_retention_test);
+
+    ts.doTest("per-thread buffer test", logger_per_thread_buffer_test);
+
+    ts.doTest("stream test", logger_stream_test);
+
+    ts.doTest("format test", logger_fmt_test);
+
+    ts.doTest("format kernel test", fmt_kernel_test);
+
+    ts.doTest("callsite test", logger_callsite_test);
+
+    ts.doTest("sequential loggers test", logger_sequential_test);
+
+    ts.doTest("console test", logger_console_test);
+
+    ts.doTest("backpressure test",
+              logger_backpressure_test,
+              TestRange<int>({(int)SimpleLogger::BLOCK,
+                              (int)SimpleLogger::DROP_NEW,
+                              (int)SimpleLogger::OVERWRITE_OLDEST,
+                              (int)SimpleLogger::FLUSH_INLINE}));
+
+    ts.doTest("clock source test",
+              logger_clock_source_test,
+              TestRange<int>({(int)SimpleLogger::SYSTEM_CLOCK,
+                              (int)SimpleLogger::COARSE_CLOCK,
+                              (int)SimpleLogger::TSC_CLOCK}));
+
     return 0;
 }
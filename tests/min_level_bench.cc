@@ -0,0 +1,91 @@
+// Built twice: with the default `SIMPLELOGGER_MIN_LEVEL`, and with
+// `SIMPLELOGGER_MIN_LEVEL=4` (DEBUG and TRACE are removed), to compare
+// the binary size and the cost of disabled callsites.
+#include "logger.h"
+
+#include "test_common.h"
+
+#include <sys/stat.h>
+
+static const char* my_path = nullptr;
+static size_t num_evals = 0;
+
+static int eval_arg() {
+    return (int)++num_evals;
+}
+
+#define _STR(x) #x
+#define _XSTR(x) _STR(x)
+// Each callsite has its own string literal.
+#define DEBUG_TRACE_PAIR(ll)                                            \
+    _log_debug(ll, "debug callsite " _XSTR(__COUNTER__) " %d", eval_arg()); \
+    _s_trace(ll) << "trace callsite " _XSTR(__COUNTER__) " " << eval_arg();
+#define DEBUG_TRACE_10(ll)                                              \
+    DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll)      \
+    DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll)      \
+    DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll) DEBUG_TRACE_PAIR(ll)      \
+    DEBUG_TRACE_PAIR(ll)
+
+// 100 callsites (50 debug, 50 trace).
+static void log_callsites(SimpleLogger* ll) {
+    DEBUG_TRACE_10(ll) DEBUG_TRACE_10(ll) DEBUG_TRACE_10(ll)
+    DEBUG_TRACE_10(ll) DEBUG_TRACE_10(ll)
+}
+
+int binary_size_bench() {
+    struct stat st;
+    CHK_Z(stat(my_path, &st));
+    TestSuite::_msg("SIMPLELOGGER_MIN_LEVEL %d, binary size %zu bytes\n",
+                    SIMPLELOGGER_MIN_LEVEL, (size_t)st.st_size);
+    return 0;
+}
+
+int disabled_callsite_bench() {
+    const std::string prefix = TEST_SUITE_AUTO_PREFIX;
+    TestSuite::clearTestFile(prefix);
+    std::string filename = TestSuite::getTestFileName(prefix) + ".log";
+
+    SimpleLogger* ll = new SimpleLogger(filename);
+    ll->start();
+    ll->setLogLevel(SimpleLogger::INFO);
+    ll->setDispLevel(-1);
+
+    // Disabled by the runtime level (or removed at compile time).
+    num_evals = 0;
+    TestSuite::Timer tt(1000);
+    uint64_t count = 0;
+    do {
+        for (size_t ii=0; ii<100; ++ii) {
+            log_callsites(ll);
+            count += 100;
+        }
+    } while (!tt.timeover());
+    uint64_t elapsed_us = tt.getTimeUs();
+    CHK_Z(num_evals);
+
+    TestSuite::_msg("SIMPLELOGGER_MIN_LEVEL %d, %.2f ns/callsite\n",
+                    SIMPLELOGGER_MIN_LEVEL, elapsed_us * 1000.0 / count);
+
+    // Enabled by the runtime level: arguments are evaluated only if
+    // the callsites are compiled in.
+    ll->setLogLevel(SimpleLogger::TRACE);
+    num_evals = 0;
+    log_callsites(ll);
+    CHK_EQ(_SL_LEVEL_ENABLED(SimpleLogger::DEBUG) ? 100 : 0, num_evals);
+
+    delete ll;
+    SimpleLogger::shutdown();
+    TestSuite::clearTestFile(prefix, TestSuite::END_OF_TEST);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite ts(argc, argv);
+    my_path = argv[0];
+
+    ts.options.printTestMessage = true;
+    ts.doTest("binary size bench", binary_size_bench);
+    ts.doTest("disabled callsite bench", disabled_callsite_bench);
+
+    return 0;
+}